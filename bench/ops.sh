@@ -0,0 +1,47 @@
+#!/bin/sh
+# Microbenchmark for the arithmetic builtins on long variadic calls
+# like (+ 1 2 3 ... 1000). Prints the cost of each operation in ns.
+#
+# Usage: sh bench/ops.sh [altbat binary] [terms] [calls]
+#
+# Each operator is timed with 1 and with 'terms' arguments, the
+# difference divided by the number of extra operands is the cost of
+# one operation (including evaluating its operand).
+
+ALTBAT=${1:-./altbat}
+TERMS=${2:-1000}
+CALLS=${3:-2000}
+
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+# Write a script calling (op 1 2 ... terms) 'calls' times
+gen() {
+	{
+		printf '(def {bench} (\\ {n} {if (== n 0) {0} {bench (- n (len (list (%s ' "$1"
+		seq 1 "$2" | tr '\n' ' '
+		printf '))))}}))\n'
+		printf '(bench %s)\n' "$CALLS"
+	} > "$DIR/bench.abat"
+}
+
+# Seconds taken to run the script, optimizer disabled so nothing is folded
+# Best of 3 runs to reduce noise
+run() {
+	for i in 1 2 3; do
+		start=$(date +%s.%N)
+		"$ALTBAT" -O0 "$DIR/bench.abat" > /dev/null
+		end=$(date +%s.%N)
+		echo "$start $end"
+	done | awk '{ t = $2 - $1; if(NR == 1 || t < min) min = t } END { print min }'
+}
+
+for op in + - '*' div max; do
+	gen "$op" 1
+	one=$(run)
+	gen "$op" "$TERMS"
+	all=$(run)
+
+	echo "$op $all $one" | awk -v n="$TERMS" -v c="$CALLS" \
+		'{ printf "%-4s %8.2f ns/op\n", $1, ($2 - $3) * 1e9 / ((n - 1) * c) }'
+done
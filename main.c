@@ -1,7 +1,32 @@
+// The JIT and generators need functions that are not part of C99, so they are only built where they exist
+#if defined(__unix__)
+#define _DEFAULT_SOURCE
+
+#if defined(__x86_64__) && !defined(ALTBAT_NO_JIT)
+#define ALTBAT_JIT
+#endif
+
+#ifndef ALTBAT_NO_GEN
+#define ALTBAT_GEN
+#endif
+#endif
+
+// Vector kernels use SSE2 and AVX through compiler intrinsics, which one is picked when they are first used
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(ALTBAT_NO_SIMD)
+#define ALTBAT_SIMD
+#endif
+
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <ctype.h>
+#include <limits.h>
+#include <time.h>
+
+#ifdef ALTBAT_SIMD
+#include <immintrin.h>
+#endif
 
 #include "./libs/mpc/mpc.h"
 
@@ -35,6 +60,24 @@ void add_history(char* unused) {}
 // To be able to use linux arrow keys
 #include <editline.h>
 
+// To load compiled scripts
+#include <dlfcn.h>
+
+#if defined(ALTBAT_JIT) || defined(ALTBAT_GEN)
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#ifdef ALTBAT_GEN
+#include <ucontext.h>
+#endif
+
+// To run the compiler for --emit-c
+#ifdef __unix__
+#include <unistd.h>
+#include <sys/wait.h>
+#endif
+
 #endif
 
 /**
@@ -73,8 +116,19 @@ mpc_parser_t* Altbat;
 // Foward declarations
 struct bval;
 struct benv;
+struct bmemo;
+struct bjit;
 typedef struct bval bval;
 typedef struct benv benv; // Environment
+typedef struct bmemo bmemo; // Cache of a memoized function
+typedef struct bjit bjit; // Native code of a lambda
+typedef struct bpromise bpromise; // Delayed expression and its value once forced
+typedef struct bgen bgen; // Generator running on its own stack
+typedef struct bvec bvec; // Contiguous doubles of a vector
+typedef struct bdict bdict; // Hash map from values to values
+typedef struct bbuilder bbuilder; // Text of a string builder
+typedef struct bdfa bdfa; // Regex compiled to a DFA
+typedef struct brange brange; // Numbers from start to stop, made when they are read
 
 // Visp Value
 
@@ -82,40 +136,234 @@ typedef struct benv benv; // Environment
 enum BTypes {
 	BVAL_ERR,
 	BVAL_NUM,
+	BVAL_INT,
 	BVAL_SYM,
 	BVAL_STR,
 
 	BVAL_FUN,
+	BVAL_PART,
+	BVAL_MEMO,
 	BVAL_SEXPR,
-	BVAL_QEXPR
+	BVAL_QEXPR,
+
+	BVAL_GUARD,
+	BVAL_PROMISE,
+	BVAL_LSEQ,
+	BVAL_GEN,
+	BVAL_VEC,
+	BVAL_DICT,
+	BVAL_BUILDER,
+	BVAL_REGEX,
+	BVAL_RANGE
 };
 
 // Function pointer type
 // "To get an bval* we dereference bbuiltin and call it with a benv* and a bval*"
 typedef bval*(*bbuiltin)(benv*, bval*);
 
+// Fast path of a builtin, called with the arguments directly instead of a S-Expression
+// The caller owns argv, a builtin can take an argument by setting its slot to NULL
+typedef bval*(*bfast)(benv*, int, bval**);
+
 // New bval struct
 struct bval {
 	int type;
 
-	/* Basic */
-	double num;
-	char* err;
-	char* sym;
-	char* str;
-
-	/* Function */
-	bbuiltin builtin;
-	benv* env;
-	bval* formals;
-	bval* body;
-
 	/* Expression */
 	// Count and Pointer to a list of "bval*"
 	// We will also need to keep track of how many lval* are in this list
+	// A partial function keeps its bound arguments here, and a lazy sequence its first element
 	int count; // e.g. list {1 2} -> count = 1, because "list" is the operator, so it doens't counts and {1 2} is a QExpr, so counts as one cell (with two cell of type BVAL_NUM inside)
 	struct bval** cell; /* which points to a location where we store a list of lval*. More specifically pointers to the other individual bval \
 	└ e.g. (list {1 2}) -> "{ 1 2 }" is the first cell, it's count is 2 (because have two cells of type BVAL_NUM inside) */
+
+	// Only the fields of 'type' are used, so they share the same memory
+	union {
+		/* Basic */
+		struct {
+			double num;
+			char* err; // An error with num = 1 is a 'break'
+		};
+		long long integer;
+		char* sym;
+		struct {
+			char* str;
+			long len; // Length of str, so it is never scanned for its end
+		};
+
+		/* Function */
+		struct {
+			bbuiltin builtin;
+			bfast fast; // NULL if builtin has no fast path
+			bfast special; // If not NULL called with the arguments unevaluated, which it must leave as they are
+			bval* formals;
+			bval* body;
+			int* refs; // Copies of a lambda share formals and body, this counts them
+			bjit* jit; // Shared like formals and body
+		};
+
+		/* Partial Function */
+		bval* fn; // Function called, the bound arguments are in cell
+
+		/* Memoized Function */
+		bmemo* memo; // Shared by all copies
+
+		/* Lazy */
+		bpromise* promise; // Shared by all copies. For a lazy sequence, its rest, the first element is in cell
+		bgen* gen; // Shared by all copies
+
+		/* Vector */
+		bvec* vec; // Shared by all copies, vectors are never changed once built
+
+		/* Dictionary */
+		bdict* dict; // Shared by all copies, set and del return a new dictionary
+
+		/* String Builder */
+		bbuilder* builder; // Shared by all copies, appending to one appends to all of them
+
+		/* Regex */
+		bdfa* dfa; // Shared by all copies
+
+		/* Range */
+		brange* range; // Shared by all copies, tail makes a new one
+
+		/* Inline Guard */
+		struct {
+			int site;       // Index in inline_sites
+			bval* inlined;  // Call with the function body substituted
+			bval* fallback; // Original call
+		};
+	};
+};
+
+
+// Cached result of a memoized function
+typedef struct bmemo_entry {
+	bval* args; // Arguments of the call, as a S-Expression
+	bval* val;
+	unsigned long hash;
+	struct bmemo_entry* next; // Next in the same bucket
+	struct bmemo_entry* newer; // Least recently used order
+	struct bmemo_entry* older;
+} bmemo_entry;
+
+struct bmemo {
+	int refs; // Number of BVAL_MEMO sharing it
+	bval* fn;
+
+	size_t count;
+	size_t max; // Least recently used entries are evicted after this
+	size_t buckets_num; // Power of two, doubled as entries are added
+	bmemo_entry** buckets;
+	bmemo_entry* newest;
+	bmemo_entry* oldest;
+
+	long hits;
+	long misses;
+};
+
+enum PromiseState { PROMISE_PENDING, PROMISE_RUNNING, PROMISE_DONE };
+
+struct bpromise {
+	int refs; // Number of values sharing it
+	int state;
+	bval* expr; // Q-Expression evaluated when forced, NULL once done
+	benv* env;  // Local variables expr uses, as they were when delayed
+	bval* value;
+};
+
+enum GenState { GEN_NEW, GEN_RUNNING, GEN_SUSPENDED, GEN_DONE };
+
+struct bgen {
+	int refs; // Number of values sharing it
+	int state;
+	int closing;    // Set when it is deleted while suspended
+	bval* body;
+	benv* env;      // Local variables body uses, as for a promise
+	bval* transfer; // Value passed by yield or resume
+	bgen* prev;     // Generator that was running when this one was resumed
+
+#ifdef ALTBAT_GEN
+	ucontext_t ctx;    // Where body continues
+	ucontext_t caller; // Where resume continues
+	char* stack;
+#endif
+};
+
+struct bvec {
+	int refs; // Number of values sharing it
+	long count;
+	double data[];
+};
+
+typedef struct bdict_node bdict_node; // Node of the trie of a dictionary
+
+struct bdict {
+	int refs; // Number of values sharing it
+	long count;
+	bdict_node* root; // NULL when empty
+};
+
+struct bbuilder {
+	int refs; // Number of values sharing it
+	long len;
+	long cap;
+	char* data; // Followed by a 0 once anything was added
+};
+
+struct bdfa {
+	int refs; // Number of values sharing it
+	bval* pattern; // String it was compiled from
+	unsigned char cls[256]; // Class of each byte, bytes no state tells apart share one
+	int classes;
+	int count; // States, 0 is the start
+	int first; // Start of a match at the start of the string, past the '^'s
+	int* next; // next[state * classes + class], -1 once nothing can match
+	char* accept; // 1 for the states where a match ends, 2 where one ends only if the string does too
+	bdfa* back; // The pattern read from the end of the string, NULL if it can't be a DFA
+};
+
+struct brange {
+	int refs; // Number of values sharing it
+	int integer; // start, stop and step were all integers, and so are the elements
+	long long istart, istop, istep;
+	double start, stop, step;
+	long long first; // Index of the first element left, tail moves it
+	long long count; // Elements from start, the ones before first included
+};
+
+// A name the native code of a lambda depends on
+struct JitGuard {
+	char* name;
+	bbuiltin builtin; // Builtin it must be bound to, NULL for a lambda
+	bval* body;       // Body of the lambda it must be bound to
+	bval* fn;         // Copy keeping that lambda and its code alive, or NULL
+};
+
+enum JitState { JIT_NONE, JIT_BUSY, JIT_DONE, JIT_FAILED };
+
+// Type of a value in native code, integers are kept in rax and doubles in xmm0
+enum JitType { JIT_INT, JIT_NUM };
+
+typedef union {
+	long long integer;
+	double num;
+} bjit_value;
+
+// Takes the arguments of the lambda, returns 1 to bail to the interpreter
+typedef int(*bjit_code)(bjit_value* args, bjit_value* out);
+
+struct bjit {
+	int calls; // By the interpreter, it is compiled after JIT_THRESHOLD
+	int state;
+	int mode; // JitType of every argument
+	int ret;  // JitType of the result
+	bjit_code code;
+	size_t size; // Of the pages holding code
+
+	int nguards;
+	struct JitGuard* guards;
+	long epoch; // benv_epoch when the guards last passed in the root environment
 };
 
 
@@ -128,10 +376,72 @@ bval* bval_num(double x) {
 	return v;
 }
 
+/**
+ * Integers are exact. Arithmetic on them gives integers while the
+ * result fits in 64 bits (and for division, is exact), otherwise
+ * the result is promoted to a double (BVAL_NUM), as it is when an
+ * integer is used together with a double
+ * */
+bval* bval_int(long long x) {
+	bval* v = malloc(sizeof(bval));
+	v->type    = BVAL_INT;
+	v->integer = x;
+	return v;
+}
+
+// Integers and doubles are both numbers
+int bval_is_num(bval* v) {
+	return v->type == BVAL_NUM || v->type == BVAL_INT;
+}
+
+// Value of a number as a double
+double bval_to_double(bval* v) {
+	return (v->type == BVAL_INT) ? (double)v->integer : v->num;
+}
+
+// Check if a double holds an integer that fits in 'out'
+int bval_double_is_int(double x, long long* out) {
+	if(!(x >= -9223372036854775808.0 && x < 9223372036854775808.0)) return 0;
+	if(x != floor(x)) return 0;
+
+	*out = (long long)x;
+	return 1;
+}
+
+/**
+ * Compare two numbers exactly, without rounding an integer to a double.
+ * Returns -1, 0 or 1, or 2 if they are unordered (NaN)
+ * */
+int bval_num_cmp(bval* x, bval* y) {
+	if(x->type == BVAL_INT && y->type == BVAL_INT)
+		return (x->integer > y->integer) - (x->integer < y->integer);
+
+	if(x->type == BVAL_NUM && y->type == BVAL_NUM) {
+		if(isnan(x->num) || isnan(y->num)) return 2;
+		return (x->num > y->num) - (x->num < y->num);
+	}
+
+	// Integer against double
+	if(x->type == BVAL_NUM) {
+		int c = bval_num_cmp(y, x);
+		return (c == 2) ? 2 : -c;
+	}
+
+	double d = y->num;
+	if(isnan(d)) return 2;
+	if(d >= 9223372036854775808.0) return -1;
+	if(d < -9223372036854775808.0) return 1;
+
+	long long f = (long long)floor(d);
+	if(x->integer != f) return (x->integer > f) ? 1 : -1;
+	return (d > floor(d)) ? -1 : 0;
+}
+
 // Construct a pointer to a new Error bval
 bval* bval_err(char* fmt, ...) {
 	bval* v = malloc(sizeof(bval));
 	v->type = BVAL_ERR;
+	v->num  = 0;
 
 	// Create a va list and initialize it
 	va_list va;
@@ -155,22 +465,46 @@ bval* bval_err(char* fmt, ...) {
 
 // BVAL_ERR,
 // BVAL_NUM,
+// BVAL_INT,
 // BVAL_SYM,
 
 // BVAL_FUN,
+// BVAL_PART,
+// BVAL_MEMO,
 // BVAL_SEXPR,
 // BVAL_QEXPR
+// BVAL_GUARD,
+// BVAL_PROMISE,
+// BVAL_LSEQ,
+// BVAL_GEN,
+// BVAL_VEC,
+// BVAL_DICT,
+// BVAL_BUILDER,
+// BVAL_REGEX,
+// BVAL_RANGE
 struct VTypeMap {
 	enum BTypes btype;
 	char* name;
 } btypes_map[] = { // Same order as BTypes
 	{ BVAL_ERR, "Error" },
 	{ BVAL_NUM, "Number" },
+	{ BVAL_INT, "Integer" },
 	{ BVAL_SYM, "Symbol" },
 	{ BVAL_STR, "String" },
 	{ BVAL_FUN, "Function" },
+	{ BVAL_PART, "Partial Function" },
+	{ BVAL_MEMO, "Memoized Function" },
 	{ BVAL_SEXPR, "S-Expression" },
-	{ BVAL_QEXPR, "Q-Expression" }
+	{ BVAL_QEXPR, "Q-Expression" },
+	{ BVAL_GUARD, "Inline" },
+	{ BVAL_PROMISE, "Promise" },
+	{ BVAL_LSEQ, "Lazy Sequence" },
+	{ BVAL_GEN, "Generator" },
+	{ BVAL_VEC, "Vector" },
+	{ BVAL_DICT, "Dictionary" },
+	{ BVAL_BUILDER, "String Builder" },
+	{ BVAL_REGEX, "Regex" },
+	{ BVAL_RANGE, "Range" }
 };
 
 char* btype_name(int t) {
@@ -213,6 +547,8 @@ bval* bval_fun(bbuiltin func) {
 	bval* v = malloc(sizeof(bval));
 	v->type = BVAL_FUN;
 	v->builtin  = func;
+	v->fast     = NULL;
+	v->special  = NULL;
 	return v;
 }
 
@@ -221,7 +557,17 @@ bval* bval_fun(bbuiltin func) {
 
 benv* benv_new();
 void benv_del(benv*);
-benv* benv_copy(benv*);
+void bmemo_release(bmemo*);
+void bpromise_release(bpromise*);
+void bgen_release(bgen*);
+void bdict_release(bdict*);
+void bbuilder_release(bbuilder*);
+void bdfa_release(bdfa*);
+void brange_release(brange*);
+bval* brange_at(brange*, long long);
+void bdict_print(FILE*, bdict*);
+int bdict_eq(bdict*, bdict*);
+unsigned long bdict_hash(bdict*);
 
 bval* bval_lambda(bval* formals, bval* body) {
 	bval* v = malloc(sizeof(bval));
@@ -229,21 +575,80 @@ bval* bval_lambda(bval* formals, bval* body) {
 
 	// Set builtin to null
 	v->builtin = NULL;
+	v->fast    = NULL;
+	v->special = NULL;
 
-	// Build new environent
-	v->env = benv_new();
-
-	// Set formals and body
+	// Set formals and body, these are never changed so copies can share them
 	v->formals = formals;
 	v->body = body;
+	v->refs = malloc(sizeof(int));
+	*v->refs = 1;
+
+	v->jit = calloc(1, sizeof(bjit));
+	v->jit->epoch = -1;
 	return v;
 }
 
-bval* bval_str(char* s) {
+void bval_del(bval* v);
+
+// Release the code and guards of a lambda, it can't be compiled again
+void bjit_clear(bjit* j) {
+#ifdef ALTBAT_JIT
+	if(j->code) munmap(*(void**)(&j->code), j->size);
+#endif
+	j->code = NULL;
+
+	for(int i=0; i < j->nguards; i++) {
+		free(j->guards[i].name);
+		if(j->guards[i].fn) bval_del(j->guards[i].fn);
+	}
+	free(j->guards);
+	j->guards = NULL;
+	j->nguards = 0;
+}
+
+/**
+ * A function called with fewer arguments than formals,
+ * takes the function and the list of arguments given so far
+ * */
+bval* bval_part(bval* fn, bval* args) {
+	bval* v = malloc(sizeof(bval));
+	v->type  = BVAL_PART;
+	v->fn    = fn;
+	v->count = args->count;
+	v->cell  = args->cell;
+	free(args);
+	return v;
+}
+
+// Takes 's', which has 'len' bytes followed by a 0
+bval* bval_str_take(char* s, long len) {
 	bval* v = malloc(sizeof(bval));
 	v->type = BVAL_STR;
-	v->str  = malloc(strlen(s) + 1);
-	strcpy(v->str, s);
+	v->str  = s;
+	v->len  = len;
+	return v;
+}
+
+// String of the first 'len' bytes of 's'
+bval* bval_str_len(char* s, long len) {
+	char* str = malloc(len + 1);
+	memcpy(str, s, len);
+	str[len] = '\0';
+	return bval_str_take(str, len);
+}
+
+bval* bval_str(char* s) {
+	return bval_str_len(s, strlen(s));
+}
+
+// A pointer to a new inline guard, see OPTIMIZE
+bval* bval_guard(int site, bval* inlined, bval* fallback) {
+	bval* v = malloc(sizeof(bval));
+	v->type     = BVAL_GUARD;
+	v->site     = site;
+	v->inlined  = inlined;
+	v->fallback = fallback;
 	return v;
 }
 
@@ -251,20 +656,53 @@ void bval_del(bval* v) {
 	switch (v->type) {
 		// Do nothing special for number and function type
 		case BVAL_NUM: break;
+		case BVAL_INT: break;
 		case BVAL_FUN:
-			if(!v->builtin) {
-				benv_del(v->env);
+			// Only delete formals and body when the last copy is deleted
+			if(!v->builtin && --(*v->refs) == 0) {
 				bval_del(v->formals);
 				bval_del(v->body);
+				free(v->refs);
+				bjit_clear(v->jit);
+				free(v->jit);
 			}
 		break;
 
+		case BVAL_PART:
+			bval_del(v->fn);
+			for(int i=0; i < v->count; i++) {
+				bval_del(v->cell[i]);
+			}
+			free(v->cell);
+			break;
+
+		case BVAL_MEMO: bmemo_release(v->memo); break;
+
+		case BVAL_PROMISE: bpromise_release(v->promise); break;
+		case BVAL_LSEQ:
+			bval_del(v->cell[0]);
+			free(v->cell);
+			bpromise_release(v->promise);
+			break;
+
+		case BVAL_GEN: bgen_release(v->gen); break;
+		case BVAL_VEC: if(--v->vec->refs == 0) free(v->vec); break;
+		case BVAL_DICT: bdict_release(v->dict); break;
+		case BVAL_BUILDER: bbuilder_release(v->builder); break;
+		case BVAL_REGEX: bdfa_release(v->dfa); break;
+		case BVAL_RANGE: brange_release(v->range); break;
+
 		// For Err or Sym free the string data
 		case BVAL_ERR: free(v->err); break;
 		case BVAL_SYM: free(v->sym); break;
 
 		case BVAL_STR: free(v->str); break;
 
+		case BVAL_GUARD:
+			bval_del(v->inlined);
+			bval_del(v->fallback);
+			break;
+
 
 		// If Sexpr or Qexpr then delete all elements inside
 		case BVAL_SEXPR:
@@ -289,20 +727,85 @@ bval* bval_copy(bval* v) {
 	switch (v->type) {
 		// Copy Functions and Numbers directly
 		case BVAL_NUM: x->num = v->num; break;
+		case BVAL_INT: x->integer = v->integer; break;
 		case BVAL_FUN:
 			if(v->builtin) {
 				x->builtin = v->builtin;
+				x->fast    = v->fast;
+				x->special = v->special;
 			}
 			else {
 				x->builtin = NULL;
-				x->env     = benv_copy(v->env);
-				x->formals = bval_copy(v->formals);
-				x->body    = bval_copy(v->body);
+				x->fast    = NULL;
+				x->special = NULL;
+				x->formals = v->formals;
+				x->body    = v->body;
+				x->refs    = v->refs;
+				x->jit     = v->jit;
+				(*x->refs)++;
 			}
 			break;
 
+		// Copies share the cache
+		case BVAL_MEMO:
+			x->memo = v->memo;
+			x->memo->refs++;
+			break;
+
+		// And the promise, so it is forced once for all of them
+		case BVAL_PROMISE:
+			x->promise = v->promise;
+			x->promise->refs++;
+			break;
+		case BVAL_LSEQ:
+			x->count   = 1;
+			x->cell    = malloc(sizeof(bval*));
+			x->cell[0] = bval_copy(v->cell[0]);
+			x->promise = v->promise;
+			x->promise->refs++;
+			break;
+
+		case BVAL_GEN:
+			x->gen = v->gen;
+			x->gen->refs++;
+			break;
+
+		case BVAL_VEC:
+			x->vec = v->vec;
+			x->vec->refs++;
+			break;
+
+		case BVAL_DICT:
+			x->dict = v->dict;
+			x->dict->refs++;
+			break;
+
+		case BVAL_BUILDER:
+			x->builder = v->builder;
+			x->builder->refs++;
+			break;
+
+		case BVAL_REGEX:
+			x->dfa = v->dfa;
+			x->dfa->refs++;
+			break;
+
+		case BVAL_RANGE:
+			x->range = v->range;
+			x->range->refs++;
+			break;
+
+		case BVAL_PART:
+			x->fn    = bval_copy(v->fn);
+			x->count = v->count;
+			x->cell  = malloc(sizeof(bval*) * x->count);
+			for(int i=0; i<x->count; i++)
+				x->cell[i] = bval_copy(v->cell[i]);
+			break;
+
 		// Copy Strings using malloc and strcpy
 		case BVAL_ERR:
+			x->num = v->num;
 			x->err = malloc(strlen(v->err) + 1);
 			strcpy(x->err, v->err);
 			break;
@@ -313,8 +816,15 @@ bval* bval_copy(bval* v) {
 			break;
 
 		case BVAL_STR:
-			x->str = malloc(strlen(v->str) + 1);
-			strcpy(x->str, v->str);
+			x->len = v->len;
+			x->str = malloc(v->len + 1);
+			memcpy(x->str, v->str, v->len + 1);
+			break;
+
+		case BVAL_GUARD:
+			x->site     = v->site;
+			x->inlined  = bval_copy(v->inlined);
+			x->fallback = bval_copy(v->fallback);
 			break;
 
 		// Copy Lists by copying each sub-expression
@@ -335,6 +845,7 @@ bval* bval_copy(bval* v) {
  * ************/
 struct benv {
 	benv* par; // Parent
+	int loop;  // Frame of a 'for' loop, 'let' or 'try', '=' only sets the variables it holds
 	int count;
 	char** syms;
 	bval** vals;
@@ -354,6 +865,7 @@ struct benv {
 benv* benv_new(void) {
 	benv* e  = malloc(sizeof(benv));
 	e->par   = NULL;
+	e->loop  = 0;
 	e->count = 0;
 	e->syms  = NULL;
 	e->vals  = NULL;
@@ -370,6 +882,12 @@ void benv_del(benv* e) {
 	free(e);
 }
 
+/**
+ * Counts how many times a binding was replaced by benv_put.
+ * Used by inline guards to know when a cached lookup may be stale
+ * */
+long benv_epoch = 0;
+
 bval* benv_get(benv* e, bval* k) {
 	// Iterate over all items in enviroment
 	for(int i=0; i<e->count; i++) {
@@ -384,25 +902,29 @@ bval* benv_get(benv* e, bval* k) {
 	else return bval_err("Unbound symbol '%s'!", k->sym);
 }
 
-
 /**
- * Because we have a new lval type that has its
- * own environment we need a function for copying
- * environments, to use for when we copy lval structs.
+ * Same as benv_get but returns the stored value itself instead of a copy,
+ * or NULL if not found. If 'owner' is given it is set to the environment
+ * where the symbol was found
  * */
-benv* benv_copy(benv* e) {
-	benv* n  = malloc(sizeof(benv));
-	n->par   = e->par;
-	n->count = e->count;
-	n->syms  = malloc(sizeof(char*) * n->count);
-	n->vals  = malloc(sizeof(bval*) * n->count);
+bval* benv_lookup(benv* e, char* sym, benv** owner) {
+	for(; e; e = e->par) {
+		for(int i=0; i<e->count; i++) {
+			if(strcmp(e->syms[i], sym)==0) {
+				if(owner) *owner = e;
+				return e->vals[i];
+			}
+		}
+	}
+	return NULL;
+}
 
+// Check if 'sym' is bound in 'e' itself, without looking in the parents
+int benv_holds(benv* e, char* sym) {
 	for(int i=0; i<e->count; i++) {
-		n->syms[i] = malloc(strlen(e->syms[i]) + 1);
-		strcpy(n->syms[i], e->syms[i]);
-		n->vals[i] = bval_copy(e->vals[i]);
+		if(strcmp(e->syms[i], sym)==0) return 1;
 	}
-	return n;
+	return 0;
 }
 
 
@@ -417,6 +939,7 @@ void benv_put(benv* e, bval* k, bval* v) {
 		if(strcmp(e->syms[i], k->sym)==0) {
 			bval_del(e->vals[i]);
 			e->vals[i] = bval_copy(v);
+			if(!e->par) benv_epoch++;
 			return;
 		}
 	}
@@ -447,61 +970,146 @@ void benv_def(benv* e, bval* k, bval* v) {
 /*******************
  * PRINT
  *******************/
-void bval_print(bval* v);
+void bval_fprint(FILE* out, bval* v);
 // Print bval followed by a newline
-void bval_expr_print(bval* v, char open, char close) {
-	putchar(open);
+void bval_expr_print(FILE* out, bval* v, char open, char close) {
+	fputc(open, out);
 
 	for(int i=0; i < v->count; i++) {
 		// Print Value contanined withi
-		bval_print(v->cell[i]);
+		bval_fprint(out, v->cell[i]);
 
 		// Don't print trailing space if last element
 		if(i != (v->count-1))
-			putchar(' ');
+			fputc(' ', out);
 	}
-	putchar(close);
+	fputc(close, out);
 }
 
-void bval_print_str(bval* v) {
+void bval_print_str(FILE* out, bval* v) {
 	// Make a copy of the string
-	char* escaped = malloc(strlen(v->str)+1);
-	strcpy(escaped, v->str);
+	char* escaped = malloc(v->len+1);
+	memcpy(escaped, v->str, v->len+1);
 
 	// Pass it through the escape function
 	escaped = mpcf_escape(escaped);
 	// Print it between " characters
-	printf("\"%s\"", escaped);
+	fprintf(out, "\"%s\"", escaped);
 	// free the copied string
 	free(escaped);
 }
 
-// Print a bval
-void bval_print(bval* v) {
+// Check if 'x' is a whole number small enough to be written without a fraction
+int num_is_whole(double x) {
+	return isfinite(x) && fabs(x) < 1e15 && x == floor(x);
+}
+
+void bval_print_double(FILE* out, double x) {
+	if(num_is_whole(x))
+		fprintf(out, "%lld", (long long)x);
+	else
+		fprintf(out, "%.1lf", x);
+}
+
+// Print a bval to 'out'
+void bval_fprint(FILE* out, bval* v) {
 	switch (v->type) {
-		case BVAL_NUM:
-			if(v->num == (long)v->num)
-				printf("%li", (long)v->num);
-			else
-				printf("%.1lf", v->num);
+		case BVAL_NUM: bval_print_double(out, v->num); break;
+		case BVAL_INT: fprintf(out, "%lld", v->integer); break;
+		case BVAL_ERR: fprintf(out, "Error: %s", v->err); break;
+		case BVAL_SYM: fprintf(out, "%s", v->sym); break;
+		case BVAL_SEXPR: bval_expr_print(out, v, '(', ')'); break;
+		case BVAL_QEXPR: bval_expr_print(out, v, '{', '}'); break;
+		case BVAL_STR: bval_print_str(out, v); break;
+		case BVAL_GUARD:
+			fprintf(out, "<inline "); bval_fprint(out, v->fallback);
+			fputc(' ', out); bval_fprint(out, v->inlined); fputc('>', out);
 			break;
-		case BVAL_ERR: printf("Error: %s", v->err); break;
-		case BVAL_SYM: printf("%s", v->sym); break;
-		case BVAL_SEXPR: bval_expr_print(v, '(', ')'); break;
-		case BVAL_QEXPR: bval_expr_print(v, '{', '}'); break;
-		case BVAL_STR: bval_print_str(v); break;
 		case BVAL_FUN:
 			if(v->builtin) {
-				printf("<builtin>");
+				fprintf(out, "<builtin>");
 			} else {
-				printf("(\\ "); bval_print(v->formals);
-				putchar(' '); bval_print(v->body); putchar(')');
+				fprintf(out, "(\\ "); bval_fprint(out, v->formals);
+				fputc(' ', out); bval_fprint(out, v->body); fputc(')', out);
 			}
 		break;
 
+		case BVAL_MEMO:
+			fprintf(out, "(memo "); bval_fprint(out, v->memo->fn); fputc(')', out);
+			break;
+
+		case BVAL_PROMISE:
+			if(v->promise->state == PROMISE_DONE) {
+				fprintf(out, "<promise "); bval_fprint(out, v->promise->value); fputc('>', out);
+			} else {
+				fprintf(out, "<promise>");
+			}
+			break;
+
+		// Elements already forced, without forcing more
+		case BVAL_LSEQ:
+			fputc('{', out);
+			while(1) {
+				bval_fprint(out, v->cell[0]);
+
+				bpromise* p = v->promise;
+				if(p->state != PROMISE_DONE) { fprintf(out, " ..."); break; }
+				if(p->value->type != BVAL_LSEQ) {
+					for(int i=0; i < p->value->count; i++) {
+						fputc(' ', out); bval_fprint(out, p->value->cell[i]);
+					}
+					break;
+				}
+				fputc(' ', out);
+				v = p->value;
+			}
+			fputc('}', out);
+			break;
+
+		case BVAL_GEN: fprintf(out, "<generator>"); break;
+		case BVAL_VEC:
+			fputc('[', out);
+			for(long i=0; i < v->vec->count; i++) {
+				if(i) fputc(' ', out);
+				bval_print_double(out, v->vec->data[i]);
+			}
+			fputc(']', out);
+			break;
+		case BVAL_DICT: bdict_print(out, v->dict); break;
+		case BVAL_BUILDER: fprintf(out, "<builder>"); break;
+		case BVAL_REGEX:
+			fprintf(out, "(re-dfa "); bval_fprint(out, v->dfa->pattern); fputc(')', out);
+			break;
+
+		// Printed as the call that makes the elements left
+		case BVAL_RANGE: {
+			brange* r = v->range;
+			if(r->integer) {
+				fprintf(out, "(range %lld %lld %lld)", r->istart + r->first * r->istep, r->istop, r->istep);
+			} else {
+				fprintf(out, "(range "); bval_print_double(out, r->start + r->first * r->step);
+				fputc(' ', out); bval_print_double(out, r->stop);
+				fputc(' ', out); bval_print_double(out, r->step); fputc(')', out);
+			}
+			break;
+		}
+
+		// Printed as the call that made it
+		case BVAL_PART:
+			fputc('(', out); bval_fprint(out, v->fn);
+			for(int i=0; i < v->count; i++) {
+				fputc(' ', out); bval_fprint(out, v->cell[i]);
+			}
+			fputc(')', out);
+			break;
+
 	}
 }
 
+void bval_print(bval* v) {
+	bval_fprint(stdout, v);
+}
+
 void bval_println(bval* v) {
 	bval_print(v);
 	putchar('\n');
@@ -575,6 +1183,13 @@ bval* bval_join(bval* x, bval* y) {
 }
 
 int bval_eq(bval* x, bval* y) {
+	// An integer and a double are equal if the double holds exactly that integer
+	if(x->type == BVAL_INT && y->type == BVAL_NUM) {
+		long long n;
+		return bval_double_is_int(y->num, &n) && n == x->integer;
+	}
+	if(x->type == BVAL_NUM && y->type == BVAL_INT) return bval_eq(y, x);
+
 	// Different Types are alaways unequal
 	if(x->type != y->type) return 0;
 
@@ -582,19 +1197,74 @@ int bval_eq(bval* x, bval* y) {
 	switch (x->type) {
 		// Compare number value
 		case BVAL_NUM: return (x->num == y->num);
+		case BVAL_INT: return (x->integer == y->integer);
 
 		// Compare string values
 		case BVAL_ERR: return (strcmp(x->err, y->err)==0);
 		case BVAL_SYM: return (strcmp(x->sym, y->sym)==0);
-		case BVAL_STR: return (strcmp(x->str, y->str)==0);
+		case BVAL_STR: return x->len == y->len && memcmp(x->str, y->str, x->len)==0;
+
+		// Guards are equal if they stand for the same call
+		case BVAL_GUARD: return bval_eq(x->fallback, y->fallback);
 
 		// If builtin compare, otherwise compare formals and body
 		case BVAL_FUN:
 			if(x->builtin || y->builtin)
 				return x->builtin == y->builtin;
+			else if(x->body == y->body)
+				return 1; // Copies of the same lambda
 			else
 				return bval_eq(x->formals, y->formals) && bval_eq(x->body, y->body);
 
+		case BVAL_MEMO:
+			return x->memo == y->memo || bval_eq(x->memo->fn, y->memo->fn);
+
+		// Only copies of the same promise or sequence are equal, comparing more would force them
+		case BVAL_PROMISE: return x->promise == y->promise;
+		case BVAL_LSEQ: return x->promise == y->promise && bval_eq(x->cell[0], y->cell[0]);
+		case BVAL_GEN: return x->gen == y->gen;
+		case BVAL_BUILDER: return x->builder == y->builder;
+		case BVAL_REGEX: return bval_eq(x->dfa->pattern, y->dfa->pattern);
+
+		// Same elements, which the first one and the step tell
+		case BVAL_RANGE: {
+			long long n = x->range->count - x->range->first;
+			if(n != y->range->count - y->range->first) return 0;
+			if(n == 0) return 1;
+
+			bval* a = brange_at(x->range, 0);
+			bval* b = brange_at(y->range, 0);
+			int eq = bval_eq(a, b);
+			bval_del(a);
+			bval_del(b);
+			if(n == 1 || !eq) return eq;
+
+			a = brange_at(x->range, 1);
+			b = brange_at(y->range, 1);
+			eq = bval_eq(a, b);
+			bval_del(a);
+			bval_del(b);
+			return eq;
+		}
+
+		case BVAL_VEC:
+			if(x->vec->count != y->vec->count) return 0;
+			for(long i=0; i < x->vec->count; i++) {
+				if(x->vec->data[i] != y->vec->data[i]) return 0;
+			}
+			return 1;
+
+		// Same keys with equal values, in any order
+		case BVAL_DICT: return bdict_eq(x->dict, y->dict);
+
+		// Same function and arguments
+		case BVAL_PART:
+			if(x->count != y->count || !bval_eq(x->fn, y->fn)) return 0;
+			for(int i=0; i<x->count; i++) {
+				if(!bval_eq(x->cell[i], y->cell[i])) return 0;
+			}
+			return 1;
+
 		// If list compare every individual element
 		case BVAL_QEXPR:
 		case BVAL_SEXPR:
@@ -611,36 +1281,121 @@ int bval_eq(bval* x, bval* y) {
 	return 0;
 }
 
+/**
+ * Hash of a value, values equal by bval_eq have the same hash
+ * */
+unsigned long bval_hash_str(char* s) {
+	// FNV-1a
+	unsigned long h = 2166136261u;
+	for(; *s; s++) {
+		h ^= (unsigned char)*s;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+unsigned long bval_hash(bval* v) {
+	// Mix the type so {1} and (1) or "a" and a differ
+	unsigned long h = (unsigned long)v->type * 2654435761u;
+
+	switch (v->type) {
+		case BVAL_NUM:
+		case BVAL_INT: {
+			// Integers and the doubles equal to them hash the same, and so do 0 and -0
+			unsigned long long bits;
+			long long n;
+			h = (unsigned long)BVAL_NUM * 2654435761u;
+
+			if(v->type == BVAL_INT) {
+				bits = (unsigned long long)v->integer;
+			} else if(bval_double_is_int(v->num, &n)) {
+				bits = (unsigned long long)n;
+			} else {
+				memcpy(&bits, &v->num, sizeof(bits));
+				h ^= 1;
+			}
+			return h ^ (unsigned long)(bits ^ (bits >> 32)) * 2246822519u;
+		}
+
+		case BVAL_ERR: return h ^ bval_hash_str(v->err);
+		case BVAL_SYM: return h ^ bval_hash_str(v->sym);
+		case BVAL_STR: return h ^ bval_hash_str(v->str);
+
+		case BVAL_FUN:
+			if(v->builtin) return h ^ (unsigned long)(size_t)v->builtin;
+			return h ^ (bval_hash(v->formals) * 31 + bval_hash(v->body));
+
+		case BVAL_MEMO: return h ^ bval_hash(v->memo->fn);
+		case BVAL_PROMISE:
+		case BVAL_LSEQ:
+			return h ^ (unsigned long)(size_t)v->promise * 2246822519u;
+		case BVAL_GEN: return h ^ (unsigned long)(size_t)v->gen * 2246822519u;
+		case BVAL_BUILDER: return h ^ (unsigned long)(size_t)v->builder * 2246822519u;
+		case BVAL_REGEX: return h ^ bval_hash(v->dfa->pattern);
+		case BVAL_RANGE: {
+			// The first two elements, as for equality
+			long long n = v->range->count - v->range->first;
+			h = h * 31 + (unsigned long)n;
+			for(long long i=0; i < n && i < 2; i++) {
+				bval* x = brange_at(v->range, i);
+				h = h * 31 + bval_hash(x);
+				bval_del(x);
+			}
+			return h;
+		}
+
+		// Equal vectors have equal elements, 0 and -0 hash the same
+		case BVAL_VEC:
+			for(long i=0; i < v->vec->count; i++) {
+				double x = v->vec->data[i] + 0.0;
+				unsigned long long bits;
+				memcpy(&bits, &x, sizeof(bits));
+				h = h * 31 + (unsigned long)(bits ^ (bits >> 32));
+			}
+			return h;
+		case BVAL_DICT: return h ^ bdict_hash(v->dict);
+		case BVAL_GUARD: return bval_hash(v->fallback);
+
+		case BVAL_PART:
+			h ^= bval_hash(v->fn);
+			// Fall through and hash the arguments as a list
+		case BVAL_QEXPR:
+		case BVAL_SEXPR:
+			for(int i=0; i<v->count; i++)
+				h = h * 31 + bval_hash(v->cell[i]);
+			return h;
+	}
+	return h;
+}
+
+/**
+ * Truth value of a bval, used by the logical functions.
+ * Only looks at the value itself, so it takes the same time
+ * for a list of any size
+ * */
+long long brange_len(brange* r);
 int bval_val(bval* x) {
 	switch (x->type) {
 		// Check number value
 		case BVAL_NUM: return (x->num) ? 1 : 0;
+		case BVAL_INT: return (x->integer) ? 1 : 0;
 
-		// Check string values
-		case BVAL_ERR: return (x->err) ? 1 : 0;
-		case BVAL_SYM: return (x->sym) ? 1 : 0;
-
-		// If builtin Check, otherwise check formals and body
-		case BVAL_FUN:
-			if(x->builtin)
-				return (x->builtin) ? 1 : 0;
-			else
-				return (bval_val(x->formals) && bval_val(x->body)) ? 1 : 0;
+		// Strings are true unless empty
+		case BVAL_STR: return (x->len != 0) ? 1 : 0;
 
-		// If list compare every individual element
+		// Lists are true unless empty
 		case BVAL_QEXPR:
 		case BVAL_SEXPR:
-			if(!x->count) return 0;
-			for(int i=0; i<x->count; i++) {
-				// If any element not true then whole list not true
-				if(!bval_val(x->cell[i])) return 0;
-			}
+			return (x->count) ? 1 : 0;
 
-			// Otherwise lists must be true
-			return 1;
-		break;
+		// So are ranges, vectors and dictionaries
+		case BVAL_RANGE: return (brange_len(x->range) != 0) ? 1 : 0;
+		case BVAL_VEC: return (x->vec->count) ? 1 : 0;
+		case BVAL_DICT: return (x->dict->count) ? 1 : 0;
 	}
-	return 0;
+
+	// Everything else (functions, symbols, errors) is true
+	return 1;
 }
 
 
@@ -663,7 +1418,12 @@ int bval_val(bval* x) {
 #define BASSERT_TYPE(func, args, index, expect) \
 	BASSERT(args, args->cell[index]->type == expect, \
 		"Function '%s' Got %s type for argument %i, Expected %s.", \
-		func, index, btype_name(args->cell[index]->type), btype_name(expect))
+		func, btype_name(args->cell[index]->type), index, btype_name(expect))
+
+#define BASSERT_NUMBER(func, args, index) \
+	BASSERT(args, bval_is_num(args->cell[index]), \
+		"Function '%s' Got %s type for argument %i, Expected %s.", \
+		func, btype_name(args->cell[index]->type), index, btype_name(BVAL_NUM))
 
 #define BASSERT_NUM(func, args, num) \
 	BASSERT(args, args->count == num, \
@@ -674,53 +1434,131 @@ int bval_val(bval* x) {
 	BASSERT(args, args->cell[index]->count != 0, \
 	"Function '%s' passed {} for argument %i.", func, index)
 
+// Same as above for fast builtins, nothing to delete since arguments belong to the caller
+#define FASSERT(cond, fmt, ...) \
+	if(!(cond)) { \
+		return bval_err(fmt, ##__VA_ARGS__); \
+	}
 
+#define FASSERT_TYPE(func, argv, index, expect) \
+	FASSERT(argv[index]->type == expect, \
+		"Function '%s' Got %s type for argument %i, Expected %s.", \
+		func, btype_name(argv[index]->type), index, btype_name(expect))
 
+#define FASSERT_NUMBER(func, argv, index) \
+	FASSERT(bval_is_num(argv[index]), \
+		"Function '%s' Got %s type for argument %i, Expected %s.", \
+		func, btype_name(argv[index]->type), index, btype_name(BVAL_NUM))
 
+// Q-Expressions and lazy sequences
+#define FASSERT_LIST(func, argv, index) \
+	FASSERT(argv[index]->type == BVAL_QEXPR || argv[index]->type == BVAL_LSEQ, \
+		"Function '%s' Got %s type for argument %i, Expected %s.", \
+		func, btype_name(argv[index]->type), index, btype_name(BVAL_QEXPR))
 
-/**
- * 
- * LIST FUNCTIONS
- * 
- * */
+#define FASSERT_NUM(func, argc, num) \
+	FASSERT(argc == num, \
+		"Function '%s' passed %i arguments, Expected %i.", \
+		func, argc, num)
 
-bval* bval_eval(benv* e, bval* v);
-// Takes one or more arguments and returns a new Q-Expression containing the arguments
-bval* builtin_list(benv* e, bval* a) {
-	a->type = BVAL_QEXPR;
-	return a;
-}
+#define FASSERT_NOT_EMPTY(func, argv, index) \
+	FASSERT(argv[index]->count != 0, \
+	"Function '%s' passed {} for argument %i.", func, index)
+
+
+// Delete an argument list a fast builtin may have taken arguments from
+void bval_del_args(bval* a) {
+	for(int i=0; i<a->count; i++) {
+		if(a->cell[i]) bval_del(a->cell[i]);
+	}
+	free(a->cell);
+	free(a);
+}
+
+// Call a fast builtin with the arguments in a S-Expression
+bval* builtin_fast(benv* e, bval* a, bfast fast) {
+	bval* x = fast(e, a->count, a->cell);
+	bval_del_args(a);
+	return x;
+}
+
+
+
+
+
+/**
+ * 
+ * LIST FUNCTIONS
+ * 
+ * */
+
+bval* bval_eval(benv* e, bval* v);
+bval* bval_eval_keep(benv* e, bval* v);
+bval* bval_eval_list(benv* e, bval* v);
+bval* bval_lseq_rest(bval* s);
+bval* brange_tail(brange* r);
+// Takes one or more arguments and returns a new Q-Expression containing the arguments
+bval* builtin_list(benv* e, bval* a) {
+	a->type = BVAL_QEXPR;
+	return a;
+}
 
 // Takes a Q-Expression and returns a Q-Expression with only the first element
-bval* builtin_head(benv* e, bval* a) {
+bval* builtin_head_fast(benv* e, int argc, bval** argv) {
 	// Check error conditions
-	BASSERT_NUM("head", a, 1);
-	BASSERT_TYPE("head", a, 0, BVAL_QEXPR);
-	BASSERT_NOT_EMPTY("head", a, 0);
+	FASSERT_NUM("head", argc, 1);
+	if(argv[0]->type == BVAL_RANGE) {
+		FASSERT(brange_len(argv[0]->range) != 0, "Function 'head' passed an empty range for argument 0.");
+		return bval_add(bval_qexpr(), brange_at(argv[0]->range, 0));
+	}
+	FASSERT_LIST("head", argv, 0);
+
+	// Lazy sequences always have a first element
+	if(argv[0]->type == BVAL_LSEQ) {
+		bval* x = bval_qexpr();
+		return bval_add(x, bval_copy(argv[0]->cell[0]));
+	}
+	FASSERT_NOT_EMPTY("head", argv, 0);
 	
 	// Otherwise take first argument
-	bval* v = bval_take(a, 0);
+	bval* v = argv[0];
+	argv[0] = NULL;
 
-	// Delete all elements that are not head and return
-	while(v->count > 1) bval_del(bval_pop(v, 1));
+	// Delete all elements that are not head (from the end, so nothing is moved) and return
+	while(v->count > 1) bval_del(v->cell[--v->count]);
 	return v;
 }
 
+bval* builtin_head(benv* e, bval* a) {
+	return builtin_fast(e, a, builtin_head_fast);
+}
+
 // Takes a Q-Expression and returns a Q-Expression with the first element removed
-bval* builtin_tail(benv* e, bval* a) {
+bval* builtin_tail_fast(benv* e, int argc, bval** argv) {
 	// Check error conditions
-	BASSERT_NUM("tail", a, 1);
-	BASSERT_TYPE("tail", a, 0, BVAL_QEXPR);
-	BASSERT_NOT_EMPTY("tail", a, 0);
+	FASSERT_NUM("tail", argc, 1);
+	if(argv[0]->type == BVAL_RANGE) {
+		FASSERT(brange_len(argv[0]->range) != 0, "Function 'tail' passed an empty range for argument 0.");
+		return brange_tail(argv[0]->range);
+	}
+	FASSERT_LIST("tail", argv, 0);
+
+	if(argv[0]->type == BVAL_LSEQ) return bval_lseq_rest(argv[0]);
+	FASSERT_NOT_EMPTY("tail", argv, 0);
 
 	// Take first argument
-	bval* v = bval_take(a, 0);
+	bval* v = argv[0];
+	argv[0] = NULL;
 
 	// Delete first element and return
 	bval_del(bval_pop(v, 0));
 	return v;
 }
 
+bval* builtin_tail(benv* e, bval* a) {
+	return builtin_fast(e, a, builtin_tail_fast);
+}
+
 
 
 // Takes a Q-Expression and evaluates it as if it were a S-Expression
@@ -733,6 +1571,33 @@ bval* builtin_eval(benv* e, bval* a) {
 	return bval_eval(e, x);
 }
 
+/**
+ * Special forms that evaluate a Q-Expression (see builtin_if_special)
+ * evaluate a literal one where it is, without copying it.
+ * Anything else is evaluated first and must give a Q-Expression
+ * */
+bval* special_eval_qexpr(benv* e, char* name, bval** argv, int i) {
+	if(argv[i]->type == BVAL_QEXPR) return bval_eval_list(e, argv[i]);
+
+	bval* x = bval_eval_keep(e, argv[i]);
+	if(x->type == BVAL_ERR) return x;
+	if(x->type != BVAL_QEXPR) {
+		bval* err = bval_err(
+			"Function '%s' Got %s type for argument %i, Expected %s.",
+			name, btype_name(x->type), i, btype_name(BVAL_QEXPR));
+		bval_del(x);
+		return err;
+	}
+
+	x->type = BVAL_SEXPR;
+	return bval_eval(e, x);
+}
+
+bval* builtin_eval_special(benv* e, int argc, bval** argv) {
+	FASSERT_NUM("eval", argc, 1);
+	return special_eval_qexpr(e, "eval", argv, 0);
+}
+
 
 
 // Takes one or more Q-Expressions and returns a Q-Expression of them conjoined together
@@ -753,14 +1618,36 @@ bval* builtin_join(benv* e, bval* a) {
 }
 
 
-// Returns the number of elements in a Q-Expression
-bval* builtin_len(benv* e, bval* a) {
-	BASSERT_NUM("len", a, 1);
-	BASSERT_TYPE("len", a, 0, BVAL_QEXPR);
+// Returns the number of elements in a Q-Expression, or a lazy sequence forcing all of it
+bval* builtin_len_fast(benv* e, int argc, bval** argv) {
+	FASSERT_NUM("len", argc, 1);
+	if(argv[0]->type == BVAL_VEC) return bval_int(argv[0]->vec->count);
+	if(argv[0]->type == BVAL_DICT) return bval_int(argv[0]->dict->count);
+	if(argv[0]->type == BVAL_BUILDER) return bval_int(argv[0]->builder->len);
+	if(argv[0]->type == BVAL_RANGE) return bval_int(brange_len(argv[0]->range));
+	FASSERT_LIST("len", argv, 0);
 
-	a->type = BVAL_NUM;
-	a->num = a->cell[0]->count;
-	return a;
+	// Taken so elements already counted can be freed
+	bval* s = argv[0];
+	argv[0] = NULL;
+
+	long long n = 0;
+	while(s->type == BVAL_LSEQ) {
+		bval* r = bval_lseq_rest(s);
+		bval_del(s);
+		if(r->type == BVAL_ERR) return r;
+
+		s = r;
+		n++;
+	}
+
+	n += s->count;
+	bval_del(s);
+	return bval_int(n);
+}
+
+bval* builtin_len(benv* e, bval* a) {
+	return builtin_fast(e, a, builtin_len_fast);
 }
 
 
@@ -806,6 +1693,105 @@ bval* builtin_env(benv* e, bval* a) {
 
 
 
+/**
+ * 
+ * EVALUATION LIMITS
+ * 
+ * */
+
+/**
+ * --fuel N and --timeout MS bound each top level evaluation, a line of
+ * the prompt or an expression of a file, nested 'require' share the
+ * budget of the expression that called them. A step is a call to a
+ * lambda or an iteration of a loop, limits are only looked at every
+ * EVAL_CHECK_EVERY steps so counting costs a decrement.
+ * Once exhausted every step gives an error until the evaluation is over,
+ * so it unwinds like any other error and definitions made so far are kept
+ * */
+#define EVAL_CHECK_EVERY 65536
+
+enum { EVAL_OK, EVAL_NO_FUEL, EVAL_NO_TIME };
+
+long eval_fuel    = 0; // Steps of a top level evaluation, 0 for no limit
+long eval_timeout = 0; // Milliseconds of a top level evaluation, 0 for no limit
+
+int    eval_active = 0; // A top level evaluation with limits is running
+int    eval_state  = EVAL_OK;
+long   eval_ticks  = LONG_MAX; // Steps before the next check
+long   eval_batch  = LONG_MAX; // Value eval_ticks started from
+long   eval_steps  = 0;
+double eval_deadline;
+
+double eval_now() {
+#if defined(__unix__)
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000.0 + t.tv_nsec / 1e6;
+#else
+	return clock() * 1000.0 / CLOCKS_PER_SEC;
+#endif
+}
+
+// Counts eval_batch steps from now, stopping early to catch the last one allowed
+void eval_refill() {
+	// Without limits there is nothing to check
+	eval_batch = eval_active ? EVAL_CHECK_EVERY : LONG_MAX;
+	if(eval_active && eval_fuel && eval_fuel - eval_steps + 1 < eval_batch)
+		eval_batch = eval_fuel - eval_steps + 1;
+	eval_ticks = eval_batch;
+}
+
+// Called when eval_ticks runs out, returns an error if a limit was passed
+bval* eval_check() {
+	if(!eval_active) {
+		eval_refill();
+		return NULL;
+	}
+
+	if(eval_state == EVAL_OK) {
+		eval_steps += eval_batch - eval_ticks;
+		if(eval_fuel && eval_steps > eval_fuel)
+			eval_state = EVAL_NO_FUEL;
+		else if(eval_timeout && eval_now() >= eval_deadline)
+			eval_state = EVAL_NO_TIME;
+	}
+
+	if(eval_state == EVAL_OK) {
+		eval_refill();
+		return NULL;
+	}
+
+	// Every step from now on fails
+	eval_ticks = eval_batch = 0;
+	return (eval_state == EVAL_NO_FUEL)
+		? bval_err("Evaluation ran out of fuel after %li steps!", eval_fuel)
+		: bval_err("Evaluation took longer than %li ms!", eval_timeout);
+}
+
+// Counts a step, an error if it is over the limits
+#define EVAL_TICK() ((--eval_ticks <= 0) ? eval_check() : NULL)
+
+// Starts the limits of a top level evaluation, returns 0 if one is already running
+int eval_begin() {
+	if(eval_active || (!eval_fuel && !eval_timeout)) return 0;
+
+	eval_active = 1;
+	eval_state  = EVAL_OK;
+	eval_steps  = 0;
+	eval_deadline = eval_now() + eval_timeout;
+	eval_refill();
+	return 1;
+}
+
+// Ends what eval_begin started if it returned 1
+void eval_end(int began) {
+	if(!began) return;
+	eval_active = 0;
+	eval_state  = EVAL_OK;
+	eval_refill();
+}
+
+
 /**
  * 
  * STRING FUNCTIONS
@@ -813,10 +1799,37 @@ bval* builtin_env(benv* e, bval* a) {
  * */
 
 bval* bval_read(mpc_ast_t* t);
+bval* bval_opt(benv* e, bval* v);
 bval* builtin_req(benv* e, bval* a) {
 	BASSERT_NUM("require", a, 1);
 	BASSERT_TYPE("require", a, 0, BVAL_STR);
 
+#ifndef _WIN32
+	// Shared object built by --emit-c, run its compiled code
+	char* name = a->cell[0]->str;
+	size_t len = strlen(name);
+	if(len > 3 && strcmp(name + len-3, ".so")==0) {
+		// A path without '/' would be searched in the system libraries
+		char* path = malloc(len + 3);
+		sprintf(path, "%s%s", strchr(name, '/') ? "" : "./", name);
+
+		void* lib = dlopen(path, RTLD_NOW);
+		free(path);
+
+		void (*load)(benv*) = NULL;
+		if(lib) *(void**)(&load) = dlsym(lib, "aot_load");
+		if(!load) {
+			bval* err = bval_err("Could not load library %s", dlerror());
+			bval_del(a);
+			return err;
+		}
+
+		load(e);
+		bval_del(a);
+		return bval_sexpr();
+	}
+#endif
+
 	// Parse file given by string name
 	mpc_result_t r;
 	if(mpc_parse_contents(a->cell[0]->str, Altbat, &r)) {
@@ -826,7 +1839,9 @@ bval* builtin_req(benv* e, bval* a) {
 
 		// Evaluate each expression
 		while(expr->count) {
-			bval* x = bval_eval(e, bval_pop(expr, 0));
+			int began = eval_begin();
+			bval* x = bval_eval(e, bval_opt(e, bval_pop(expr, 0)));
+			eval_end(began);
 
 			// If evaluation leads to error print it
 			if(x->type == BVAL_ERR) bval_println(x);
@@ -881,175 +1896,416 @@ bval* builtin_error(benv* e, bval* a) {
 	return err;
 }
 
+/**
+ * (try {body} {handler}) evaluates body, if that gives an error handler
+ * is evaluated instead. (try {body} {name} {handler}) also binds the
+ * message of the error to name while handler runs.
+ * 'break', a passed evaluation limit and a generator being closed are
+ * not errors of body, they go through so what they stop is stopped
+ * */
+int gen_closing();
+int error_catchable(bval* x) {
+	return x->type == BVAL_ERR && !x->num && eval_state == EVAL_OK && !gen_closing();
+}
 
+bval* builtin_try_special(benv* e, int argc, bval** argv) {
+	FASSERT(argc == 2 || argc == 3,
+		"Function 'try' passed %i arguments, Expected 2 or 3.", argc);
+	if(argc == 3) {
+		FASSERT_TYPE("try", argv, 1, BVAL_QEXPR);
+		FASSERT(argv[1]->count == 1 && argv[1]->cell[0]->type == BVAL_SYM,
+			"Function 'try' second argument must be a single symbol.");
+	}
 
+	bval* x = special_eval_qexpr(e, "try", argv, 0);
+	if(!error_catchable(x)) return x;
 
+	if(argc == 2) {
+		bval_del(x);
+		return special_eval_qexpr(e, "try", argv, 1);
+	}
 
+	char* sym = argv[1]->cell[0]->sym;
+	bval* msg = bval_str(x->err);
+	bval_del(x);
 
+	benv frame = { e, 1, 1, &sym, &msg };
+	x = special_eval_qexpr(&frame, "try", argv, 2);
+	bval_del(msg);
+	return x;
+}
 
+bval* builtin_try(benv* e, bval* a) {
+	return builtin_fast(e, a, builtin_try_special);
+}
 
 /**
- * 
- * LOGICAL FUNCTIONS
- * 
+ * Strings keep their length, so these never scan for the end of one.
+ * Indexes and lengths are in bytes
  * */
-bval* builtin_log(benv* e, bval* a, char* op) {
-	BASSERT_NUM(op, a, 2);
 
-	int r;
-	if(strcmp(op, "&&")==0) {
-		r = bval_val(a->cell[0]) && bval_val(a->cell[1]);
+/**
+ * Index of the first 'sub' in 's' at or after 'from', -1 if there is none.
+ * memchr, which the C library does many bytes at a time, jumps to each
+ * place the first byte matches and the last byte is checked before the rest
+ * */
+long str_find(char* s, long len, char* sub, long sublen, long from) {
+	if(sublen == 0) return (from <= len) ? from : -1;
+
+	char* end = s + len - sublen + 1; // Past the last place 'sub' fits
+	for(char* p = s + from; p < end; p++) {
+		p = memchr(p, sub[0], end - p);
+		if(!p) return -1;
+		if(p[sublen-1] == sub[sublen-1] && memcmp(p+1, sub+1, sublen-1)==0) return p - s;
 	}
-	if(strcmp(op, "||")==0)
-		r = bval_val(a->cell[0]) || bval_val(a->cell[1]);
+	return -1;
+}
 
-	bval_del(a);
-	return bval_num(r);
+// (str-len s) returns the number of bytes of s
+bval* builtin_str_len_fast(benv* e, int argc, bval** argv) {
+	FASSERT_NUM("str-len", argc, 1);
+	FASSERT_TYPE("str-len", argv, 0, BVAL_STR);
+	return bval_int(argv[0]->len);
 }
 
-bval* builtin_and(benv* e, bval* a) {
-	return builtin_log(e, a, "&&");
+// (concat s ...) returns the strings joined, allocated once
+bval* builtin_concat_fast(benv* e, int argc, bval** argv) {
+	long len = 0;
+	for(int i=0; i<argc; i++) {
+		FASSERT_TYPE("concat", argv, i, BVAL_STR);
+		len += argv[i]->len;
+	}
+
+	char* s = malloc(len + 1);
+	char* at = s;
+	for(int i=0; i<argc; i++) {
+		memcpy(at, argv[i]->str, argv[i]->len);
+		at += argv[i]->len;
+	}
+	*at = '\0';
+	return bval_str_take(s, len);
 }
 
-bval* builtin_or(benv* e, bval* a) {
-	return builtin_log(e, a, "||");
+// (substr s start [end]) returns the bytes of s from start up to end, or its end
+bval* builtin_substr_fast(benv* e, int argc, bval** argv) {
+	FASSERT(argc == 2 || argc == 3,
+		"Function 'substr' passed %i arguments, Expected 2 or 3.", argc);
+	FASSERT_TYPE("substr", argv, 0, BVAL_STR);
+	FASSERT_TYPE("substr", argv, 1, BVAL_INT);
+	if(argc == 3) FASSERT_TYPE("substr", argv, 2, BVAL_INT);
+
+	long len = argv[0]->len;
+	long long start = argv[1]->integer;
+	long long end = (argc == 3) ? argv[2]->integer : len;
+	FASSERT(0 <= start && start <= end && end <= len,
+		"Function 'substr' range %lld to %lld is out of a string of length %li.", start, end, len);
+
+	return bval_str_len(argv[0]->str + start, end - start);
 }
 
+// (index-of s sub [from]) returns where sub first is in s, at or after from, -1 if it isn't
+bval* builtin_index_of_fast(benv* e, int argc, bval** argv) {
+	FASSERT(argc == 2 || argc == 3,
+		"Function 'index-of' passed %i arguments, Expected 2 or 3.", argc);
+	FASSERT_TYPE("index-of", argv, 0, BVAL_STR);
+	FASSERT_TYPE("index-of", argv, 1, BVAL_STR);
+	if(argc == 3) FASSERT_TYPE("index-of", argv, 2, BVAL_INT);
 
+	long long from = (argc == 3) ? argv[2]->integer : 0;
+	FASSERT(0 <= from && from <= argv[0]->len,
+		"Function 'index-of' index %lld is out of a string of length %li.", from, argv[0]->len);
 
+	return bval_int(str_find(argv[0]->str, argv[0]->len, argv[1]->str, argv[1]->len, from));
+}
 
+// (split s sep) returns the parts of s between each sep, the bytes of s if sep is ""
+bval* builtin_split_fast(benv* e, int argc, bval** argv) {
+	FASSERT_NUM("split", argc, 2);
+	FASSERT_TYPE("split", argv, 0, BVAL_STR);
+	FASSERT_TYPE("split", argv, 1, BVAL_STR);
 
+	bval* s = argv[0];
+	bval* sep = argv[1];
+	bval* x = bval_qexpr();
 
+	if(sep->len == 0) {
+		x->count = s->len;
+		x->cell  = malloc(sizeof(bval*) * (s->len ? s->len : 1));
+		for(long i=0; i < s->len; i++) x->cell[i] = bval_str_len(s->str + i, 1);
+		return x;
+	}
 
+	// Parts are counted first so the list is allocated once
+	long count = 1;
+	for(long at = 0; (at = str_find(s->str, s->len, sep->str, sep->len, at)) != -1; at += sep->len) count++;
+
+	x->count = count;
+	x->cell  = malloc(sizeof(bval*) * count);
+	long from = 0;
+	for(long i=0; i < count; i++) {
+		long at = (i == count-1) ? s->len : str_find(s->str, s->len, sep->str, sep->len, from);
+		x->cell[i] = bval_str_len(s->str + from, at - from);
+		from = at + sep->len;
+	}
+	return x;
+}
 
-/**
- * 
- * COMPARSION FUNCTIONS
- * 
- * */
+// (replace s old new) returns s with every old replaced by new
+bval* builtin_replace_fast(benv* e, int argc, bval** argv) {
+	FASSERT_NUM("replace", argc, 3);
+	FASSERT_TYPE("replace", argv, 0, BVAL_STR);
+	FASSERT_TYPE("replace", argv, 1, BVAL_STR);
+	FASSERT_TYPE("replace", argv, 2, BVAL_STR);
+	FASSERT(argv[1]->len != 0, "Function 'replace' passed \"\" for argument 1.");
+
+	bval* s = argv[0];
+	bval* old = argv[1];
+	bval* new = argv[2];
+
+	// Found once to know the length, then again to copy
+	long count = 0;
+	for(long at = 0; (at = str_find(s->str, s->len, old->str, old->len, at)) != -1; at += old->len) count++;
+	if(count == 0) {
+		argv[0] = NULL;
+		return s;
+	}
 
+	long len = s->len + count * (new->len - old->len);
+	char* r = malloc(len + 1);
+	char* to = r;
+	long from = 0;
+	for(long at; (at = str_find(s->str, s->len, old->str, old->len, from)) != -1; from = at + old->len) {
+		memcpy(to, s->str + from, at - from);
+		to += at - from;
+		memcpy(to, new->str, new->len);
+		to += new->len;
+	}
+	memcpy(to, s->str + from, s->len - from);
+	r[len] = '\0';
+	return bval_str_take(r, len);
+}
 
+// Copy of a string with 'f' applied to each byte
+bval* str_map(char* func, int argc, bval** argv, int (*f)(int)) {
+	FASSERT_NUM(func, argc, 1);
+	FASSERT_TYPE(func, argv, 0, BVAL_STR);
 
-// enum of operators_map types of eval_op
-enum OrdenatorsCode {
-	OR_GT,
-	OR_LT,
-	OR_GE,
-	OR_LE
-};
+	bval* x = bval_str_len(argv[0]->str, argv[0]->len);
+	for(long i=0; i < x->len; i++) x->str[i] = (char)f((unsigned char)x->str[i]);
+	return x;
+}
 
-// Define struct of operators
-struct OrdenatorsEntry {
-	char* name;
-	enum OrdenatorsCode code;
+// (upper s) and (lower s) return s with its ASCII letters changed
+bval* builtin_upper_fast(benv* e, int argc, bval** argv) {
+	return str_map("upper", argc, argv, toupper);
+}
 
-} ordenators_map[] = { // Define operators
-	{ ">",  OR_GT },
-	{ "<",  OR_LT },
-	{ ">=", OR_GE },
-	{ "<=", OR_LE }
-};
+bval* builtin_lower_fast(benv* e, int argc, bval** argv) {
+	return str_map("lower", argc, argv, tolower);
+}
 
-bval* builtin_ord(benv* e, bval* a, char* op) {
-	BASSERT_NUM(op, a, 2);
-	BASSERT_TYPE(op, a, 0, BVAL_NUM);
-	BASSERT_TYPE(op, a, 1, BVAL_NUM);
+// (str->num s) reads an integer or a double from s, as a number in code is read
+bval* builtin_str_num_fast(benv* e, int argc, bval** argv) {
+	FASSERT_NUM("str->num", argc, 1);
+	FASSERT_TYPE("str->num", argv, 0, BVAL_STR);
 
-	int r,
-		num_ordenators = sizeof(ordenators_map) / sizeof(ordenators_map[0]); // Find array lenght
+	char* s = argv[0]->str;
+	char* end;
+	errno = 0;
+	long long n = strtoll(s, &end, 10);
+	if(argv[0]->len && end == s + argv[0]->len && errno != ERANGE) return bval_int(n);
 
-	// Get operator index
-	enum OrdenatorsCode ordenators_code;
-	for(int i=0; i<num_ordenators; i++) {
-		if(strcmp(op, ordenators_map[i].name)==0) {
-			ordenators_code = ordenators_map[i].code;
-			break;
-		}
+	errno = 0;
+	double x = strtod(s, &end);
+	FASSERT(argv[0]->len && end == s + argv[0]->len && errno != ERANGE,
+		"Function 'str->num' could not read a number from \"%s\".", s);
+	return bval_num(x);
+}
+
+/**
+ * Writes the number 'x' like snprintf, doubles with the fewest digits
+ * that read back as the same value, so str->num gives x again
+ * */
+int num_format(char* buf, size_t size, bval* x) {
+	if(x->type == BVAL_INT) return snprintf(buf, size, "%lld", x->integer);
+	if(num_is_whole(x->num)) return snprintf(buf, size, "%lld", (long long)x->num);
+
+	char digits[32];
+	for(int p=1; p <= 17; p++) {
+		snprintf(digits, sizeof(digits), "%.*g", p, x->num);
+		if(strtod(digits, NULL) == x->num) break;
 	}
+	return snprintf(buf, size, "%s", digits);
+}
 
+// (num->str n) returns n written with the digits needed to read it back
+bval* builtin_num_str_fast(benv* e, int argc, bval** argv) {
+	FASSERT_NUM("num->str", argc, 1);
+	FASSERT_NUMBER("num->str", argv, 0);
 
-	switch (ordenators_code) {
-		case OR_GT:
-			r = (a->cell[0]->num > a->cell[1]->num);
-			break;
-		case OR_LT:
-			r = (a->cell[0]->num < a->cell[1]->num);
-			break;
-		case OR_GE:
-			r = (a->cell[0]->num >= a->cell[1]->num);
-			break;
-		case OR_LE:
-			r = (a->cell[0]->num <= a->cell[1]->num);
-			break;
+	int len = num_format(NULL, 0, argv[0]);
+	char* s = malloc(len + 1);
+	num_format(s, len + 1, argv[0]);
+	return bval_str_take(s, len);
+}
+
+/**
+ * A string builder is text that grows in place: (builder x ...) makes
+ * one, (append b x ...) adds to it and returns b, (build b) gives its
+ * text as a string. Strings are added as they are, numbers as num->str
+ * writes them and anything else as print does.
+ * The buffer doubles when it is full, so an append costs amortized O(1)
+ * per byte and text made of many appends is copied once by build,
+ * instead of at each step as with concat. Copies of a builder share
+ * its text
+ * */
+bval* bval_builder(void) {
+	bbuilder* b = malloc(sizeof(bbuilder));
+	b->refs = 1;
+	b->len  = 0;
+	b->cap  = 0;
+	b->data = NULL;
+
+	bval* v = malloc(sizeof(bval));
+	v->type    = BVAL_BUILDER;
+	v->builder = b;
+	return v;
+}
+
+void bbuilder_release(bbuilder* b) {
+	if(--b->refs > 0) return;
+	free(b->data);
+	free(b);
+}
+
+// End of the text, with room for 'n' more bytes and a 0
+char* bbuilder_reserve(bbuilder* b, long n) {
+	if(b->len + n + 1 > b->cap) {
+		b->cap = b->cap ? b->cap : 64;
+		while(b->len + n + 1 > b->cap) b->cap *= 2;
+		b->data = realloc(b->data, b->cap);
 	}
-	bval_del(a);
-	return bval_num(r);
+	return b->data + b->len;
 }
 
-bval* builtin_cmp(benv* e, bval* a, char* op) {
-	BASSERT_NUM(op, a, 2);
+void bbuilder_add(bbuilder* b, char* s, long len) {
+	memcpy(bbuilder_reserve(b, len), s, len);
+	b->len += len;
+	b->data[b->len] = '\0';
+}
 
-	int r;
-	if(strcmp(op, "==")==0)
-		r = bval_eq(a->cell[0], a->cell[1]);
+void bbuilder_put(bbuilder* b, bval* x) {
+	if(x->type == BVAL_STR) {
+		bbuilder_add(b, x->str, x->len);
+		return;
+	}
 
-	if(strcmp(op, "!=")==0)
-		r = !bval_eq(a->cell[0], a->cell[1]);
+	if(bval_is_num(x)) {
+		int len = num_format(NULL, 0, x);
+		num_format(bbuilder_reserve(b, len), len + 1, x);
+		b->len += len;
+		return;
+	}
 
-	bval_del(a);
-	return bval_num(r);
+	// Anything else is printed to a stream, in memory where there is one
+#if defined(__unix__)
+	char* s = NULL;
+	size_t len = 0;
+	FILE* f = open_memstream(&s, &len);
+	bval_fprint(f, x);
+	fclose(f);
+	bbuilder_add(b, s, len);
+	free(s);
+#else
+	FILE* f = tmpfile();
+	bval_fprint(f, x);
+	long len = ftell(f);
+	rewind(f);
+	len = fread(bbuilder_reserve(b, len), 1, len, f);
+	b->len += len;
+	b->data[b->len] = '\0';
+	fclose(f);
+#endif
 }
 
+// (builder x ...) returns a string builder with the values x added
+bval* builtin_builder_fast(benv* e, int argc, bval** argv) {
+	bval* b = bval_builder();
+	for(int i=0; i<argc; i++) bbuilder_put(b->builder, argv[i]);
+	return b;
+}
 
-bval* builtin_if(benv* e, bval* a) {
-	BASSERT_NUM("if", a, 3);
-	BASSERT_TYPE("if", a, 0, BVAL_NUM);
-	BASSERT_TYPE("if", a, 1, BVAL_QEXPR);
-	BASSERT_TYPE("if", a, 2, BVAL_QEXPR);
+// (append b x ...) adds the values x to the builder b and returns it
+bval* builtin_append_fast(benv* e, int argc, bval** argv) {
+	FASSERT(argc >= 1, "Function 'append' passed no arguments.");
+	FASSERT_TYPE("append", argv, 0, BVAL_BUILDER);
 
-	// Mark both expressions as evaluable
-	bval* x;
-	a->cell[1]->type = BVAL_SEXPR;
-	a->cell[2]->type = BVAL_SEXPR;
+	for(int i=1; i<argc; i++) bbuilder_put(argv[0]->builder, argv[i]);
+	bval* b = argv[0];
+	argv[0] = NULL;
+	return b;
+}
 
-	if(a->cell[0]->num)
-		// If condition is true evaluate first expression
-		x = bval_eval(e, bval_pop(a, 1));
-	else
-		// Otherwise evaluate second expression
-		x = bval_eval(e, bval_pop(a, 2));
+// (build b) returns the text of the builder b
+bval* builtin_build_fast(benv* e, int argc, bval** argv) {
+	FASSERT_NUM("build", argc, 1);
+	FASSERT_TYPE("build", argv, 0, BVAL_BUILDER);
 
-	// Delete argument list and return
-	bval_del(a);
-	return x;
+	bbuilder* b = argv[0]->builder;
+	return bval_str_len(b->len ? b->data : "", b->len);
 }
 
-bval* builtin_eq(benv* e, bval* a) {
-  return builtin_cmp(e, a, "==");
+bval* builtin_str_len(benv* e, bval* a) {
+	return builtin_fast(e, a, builtin_str_len_fast);
 }
 
-bval* builtin_ne(benv* e, bval* a) {
-  return builtin_cmp(e, a, "!=");
+bval* builtin_concat(benv* e, bval* a) {
+	return builtin_fast(e, a, builtin_concat_fast);
 }
 
+bval* builtin_substr(benv* e, bval* a) {
+	return builtin_fast(e, a, builtin_substr_fast);
+}
 
+bval* builtin_index_of(benv* e, bval* a) {
+	return builtin_fast(e, a, builtin_index_of_fast);
+}
 
-bval* builtin_gt(benv* e, bval* a) {
-	return builtin_ord(e, a, ">");
+bval* builtin_split(benv* e, bval* a) {
+	return builtin_fast(e, a, builtin_split_fast);
 }
 
-bval* builtin_lt(benv* e, bval* a) {
-	return builtin_ord(e, a, "<");
+bval* builtin_replace(benv* e, bval* a) {
+	return builtin_fast(e, a, builtin_replace_fast);
 }
 
-bval* builtin_ge(benv* e, bval* a) {
-	return builtin_ord(e, a, ">=");
+bval* builtin_upper(benv* e, bval* a) {
+	return builtin_fast(e, a, builtin_upper_fast);
 }
 
-bval* builtin_le(benv* e, bval* a) {
-	return builtin_ord(e, a, "<=");
+bval* builtin_lower(benv* e, bval* a) {
+	return builtin_fast(e, a, builtin_lower_fast);
+}
+
+bval* builtin_str_num(benv* e, bval* a) {
+	return builtin_fast(e, a, builtin_str_num_fast);
+}
+
+bval* builtin_num_str(benv* e, bval* a) {
+	return builtin_fast(e, a, builtin_num_str_fast);
+}
+
+bval* builtin_builder(benv* e, bval* a) {
+	return builtin_fast(e, a, builtin_builder_fast);
+}
+
+bval* builtin_append(benv* e, bval* a) {
+	return builtin_fast(e, a, builtin_append_fast);
 }
 
+bval* builtin_build(benv* e, bval* a) {
+	return builtin_fast(e, a, builtin_build_fast);
+}
 
 
 
@@ -1060,62 +2316,375 @@ bval* builtin_le(benv* e, bval* a) {
 
 /**
  * 
- * VARIABLE FUNCTIONS
+ * LOGICAL FUNCTIONS
  * 
  * */
-
+enum LogicalCode {
+	LO_AND,
+	LO_OR
+};
 
 /**
- * There are two ways we could define a variable now.
- * Either we could define it in the local, innermost environment,
- * or we could define it in the global, outermost environment.
- * We will add functions to do both. We'll leave the benv_put method
- * the same. It can be used for definition in the local environment.
- * But we'll add a new function benv_def for definition in the global
- * environment. This works by simply following the parent chain up before
- * using benv_put to define locally 
+ * Both take any number of arguments. && is true if all are true,
+ * || if any is. In the evaluator they are special forms (see
+ * bval_eval_special) that evaluate their arguments from left to right
+ * only until the result is known, so (&& (> n 0) (expensive n))
+ * skips (expensive n) when n <= 0
  * */
-bval* builtin_var(benv* e, bval* a, char* func) {
-	BASSERT_TYPE(func, a, 0, BVAL_QEXPR);
+bval* builtin_log_fast(benv* e, int argc, bval** argv, enum LogicalCode op) {
+	for(int i=0; i<argc; i++) {
+		int t = bval_val(argv[i]);
 
-	bval* syms = a->cell[0];
-	for(int i=0; i < syms->count; i++) {
-		BASSERT(a, (syms->cell[i]->type == BVAL_SYM),
-			"Function '%s' cannot define non-symbol. "
-			"Got %s, Expected %s.", func,
-			btype_name(syms->cell[i]->type),
-			btype_name(BVAL_SYM));
+		// Stop at the first false for && or the first true for ||
+		if(op == LO_AND && !t) return bval_int(0);
+		if(op == LO_OR && t) return bval_int(1);
 	}
+	return bval_int(op == LO_AND);
+}
 
-	BASSERT(a, (syms->count == a->count-1),
-		"Function '%s' passed too many arguments for symbols. "
-		"Got %i, Expected %i.", func, syms->count, a->count-1);
+// Same as above but argv are not evaluated yet
+bval* builtin_log_special(benv* e, int argc, bval** argv, enum LogicalCode op) {
+	for(int i=0; i<argc; i++) {
+		bval* x = bval_eval_keep(e, argv[i]);
+		if(x->type == BVAL_ERR) return x;
 
-	for(int i=0; i < syms->count; i++) {
-		// If 'def' define in globally. If 'put' define in locally
-		if(strcmp(func, "def")==0)
-			benv_def(e, syms->cell[i], a->cell[i+1]);
+		int t = bval_val(x);
+		bval_del(x);
 
-		if(strcmp(func, "=")==0)
-			benv_put(e, syms->cell[i], a->cell[i+1]);
+		if(op == LO_AND && !t) return bval_int(0);
+		if(op == LO_OR && t) return bval_int(1);
 	}
+	return bval_int(op == LO_AND);
+}
 
-	bval_del(a);
-	return bval_sexpr();
+bval* builtin_and_fast(benv* e, int argc, bval** argv) {
+	return builtin_log_fast(e, argc, argv, LO_AND);
 }
 
-bval* builtin_lambda(benv* e, bval* a) {
-	// Check two arguments, each of wich are Q-Expressions
-	BASSERT_NUM("\\", a, 2);
-	BASSERT_TYPE("\\", a, 0, BVAL_QEXPR);
-	BASSERT_TYPE("\\", a, 1, BVAL_QEXPR);
+bval* builtin_or_fast(benv* e, int argc, bval** argv) {
+	return builtin_log_fast(e, argc, argv, LO_OR);
+}
 
-	// Check first Q-Expression contains only symbols
-	for(int i=0; i < a->cell[0]->count; i++) {
-		BASSERT(a, (a->cell[0]->cell[i]->type == BVAL_SYM),
-			"Cannot define non-symbol. Got %s, Expected %s.",
-			btype_name(a->cell[0]->cell[i]->type), btype_name(BVAL_SYM));
-	}
+bval* builtin_and_special(benv* e, int argc, bval** argv) {
+	return builtin_log_special(e, argc, argv, LO_AND);
+}
+
+bval* builtin_or_special(benv* e, int argc, bval** argv) {
+	return builtin_log_special(e, argc, argv, LO_OR);
+}
+
+bval* builtin_and(benv* e, bval* a) {
+	return builtin_fast(e, a, builtin_and_fast);
+}
+
+bval* builtin_or(benv* e, bval* a) {
+	return builtin_fast(e, a, builtin_or_fast);
+}
+
+
+
+
+
+
+
+
+/**
+ * 
+ * COMPARSION FUNCTIONS
+ * 
+ * */
+
+
+
+// enum of operators_map types of eval_op
+enum OrdenatorsCode {
+	OR_GT,
+	OR_LT,
+	OR_GE,
+	OR_LE,
+	OR_EQ,
+	OR_NE
+};
+
+// Define struct of operators
+struct OrdenatorsEntry {
+	char* name;
+	enum OrdenatorsCode code;
+
+} ordenators_map[] = { // Define operators, same order as OrdenatorsCode
+	{ ">",  OR_GT },
+	{ "<",  OR_LT },
+	{ ">=", OR_GE },
+	{ "<=", OR_LE },
+	{ "==", OR_EQ },
+	{ "!=", OR_NE }
+};
+
+/**
+ * Each builtin passes its own code, so the operator is known when
+ * the builtin is registered and no name has to be looked up on calls.
+ * The name is only used for error messages
+ * */
+bval* builtin_ord_fast(benv* e, int argc, bval** argv, enum OrdenatorsCode op) {
+	char* name = ordenators_map[op].name;
+	FASSERT_NUM(name, argc, 2);
+	FASSERT_NUMBER(name, argv, 0);
+	FASSERT_NUMBER(name, argv, 1);
+
+	int c = bval_num_cmp(argv[0], argv[1]);
+	int r = 0;
+	switch (op) {
+		case OR_GT:
+			r = (c == 1);
+			break;
+		case OR_LT:
+			r = (c == -1);
+			break;
+		case OR_GE:
+			r = (c == 1 || c == 0);
+			break;
+		case OR_LE:
+			r = (c == -1 || c == 0);
+			break;
+		default: break;
+	}
+	return bval_int(r);
+}
+
+// Same as above but compares any type
+bval* builtin_cmp_fast(benv* e, int argc, bval** argv, enum OrdenatorsCode op) {
+	FASSERT_NUM(ordenators_map[op].name, argc, 2);
+
+	int r = bval_eq(argv[0], argv[1]);
+	if(op == OR_NE) r = !r;
+
+	return bval_int(r);
+}
+
+
+bval* builtin_if_fast(benv* e, int argc, bval** argv) {
+	FASSERT_NUM("if", argc, 3);
+	FASSERT_NUMBER("if", argv, 0);
+	FASSERT_TYPE("if", argv, 1, BVAL_QEXPR);
+	FASSERT_TYPE("if", argv, 2, BVAL_QEXPR);
+
+	// If condition is true take first expression, otherwise the second
+	int i = bval_val(argv[0]) ? 1 : 2;
+	bval* x = argv[i];
+	argv[i] = NULL;
+
+	// Mark it as evaluable and evaluate
+	x->type = BVAL_SEXPR;
+	return bval_eval(e, x);
+}
+
+bval* builtin_if(benv* e, bval* a) {
+	return builtin_fast(e, a, builtin_if_fast);
+}
+
+/**
+ * In the evaluator 'if' is a special form: only the condition and the
+ * branch taken are evaluated, and a literal branch is evaluated where it
+ * is, so the other one is neither copied nor deleted
+ * */
+bval* builtin_if_special(benv* e, int argc, bval** argv) {
+	FASSERT_NUM("if", argc, 3);
+
+	// Branches written as numbers or strings can't give a Q-Expression
+	for(int i=1; i<3; i++) {
+		int t = argv[i]->type;
+		if(t != BVAL_SYM && t != BVAL_SEXPR && t != BVAL_GUARD)
+			FASSERT_TYPE("if", argv, i, BVAL_QEXPR);
+	}
+
+	bval* c = bval_eval_keep(e, argv[0]);
+	if(c->type == BVAL_ERR) return c;
+	if(!bval_is_num(c)) {
+		bval* err = bval_err(
+			"Function '%s' Got %s type for argument %i, Expected %s.",
+			"if", btype_name(c->type), 0, btype_name(BVAL_NUM));
+		bval_del(c);
+		return err;
+	}
+
+	int i = bval_val(c) ? 1 : 2;
+	bval_del(c);
+	return special_eval_qexpr(e, "if", argv, i);
+}
+
+bval* builtin_eq_fast(benv* e, int argc, bval** argv) {
+	return builtin_cmp_fast(e, argc, argv, OR_EQ);
+}
+
+bval* builtin_ne_fast(benv* e, int argc, bval** argv) {
+	return builtin_cmp_fast(e, argc, argv, OR_NE);
+}
+
+bval* builtin_gt_fast(benv* e, int argc, bval** argv) {
+	return builtin_ord_fast(e, argc, argv, OR_GT);
+}
+
+bval* builtin_lt_fast(benv* e, int argc, bval** argv) {
+	return builtin_ord_fast(e, argc, argv, OR_LT);
+}
+
+bval* builtin_ge_fast(benv* e, int argc, bval** argv) {
+	return builtin_ord_fast(e, argc, argv, OR_GE);
+}
+
+bval* builtin_le_fast(benv* e, int argc, bval** argv) {
+	return builtin_ord_fast(e, argc, argv, OR_LE);
+}
+
+bval* builtin_eq(benv* e, bval* a) {
+	return builtin_fast(e, a, builtin_eq_fast);
+}
+
+bval* builtin_ne(benv* e, bval* a) {
+	return builtin_fast(e, a, builtin_ne_fast);
+}
+
+bval* builtin_gt(benv* e, bval* a) {
+	return builtin_fast(e, a, builtin_gt_fast);
+}
+
+bval* builtin_lt(benv* e, bval* a) {
+	return builtin_fast(e, a, builtin_lt_fast);
+}
+
+bval* builtin_ge(benv* e, bval* a) {
+	return builtin_fast(e, a, builtin_ge_fast);
+}
+
+bval* builtin_le(benv* e, bval* a) {
+	return builtin_fast(e, a, builtin_le_fast);
+}
+
+
+
+
+
+
+
+
+
+/**
+ * 
+ * VARIABLE FUNCTIONS
+ * 
+ * */
+
+
+/**
+ * There are two ways we could define a variable now.
+ * Either we could define it in the local, innermost environment,
+ * or we could define it in the global, outermost environment.
+ * We will add functions to do both. We'll leave the benv_put method
+ * the same. It can be used for definition in the local environment.
+ * But we'll add a new function benv_def for definition in the global
+ * environment. This works by simply following the parent chain up before
+ * using benv_put to define locally 
+ * */
+bval* builtin_var(benv* e, bval* a, char* func) {
+	BASSERT_TYPE(func, a, 0, BVAL_QEXPR);
+
+	bval* syms = a->cell[0];
+	for(int i=0; i < syms->count; i++) {
+		BASSERT(a, (syms->cell[i]->type == BVAL_SYM),
+			"Function '%s' cannot define non-symbol. "
+			"Got %s, Expected %s.", func,
+			btype_name(syms->cell[i]->type),
+			btype_name(BVAL_SYM));
+	}
+
+	BASSERT(a, (syms->count == a->count-1),
+		"Function '%s' passed too many arguments for symbols. "
+		"Got %i, Expected %i.", func, syms->count, a->count-1);
+
+	for(int i=0; i < syms->count; i++) {
+		// If 'def' define in globally. If 'put' define in locally
+		if(strcmp(func, "def")==0)
+			benv_def(e, syms->cell[i], a->cell[i+1]);
+
+		// Loop and let frames pass anything but their variables to the enclosing frame
+		if(strcmp(func, "=")==0) {
+			benv* f = e;
+			while(f->loop && !benv_holds(f, syms->cell[i]->sym))
+				f = f->par;
+			benv_put(f, syms->cell[i], a->cell[i+1]);
+		}
+	}
+
+	bval_del(a);
+	return bval_sexpr();
+}
+
+/**
+ * (let {x 1 y (+ x 1)} {body}) evaluates body with x and y bound, each
+ * value sees the bindings before it. The frame and its arrays live on
+ * the C stack, and the names point into the binding list, so nothing is
+ * allocated for the frame itself. As in a 'for' loop '=' only sets the
+ * variables of the frame and passes anything else on, so it never grows
+ * */
+bval* builtin_let_special(benv* e, int argc, bval** argv) {
+	FASSERT_NUM("let", argc, 2);
+	FASSERT_TYPE("let", argv, 0, BVAL_QEXPR);
+
+	bval* binds = argv[0];
+	FASSERT(binds->count % 2 == 0,
+		"Function 'let' passed %i elements to bind, Expected pairs of symbol and value.",
+		binds->count);
+	for(int i=0; i < binds->count; i += 2) {
+		FASSERT(binds->cell[i]->type == BVAL_SYM,
+			"Function 'let' cannot define non-symbol. Got %s, Expected %s.",
+			btype_name(binds->cell[i]->type), btype_name(BVAL_SYM));
+	}
+
+	int n = binds->count / 2;
+	char* syms[n ? n : 1];
+	bval* vals[n ? n : 1];
+	benv frame = { e, 1, 0, syms, vals };
+
+	bval* x = NULL;
+	for(int i=0; i<n; i++) {
+		bval* v = bval_eval_keep(&frame, binds->cell[2*i+1]);
+		if(v->type == BVAL_ERR) {
+			x = v;
+			break;
+		}
+
+		// A name given twice keeps the last value
+		char* sym = binds->cell[2*i]->sym;
+		int k = 0;
+		while(k < frame.count && strcmp(syms[k], sym)!=0) k++;
+
+		if(k == frame.count) syms[frame.count++] = sym;
+		else bval_del(vals[k]);
+		vals[k] = v;
+	}
+
+	if(!x) x = special_eval_qexpr(&frame, "let", argv, 1);
+
+	for(int i=0; i < frame.count; i++) bval_del(vals[i]);
+	return x;
+}
+
+bval* builtin_let(benv* e, bval* a) {
+	return builtin_fast(e, a, builtin_let_special);
+}
+
+bval* builtin_lambda(benv* e, bval* a) {
+	// Check two arguments, each of wich are Q-Expressions
+	BASSERT_NUM("\\", a, 2);
+	BASSERT_TYPE("\\", a, 0, BVAL_QEXPR);
+	BASSERT_TYPE("\\", a, 1, BVAL_QEXPR);
+
+	// Check first Q-Expression contains only symbols
+	for(int i=0; i < a->cell[0]->count; i++) {
+		BASSERT(a, (a->cell[0]->cell[i]->type == BVAL_SYM),
+			"Cannot define non-symbol. Got %s, Expected %s.",
+			btype_name(a->cell[0]->cell[i]->type), btype_name(BVAL_SYM));
+	}
 
 	// Pop first to arguments and pass them to bval_lambda
 	bval* formals = bval_pop(a, 0);
@@ -1169,7 +2738,7 @@ struct OperatorEntry {
 	{ "+",   OP_ADD },
 	{ "add", OP_ADD },
 	{ "-",   OP_SUB },
-	{ "min", OP_SUB },
+	{ "sub", OP_SUB },
 	{ "*",   OP_MUL },
 	{ "mul", OP_MUL },
 	{ "/",   OP_DIV },
@@ -1182,426 +2751,5866 @@ struct OperatorEntry {
 	{ "max", OP_MAX }
 };
 
-bval* builtin_op(benv* e, bval* a, char* op) {
+/**
+ * Apply the operator to two integers. Returns 0 if the result is not an
+ * exact integer (it overflows, or a division has a remainder), in which
+ * case the caller promotes to double. The divisor is never 0 here
+ * */
+int op_int(enum OperatorCode op, long long x, long long y, long long* r) {
+	switch (op) {
+		case OP_ADD:
+			if((y > 0 && x > LLONG_MAX - y) || (y < 0 && x < LLONG_MIN - y)) return 0;
+			*r = x + y;
+			return 1;
+		case OP_SUB:
+			if((y < 0 && x > LLONG_MAX + y) || (y > 0 && x < LLONG_MIN + y)) return 0;
+			*r = x - y;
+			return 1;
+		case OP_MUL:
+			if(x > 0) {
+				if((y > 0 && x > LLONG_MAX / y) || (y < 0 && y < LLONG_MIN / x)) return 0;
+			} else if(x < 0) {
+				if((y > 0 && x < LLONG_MIN / y) || (y < 0 && x < LLONG_MAX / y)) return 0;
+			}
+			*r = x * y;
+			return 1;
+		case OP_DIV:
+			if(y == -1 && x == LLONG_MIN) return 0;
+			if(x % y != 0) return 0;
+			*r = x / y;
+			return 1;
+		case OP_RES:
+			*r = (y == -1) ? 0 : x % y;
+			return 1;
+		case OP_POW: {
+			if(y < 0) return 0;
+
+			// Exponentiation by squaring, giving up on overflow
+			long long b = x, p = 1;
+			while(y) {
+				if(y & 1 && !op_int(OP_MUL, p, b, &p)) return 0;
+				y >>= 1;
+				if(y && !op_int(OP_MUL, b, b, &b)) return 0;
+			}
+			*r = p;
+			return 1;
+		}
+		default: return 0;
+	}
+}
+
+// Same for doubles
+double op_double(enum OperatorCode op, double x, double y) {
+	switch (op) {
+		case OP_ADD: return x + y;
+		case OP_SUB: return x - y;
+		case OP_MUL: return x * y;
+		case OP_DIV: return x / y;
+		case OP_RES: return fmod(x, y);
+		case OP_POW: return pow(x, y);
+		case OP_MIN: return (x < y) ? x : y;
+		case OP_MAX: return (x > y) ? x : y;
+		default: return 0;
+	}
+}
+
+/**
+ * The operator is given by the builtin that was registered (see builtin_add
+ * and friends), so the switch runs once per call and each case is a plain
+ * loop over the arguments.
+ * Integers are folded as integers until an argument is a double or a
+ * result is not exact, from there on the fold continues with doubles
+ * */
+bval* bvec_op_fast(int argc, bval** argv, enum OperatorCode op);
+bval* builtin_op_fast(benv* e, int argc, bval** argv, enum OperatorCode op) {
+	// Vectors are operated element by element
+	for(int i=0; i < argc; i++) {
+		if(argv[i]->type == BVAL_VEC) return bvec_op_fast(argc, argv, op);
+	}
+
 	// Ensure all arguments are numbers
-	for(int i=0; i < a->count; i++) {
-		if(a->cell[i]->type != BVAL_NUM) {
-			bval_del(a);
+	for(int i=0; i < argc; i++) {
+		if(!bval_is_num(argv[i]))
 			return bval_err("Cannot operate non-numbers!");
+	}
+
+	FASSERT(argc > 0, "Cannot operate without arguments!");
+
+	// min and max give back the chosen argument as it is
+	if(op == OP_MIN || op == OP_MAX) {
+		int best = 0;
+		for(int i=1; i < argc; i++) {
+			int c = bval_num_cmp(argv[i], argv[best]);
+			if((op == OP_MIN && c == -1) || (op == OP_MAX && c == 1)) best = i;
 		}
+		bval* x = argv[best];
+		argv[best] = NULL;
+		return x;
 	}
 
-	// Pop the first element
-	bval* x = bval_pop(a, 0);
+	if(op == OP_UNKNOWN)
+		return bval_err("Bad Operator!");
 
-	// If no arguments and sub then perform unary negation
-	if((strcmp(op, "-")==0) && a->count == 0)
-		x->num = -x->num;
+	// Start from the first element
+	int is_int  = (argv[0]->type == BVAL_INT);
+	long long n = (is_int) ? argv[0]->integer : 0;
+	double x    = bval_to_double(argv[0]);
 
-	// While there are still elements remaining
-	while(a->count > 0) {
-		int err = 0; // Check for error from inside switch
+	// If no arguments then perform unary negation
+	if(op == OP_SUB && argc == 1) {
+		if(is_int && n != LLONG_MIN) return bval_int(-n);
+		return bval_num(-x);
+	}
 
-		// Pop the next element
-		bval* y = bval_pop(a, 0);
+	for(int i=1; i < argc; i++) {
+		bval* y = argv[i];
 
-		int num_operators = sizeof(operators_map) / sizeof(operators_map[0]); // Find array lenght
+		if((op == OP_DIV || op == OP_RES) && bval_to_double(y) == 0)
+			return bval_err("Division by Zero!");
 
-		// Get operator index
-		enum OperatorCode operator_code = OP_UNKNOWN;
-		for(int i=0; i<num_operators; i++) {
-			if(strcmp(op, operators_map[i].name)==0) {
-				operator_code = operators_map[i].code;
-				break;
+		if(is_int && y->type == BVAL_INT) {
+			long long r;
+			if(op_int(op, n, y->integer, &r)) {
+				n = r;
+				continue;
 			}
 		}
 
+		// Promote
+		if(is_int) {
+			x = (double)n;
+			is_int = 0;
+		}
+		x = op_double(op, x, bval_to_double(y));
+	}
 
-		switch (operator_code) {
-			case OP_ADD:
-				x->num += y->num;
-				break;
-			case OP_SUB:
-				x->num -= y->num;
-				break;
-			case OP_MUL:
-				x->num *= y->num;
-				break;
-			case OP_DIV:
-				if(y->num==0) {
-					bval_del(x); bval_del(y);
-					x = bval_err("Division by Zero!");
+	return (is_int) ? bval_int(n) : bval_num(x);
+}
 
-					err=1; break; // Error
-				}
-				x->num /= y->num;
-				break;
-			case OP_RES:
-				if(y->num==0) {
-					bval_del(x); bval_del(y);
-					x = bval_err("Division by Zero!");
+// Apply operator given by name, e.g. "+" or "add"
+bval* builtin_op(benv* e, bval* a, char* op) {
+	int num_operators = sizeof(operators_map) / sizeof(operators_map[0]); // Find array lenght
 
-					err=1; break; // Error
-				}
-				x->num = (long)x->num % (long)y->num;
-				break;
-			case OP_POW:
-				x->num = pow(x->num, y->num);
-				break;
-			case OP_MIN:
-				x->num = (x->num <= y->num) ? x->num : y->num;
-				break;
-			case OP_MAX:
-				x->num = (x->num >= y->num) ? x->num : y->num;
-				break;
-			default:
-				bval_del(x); bval_del(y);
-				x = bval_err("Bad Operator!");
-				
-				err=1; break; // Erro
+	// Get operator code
+	enum OperatorCode operator_code = OP_UNKNOWN;
+	for(int i=0; i<num_operators; i++) {
+		if(strcmp(op, operators_map[i].name)==0) {
+			operator_code = operators_map[i].code;
+			break;
 		}
-		if(err) break; // Error occurred, break while loop
+	}
+
+	bval* x = builtin_op_fast(e, a->count, a->cell, operator_code);
+	bval_del(a);
+	return x;
+}
+
+bval* builtin_add_fast(benv* e, int argc, bval** argv) {
+	return builtin_op_fast(e, argc, argv, OP_ADD);
+}
+
+bval* builtin_sub_fast(benv* e, int argc, bval** argv) {
+	return builtin_op_fast(e, argc, argv, OP_SUB);
+}
+
+bval* builtin_mul_fast(benv* e, int argc, bval** argv) {
+	return builtin_op_fast(e, argc, argv, OP_MUL);
+}
+
+bval* builtin_div_fast(benv* e, int argc, bval** argv) {
+	return builtin_op_fast(e, argc, argv, OP_DIV);
+}
+
+bval* builtin_res_fast(benv* e, int argc, bval** argv) {
+	return builtin_op_fast(e, argc, argv, OP_RES);
+}
+
+bval* builtin_pow_fast(benv* e, int argc, bval** argv) {
+	return builtin_op_fast(e, argc, argv, OP_POW);
+}
+
+bval* builtin_min_fast(benv* e, int argc, bval** argv) {
+	return builtin_op_fast(e, argc, argv, OP_MIN);
+}
+
+bval* builtin_max_fast(benv* e, int argc, bval** argv) {
+	return builtin_op_fast(e, argc, argv, OP_MAX);
+}
+
+bval* builtin_add(benv* e, bval* a) {
+	return builtin_fast(e, a, builtin_add_fast);
+}
+
+bval* builtin_sub(benv* e, bval* a) {
+	return builtin_fast(e, a, builtin_sub_fast);
+}
+
+bval* builtin_mul(benv* e, bval* a) {
+	return builtin_fast(e, a, builtin_mul_fast);
+}
+
+bval* builtin_div(benv* e, bval* a) {
+	return builtin_fast(e, a, builtin_div_fast);
+}
+
+bval* builtin_res(benv* e, bval* a) {
+	return builtin_fast(e, a, builtin_res_fast);
+}
+
+bval* builtin_pow(benv* e, bval* a) {
+	return builtin_fast(e, a, builtin_pow_fast);
+}
+
+bval* builtin_min(benv* e, bval* a) {
+	return builtin_fast(e, a, builtin_min_fast);
+}
+
+bval* builtin_max(benv* e, bval* a) {
+	return builtin_fast(e, a, builtin_max_fast);
+}
+
+
+/**
+ * 
+ * MEMOIZATION FUNCTIONS
+ * 
+ * */
+
+/**
+ * (memo f) returns a function that calls f and caches the result for
+ * each list of arguments, so pure recursive functions like fib don't
+ * recompute the same calls. Arguments are compared with bval_eq and
+ * hashed with bval_hash. The cache holds at most a number of results
+ * (MEMO_DEFAULT_MAX or the second argument to memo, up to MEMO_LIMIT),
+ * evicting the least recently used. Errors are not cached.
+ * */
+#define MEMO_DEFAULT_MAX 4096
+#define MEMO_LIMIT (1 << 24)
+
+bval* bval_memo(bval* fn, size_t max) {
+	bmemo* m = malloc(sizeof(bmemo));
+	m->refs  = 1;
+	m->fn    = fn;
+	m->count = 0;
+	m->max   = max;
+	m->hits  = 0;
+	m->misses = 0;
+	m->newest = NULL;
+	m->oldest = NULL;
+
+	// Grows with the entries, so a large max costs nothing until used
+	m->buckets_num = 16;
+	m->buckets = calloc(m->buckets_num, sizeof(bmemo_entry*));
+
+	bval* v = malloc(sizeof(bval));
+	v->type = BVAL_MEMO;
+	v->memo = m;
+	return v;
+}
+
+void bmemo_release(bmemo* m) {
+	if(--m->refs > 0) return;
+
+	bmemo_entry* x = m->newest;
+	while(x) {
+		bmemo_entry* older = x->older;
+		bval_del(x->args);
+		bval_del(x->val);
+		free(x);
+		x = older;
+	}
+
+	bval_del(m->fn);
+	free(m->buckets);
+	free(m);
+}
+
+// Remove entry from the least recently used list
+void bmemo_unlink(bmemo* m, bmemo_entry* x) {
+	if(x->newer) x->newer->older = x->older; else m->newest = x->older;
+	if(x->older) x->older->newer = x->newer; else m->oldest = x->newer;
+}
+
+// Put entry as the most recently used
+void bmemo_push(bmemo* m, bmemo_entry* x) {
+	x->newer = NULL;
+	x->older = m->newest;
+	if(m->newest) m->newest->newer = x;
+	m->newest = x;
+	if(!m->oldest) m->oldest = x;
+}
+
+bmemo_entry* bmemo_find(bmemo* m, bval* args, unsigned long hash) {
+	bmemo_entry* x = m->buckets[hash & (m->buckets_num-1)];
+	for(; x; x = x->next) {
+		if(x->hash == hash && bval_eq(x->args, args)) return x;
+	}
+	return NULL;
+}
+
+void bmemo_evict(bmemo* m) {
+	bmemo_entry* x = m->oldest;
+	bmemo_unlink(m, x);
+
+	// Remove from its bucket
+	bmemo_entry** p = &m->buckets[x->hash & (m->buckets_num-1)];
+	while(*p != x) p = &(*p)->next;
+	*p = x->next;
+
+	bval_del(x->args);
+	bval_del(x->val);
+	free(x);
+	m->count--;
+}
+
+// Double the buckets, keeping at most one entry per bucket on average
+void bmemo_grow(bmemo* m) {
+	size_t num = m->buckets_num * 2;
+	bmemo_entry** buckets = calloc(num, sizeof(bmemo_entry*));
+	if(!buckets) return; // Keep the longer chains
+
+	for(size_t i=0; i<m->buckets_num; i++) {
+		bmemo_entry* x = m->buckets[i];
+		while(x) {
+			bmemo_entry* next = x->next;
+			x->next = buckets[x->hash & (num-1)];
+			buckets[x->hash & (num-1)] = x;
+			x = next;
+		}
+	}
+
+	free(m->buckets);
+	m->buckets = buckets;
+	m->buckets_num = num;
+}
+
+void bmemo_add(bmemo* m, bval* args, bval* val, unsigned long hash) {
+	if(m->count >= m->max) bmemo_evict(m);
+	if(m->count >= m->buckets_num) bmemo_grow(m);
+
+	bmemo_entry* x = malloc(sizeof(bmemo_entry));
+	x->args = args;
+	x->val  = val;
+	x->hash = hash;
+
+	size_t i = hash & (m->buckets_num-1);
+	x->next = m->buckets[i];
+	m->buckets[i] = x;
+
+	bmemo_push(m, x);
+	m->count++;
+}
+
+bval* bval_call(benv* e, bval* f, bval* a);
+
+// Call a memoized function, 'a' are the arguments
+bval* bmemo_call(benv* e, bmemo* m, bval* a) {
+	unsigned long hash = bval_hash(a);
+
+	bmemo_entry* x = bmemo_find(m, a, hash);
+	if(x) {
+		m->hits++;
+		bmemo_unlink(m, x);
+		bmemo_push(m, x);
+
+		bval_del(a);
+		return bval_copy(x->val);
+	}
+
+	m->misses++;
+
+	// Keep the cache alive even if the function is redefined while called
+	m->refs++;
+	bval* r = bval_call(e, m->fn, bval_copy(a));
+
+	// A recursive call may have added the same arguments already
+	if(r->type != BVAL_ERR && m->max > 0 && !bmemo_find(m, a, hash))
+		bmemo_add(m, a, bval_copy(r), hash);
+	else
+		bval_del(a);
+
+	bmemo_release(m);
+	return r;
+}
+
+int bval_callable(bval* f) {
+	return f->type == BVAL_FUN || f->type == BVAL_PART || f->type == BVAL_MEMO;
+}
+
+bval* builtin_memo(benv* e, bval* a) {
+	BASSERT(a, a->count == 1 || a->count == 2,
+		"Function 'memo' passed %i arguments, Expected 1 or 2.", a->count);
+	BASSERT(a, bval_callable(a->cell[0]),
+		"Function 'memo' Got %s type for argument 0, Expected %s.",
+		btype_name(a->cell[0]->type), btype_name(BVAL_FUN));
+
+	size_t max = MEMO_DEFAULT_MAX;
+	if(a->count == 2) {
+		BASSERT_NUMBER("memo", a, 1);
+		BASSERT(a, bval_to_double(a->cell[1]) >= 0,
+			"Function 'memo' passed negative cache size.");
+		BASSERT(a, bval_to_double(a->cell[1]) <= MEMO_LIMIT,
+			"Function 'memo' passed cache size over %i.", MEMO_LIMIT);
+		max = bval_to_double(a->cell[1]);
+	}
+
+	bval* fn = bval_pop(a, 0);
+	bval_del(a);
+	return bval_memo(fn, max);
+}
+
+// Returns {hits misses size max} of a memoized function
+bval* builtin_memo_stats(benv* e, bval* a) {
+	BASSERT_NUM("memo-stats", a, 1);
+	BASSERT_TYPE("memo-stats", a, 0, BVAL_MEMO);
+
+	bmemo* m = a->cell[0]->memo;
+	bval* x = bval_qexpr();
+	x = bval_add(x, bval_int(m->hits));
+	x = bval_add(x, bval_int(m->misses));
+	x = bval_add(x, bval_int(m->count));
+	x = bval_add(x, bval_int(m->max));
+
+	bval_del(a);
+	return x;
+}
+
+// Removes all cached results and resets the statistics
+bval* builtin_memo_clear(benv* e, bval* a) {
+	BASSERT_NUM("memo-clear", a, 1);
+	BASSERT_TYPE("memo-clear", a, 0, BVAL_MEMO);
+
+	bmemo* m = a->cell[0]->memo;
+	while(m->count) bmemo_evict(m);
+	m->hits = 0;
+	m->misses = 0;
+
+	bval_del(a);
+	return bval_sexpr();
+}
+
+
+/**
+ * 
+ * RANGE FUNCTIONS
+ * 
+ * */
+
+/**
+ * (range stop), (range start stop) and (range start stop step) return
+ * the numbers from start (0 if not given) up to, but not including,
+ * stop, as 'for' counts them. Only start, step and how many there are
+ * is kept, each element is made when it is read, so len is O(1), tail
+ * returns another range and map, filter, the folds, vec, take and for
+ * go through a range of any length in the same memory.
+ * (range->list r) makes the Q-Expression of all of them
+ * */
+bval* bval_range(brange* range) {
+	bval* v = malloc(sizeof(bval));
+	v->type  = BVAL_RANGE;
+	v->range = range;
+	return v;
+}
+
+void brange_release(brange* r) {
+	if(--r->refs == 0) free(r);
+}
+
+// Elements left
+long long brange_len(brange* r) {
+	return r->count - r->first;
+}
+
+// Element 'i' of the ones left
+bval* brange_at(brange* r, long long i) {
+	i += r->first;
+	return r->integer ? bval_int(r->istart + i * r->istep) : bval_num(r->start + i * r->step);
+}
+
+// Range without its first element
+bval* brange_tail(brange* r) {
+	brange* x = malloc(sizeof(brange));
+	*x = *r;
+	x->refs = 1;
+	if(x->first < x->count) x->first++;
+	return bval_range(x);
+}
+
+// (range [start] stop [step]) returns the numbers from start up to stop
+bval* builtin_range_fast(benv* e, int argc, bval** argv) {
+	FASSERT(argc >= 1 && argc <= 3,
+		"Function 'range' passed %i arguments, Expected 1 to 3.", argc);
+
+	int integer = 1;
+	for(int i=0; i<argc; i++) {
+		FASSERT_NUMBER("range", argv, i);
+		if(argv[i]->type != BVAL_INT) integer = 0;
+	}
+
+	bval* start = (argc > 1) ? argv[0] : NULL;
+	bval* stop  = (argc > 1) ? argv[1] : argv[0];
+	bval* step  = (argc > 2) ? argv[2] : NULL;
+
+	brange* r = malloc(sizeof(brange));
+	r->refs    = 1;
+	r->integer = integer;
+	r->first   = 0;
+	r->count   = 0;
+
+	if(integer) {
+		r->istart = start ? start->integer : 0;
+		r->istop  = stop->integer;
+		r->istep  = step ? step->integer : 1;
+
+		// Counted unsigned so stop - start can't overflow
+		long long s = r->istep;
+		if(s > 0 && r->istart < r->istop)
+			r->count = ((unsigned long long)r->istop - r->istart - 1) / s + 1;
+		if(s < 0 && r->istart > r->istop)
+			r->count = ((unsigned long long)r->istart - r->istop - 1) / (0ULL - s) + 1;
+		if(s != 0) return bval_range(r);
+
+		free(r);
+		return bval_err("Function 'range' passed 0 as step.");
+	}
+
+	r->start = start ? bval_to_double(start) : 0;
+	r->stop  = bval_to_double(stop);
+	r->step  = step ? bval_to_double(step) : 1;
+
+	double n = ceil((r->stop - r->start) / r->step);
+	if(r->step == 0 || !(n < 9e18)) {
+		free(r);
+		return bval_err("Function 'range' passed a step that gives no end.");
+	}
+
+	// Corrected so each start + i*step, as 'for' makes them, is before stop
+	r->count = (n > 0) ? (long long)n : 0;
+	while(r->count > 0 && ((r->step > 0) ? (r->start + (r->count-1) * r->step >= r->stop)
+		: (r->start + (r->count-1) * r->step <= r->stop))) r->count--;
+	while((r->step > 0) ? (r->start + r->count * r->step < r->stop)
+		: (r->start + r->count * r->step > r->stop)) r->count++;
+	return bval_range(r);
+}
+
+// (range->list r) returns the elements of r as a Q-Expression
+bval* builtin_range_list_fast(benv* e, int argc, bval** argv) {
+	FASSERT_NUM("range->list", argc, 1);
+	FASSERT_TYPE("range->list", argv, 0, BVAL_RANGE);
+
+	brange* r = argv[0]->range;
+	long long n = brange_len(r);
+	FASSERT(n <= INT_MAX, "Function 'range->list' passed a range of %lld elements, too long for a list.", n);
+
+	bval* x = bval_qexpr();
+	x->cell = malloc(sizeof(bval*) * (n ? n : 1));
+	if(!x->cell) {
+		bval_del(x);
+		return bval_err("Function 'range->list' could not allocate %lld elements.", n);
+	}
+	x->count = (int)n;
+	for(long long i=0; i < n; i++) x->cell[i] = brange_at(r, i);
+	return x;
+}
+
+bval* builtin_range(benv* e, bval* a) {
+	return builtin_fast(e, a, builtin_range_fast);
+}
+
+bval* builtin_range_list(benv* e, bval* a) {
+	return builtin_fast(e, a, builtin_range_list_fast);
+}
+
+
+/**
+ * 
+ * LAZY FUNCTIONS
+ * 
+ * */
+
+/**
+ * (delay {expr}) returns a promise, (force p) evaluates expr the first
+ * time and gives back that value from then on. Scope is dynamic and the
+ * frames of the caller are gone by the time a promise is forced, so the
+ * local variables expr uses are copied when it is delayed, other names
+ * are looked up in the root environment. Errors are not cached.
+ * (lazy-cons x {rest}) is x followed by the elements of what rest gives,
+ * a Q-Expression or another lazy sequence, {} ends it. head, tail, len and take only
+ * force what they need, so an unbounded sequence walked without keeping
+ * its start runs in constant memory
+ * */
+
+// Copy into 'to' the variables 'v' uses that are local to 'e'
+void promise_capture(benv* e, benv* to, bval* v) {
+	switch(v->type) {
+		case BVAL_SYM: {
+			benv* owner = NULL;
+			bval* x = benv_lookup(e, v->sym, &owner);
+			if(x && owner->par && !benv_lookup(to, v->sym, NULL)) benv_put(to, v, x);
+			return;
+		}
+
+		case BVAL_GUARD: promise_capture(e, to, v->fallback); return;
+
+		case BVAL_SEXPR:
+		case BVAL_QEXPR:
+			for(int i=0; i < v->count; i++) promise_capture(e, to, v->cell[i]);
+			return;
+	}
+}
+
+// New environment holding the local variables of 'e' that 'v' uses, its parent is the root
+benv* benv_capture(benv* e, bval* v) {
+	benv* x = benv_new();
+	promise_capture(e, x, v);
+
+	// Parent is set after capturing, so only the frame itself is searched
+	while(e->par) e = e->par;
+	x->par = e;
+	return x;
+}
+
+// Takes 'expr'
+bpromise* bpromise_new(benv* e, bval* expr) {
+	bpromise* p = malloc(sizeof(bpromise));
+	p->refs  = 1;
+	p->state = PROMISE_PENDING;
+	p->expr  = expr;
+	p->value = NULL;
+	p->env   = benv_capture(e, expr);
+	return p;
+}
+
+bval* bval_promise(bpromise* p) {
+	bval* v = malloc(sizeof(bval));
+	v->type    = BVAL_PROMISE;
+	v->promise = p;
+	return v;
+}
+
+// Takes 'first', the rest is given by 'p'
+bval* bval_lseq(bval* first, bpromise* p) {
+	bval* v = malloc(sizeof(bval));
+	v->type    = BVAL_LSEQ;
+	v->count   = 1;
+	v->cell    = malloc(sizeof(bval*));
+	v->cell[0] = first;
+	v->promise = p;
+	return v;
+}
+
+/**
+ * A forced sequence holds the next one, so releasing the start of a long
+ * one goes through it in a loop instead of recursing down its length
+ * */
+void bpromise_release(bpromise* p) {
+	while(p && --p->refs == 0) {
+		bpromise* next = NULL;
+		bval* v = p->value;
+
+		if(v && v->type == BVAL_LSEQ) {
+			next = v->promise;
+			bval_del(v->cell[0]);
+			free(v->cell);
+			free(v);
+		} else if(v) {
+			bval_del(v);
+		}
+
+		if(p->expr) bval_del(p->expr);
+		if(p->env) benv_del(p->env);
+		free(p);
+		p = next;
+	}
+}
+
+// Value of 'p', evaluating it the first time
+bval* bpromise_force(bpromise* p) {
+	if(p->state == PROMISE_DONE) return bval_copy(p->value);
+	if(p->state == PROMISE_RUNNING)
+		return bval_err("Promise forced while it is being computed!");
+
+	p->state = PROMISE_RUNNING;
+	bval* x = bval_eval_list(p->env, p->expr);
+	if(x->type == BVAL_ERR) {
+		p->state = PROMISE_PENDING;
+		return x;
+	}
+
+	// The expression and its variables are not needed anymore
+	p->state = PROMISE_DONE;
+	p->value = x;
+	bval_del(p->expr);
+	benv_del(p->env);
+	p->expr = NULL;
+	p->env  = NULL;
+	return bval_copy(x);
+}
+
+// Elements of lazy sequence 's' after the first
+bval* bval_lseq_rest(bval* s) {
+	bval* x = bpromise_force(s->promise);
+	if(x->type == BVAL_ERR || x->type == BVAL_QEXPR || x->type == BVAL_LSEQ) return x;
+
+	// Evaluating {} gives (), which ends the sequence
+	if(x->type == BVAL_SEXPR && x->count == 0) {
+		x->type = BVAL_QEXPR;
+		return x;
+	}
+
+	bval* err = bval_err(
+		"Lazy sequence rest is %s, Expected %s or %s.",
+		btype_name(x->type), btype_name(BVAL_QEXPR), btype_name(BVAL_LSEQ));
+	bval_del(x);
+	return err;
+}
+
+bval* builtin_delay(benv* e, bval* a) {
+	BASSERT_NUM("delay", a, 1);
+	BASSERT_TYPE("delay", a, 0, BVAL_QEXPR);
+
+	return bval_promise(bpromise_new(e, bval_take(a, 0)));
+}
+
+// Value of a promise, anything else is given back as it is
+bval* builtin_force(benv* e, bval* a) {
+	BASSERT_NUM("force", a, 1);
+
+	bval* x = bval_take(a, 0);
+	if(x->type != BVAL_PROMISE) return x;
+
+	bval* v = bpromise_force(x->promise);
+	bval_del(x);
+	return v;
+}
+
+bval* builtin_lazy_cons(benv* e, bval* a) {
+	BASSERT_NUM("lazy-cons", a, 2);
+	BASSERT_TYPE("lazy-cons", a, 1, BVAL_QEXPR);
+
+	bpromise* p = bpromise_new(e, bval_pop(a, 1));
+	return bval_lseq(bval_take(a, 0), p);
+}
+
+// (take n list) returns the first n elements of a Q-Expression, lazy sequence, generator or range as a Q-Expression
+bval* gen_next(bgen* g, bval* send);
+bval* builtin_take(benv* e, bval* a) {
+	BASSERT_NUM("take", a, 2);
+	BASSERT_NUMBER("take", a, 0);
+	int t = a->cell[1]->type;
+	BASSERT(a, t == BVAL_QEXPR || t == BVAL_LSEQ || t == BVAL_GEN || t == BVAL_RANGE,
+		"Function '%s' Got %s type for argument %i, Expected %s.",
+		"take", btype_name(t), 1, btype_name(BVAL_QEXPR));
+
+	double n = bval_to_double(a->cell[0]);
+	bval* s = bval_pop(a, 1);
+	bval_del(a);
+
+	bval* x = bval_qexpr();
+
+	// Only the elements taken are made
+	if(s->type == BVAL_RANGE) {
+		for(long long i=0; i < brange_len(s->range) && n >= 1; i++, n--)
+			x = bval_add(x, brange_at(s->range, i));
+		bval_del(s);
+		return x;
+	}
+
+	// Next values of a generator
+	if(s->type == BVAL_GEN) {
+		for(; n >= 1; n--) {
+			bval* v = gen_next(s->gen, NULL);
+			if(!v) break;
+			if(v->type == BVAL_ERR) {
+				bval_del(x);
+				x = v;
+				break;
+			}
+			x = bval_add(x, v);
+		}
+		bval_del(s);
+		return x;
+	}
+
+	while(n >= 1 && s->type == BVAL_LSEQ) {
+		x = bval_add(x, bval_copy(s->cell[0]));
+
+		// Don't force more than what is taken
+		if(--n < 1) break;
+
+		bval* r = bval_lseq_rest(s);
+		bval_del(s);
+		if(r->type == BVAL_ERR) {
+			bval_del(x);
+			return r;
+		}
+		s = r;
+	}
+
+	for(int i=0; s->type == BVAL_QEXPR && i < s->count && n >= 1; i++, n--)
+		x = bval_add(x, bval_copy(s->cell[i]));
+
+	bval_del(s);
+	return x;
+}
+
+
+/**
+ * 
+ * GENERATOR FUNCTIONS
+ * 
+ * */
+
+/**
+ * (gen {body}) returns a generator, body runs on its own stack the
+ * first time it is resumed and stops at each (yield v), (resume g)
+ * continues it and gives {v}, or {} once body has finished.
+ * (resume g x) makes the yield that stopped it give back x.
+ * Only the frames of a suspended body are kept, so a pipeline of
+ * generators runs in the same memory however long the stream is.
+ * Local variables are copied as for delay. A generator deleted while
+ * suspended is resumed once more with its yield giving an error, so
+ * body unwinds and its frames are freed
+ * */
+
+// Size of the stack of each generator, pages are only used as body needs them
+#define GEN_STACK_SIZE (1 << 20)
+
+// Generator whose body is running
+bgen* gen_current = NULL;
+
+// Takes 'body'
+bval* bval_gen(benv* e, bval* body) {
+	bgen* g = calloc(1, sizeof(bgen));
+	g->refs  = 1;
+	g->state = GEN_NEW;
+	g->body  = body;
+	g->env   = benv_capture(e, body);
+
+	bval* v = malloc(sizeof(bval));
+	v->type = BVAL_GEN;
+	v->gen  = g;
+	return v;
+}
+
+#ifdef ALTBAT_GEN
+// First function on the stack of a generator
+void gen_entry(void) {
+	bgen* g = gen_current;
+	bval* x = bval_eval_list(g->env, g->body);
+
+	// A 'break' can't leave the generator, it just ends it
+	if(x->type == BVAL_ERR && x->num) {
+		bval_del(x);
+		x = bval_sexpr();
+	}
+
+	g->transfer = x;
+	g->state    = GEN_DONE;
+	gen_current = g->prev;
+	setcontext(&g->caller);
+}
+#endif
+
+// Continue body until it yields or ends, takes 'v' and returns what was passed back
+bval* gen_run(bgen* g, bval* v) {
+#ifdef ALTBAT_GEN
+	if(g->state == GEN_NEW) {
+		// Lowest page is left unmapped so an overflow faults instead of writing over memory
+		long page = sysconf(_SC_PAGESIZE);
+		void* mem = mmap(NULL, GEN_STACK_SIZE + page, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if(mem == MAP_FAILED) {
+			if(v) bval_del(v);
+			return bval_err("Could not allocate the stack of a generator!");
+		}
+		mprotect(mem, page, PROT_NONE);
+		g->stack = mem;
+
+		getcontext(&g->ctx);
+		g->ctx.uc_stack.ss_sp   = g->stack + page;
+		g->ctx.uc_stack.ss_size = GEN_STACK_SIZE;
+		g->ctx.uc_link = NULL;
+		makecontext(&g->ctx, gen_entry, 0);
+
+		// Nothing is waiting for the first value sent
+		if(v) bval_del(v);
+		v = NULL;
+	}
+
+	g->transfer = v;
+	g->prev     = gen_current;
+	g->state    = GEN_RUNNING;
+	gen_current = g;
+	swapcontext(&g->caller, &g->ctx);
+
+	bval* x = g->transfer;
+	g->transfer = NULL;
+
+	if(g->state == GEN_DONE) {
+		munmap(g->stack, GEN_STACK_SIZE + sysconf(_SC_PAGESIZE));
+		g->stack = NULL;
+	}
+	return x;
+#else
+	if(v) bval_del(v);
+	g->state = GEN_DONE;
+	return bval_err("Generators are not supported on this platform!");
+#endif
+}
+
+// A generator is being closed, its body must be left to unwind
+int gen_closing() {
+	return gen_current && gen_current->closing;
+}
+
+// Next value of 'g', NULL once it has finished. Takes 'send', which can be NULL
+bval* gen_next(bgen* g, bval* send) {
+	if(g->state == GEN_DONE) {
+		if(send) bval_del(send);
+		return NULL;
+	}
+	if(g->state == GEN_RUNNING) {
+		if(send) bval_del(send);
+		return bval_err("Generator resumed while it is running!");
+	}
+
+	bval* x = gen_run(g, send);
+
+	// Value body ended with is not part of the stream, unless it is an error
+	if(g->state == GEN_DONE && x->type != BVAL_ERR) {
+		bval_del(x);
+		return NULL;
+	}
+	return x;
+}
+
+void bgen_release(bgen* g) {
+	if(--g->refs > 0) return;
+
+#ifdef ALTBAT_GEN
+	if(g->state == GEN_SUSPENDED) {
+		// Keep it alive while body unwinds
+		g->refs    = 1;
+		g->closing = 1;
+		bval_del(gen_run(g, NULL));
+	}
+#endif
+
+	bval_del(g->body);
+	benv_del(g->env);
+	free(g);
+}
+
+// (gen {body}) returns a generator that runs body
+bval* builtin_gen(benv* e, bval* a) {
+	BASSERT_NUM("gen", a, 1);
+	BASSERT_TYPE("gen", a, 0, BVAL_QEXPR);
+
+	bval* x = bval_gen(e, bval_pop(a, 0));
+	bval_del(a);
+	return x;
+}
+
+// (yield v) passes v to the resume of the running generator and waits to be resumed again
+bval* builtin_yield(benv* e, bval* a) {
+	BASSERT(a, a->count <= 1,
+		"Function 'yield' passed %i arguments, Expected 0 or 1.", a->count);
+
+	bgen* g = gen_current;
+	BASSERT(a, g, "Function 'yield' used outside of a generator.");
+	BASSERT(a, !g->closing, "Generator closed");
+
+	g->transfer = (a->count) ? bval_pop(a, 0) : bval_sexpr();
+	bval_del(a);
+
+#ifdef ALTBAT_GEN
+	g->state    = GEN_SUSPENDED;
+	gen_current = g->prev;
+	swapcontext(&g->ctx, &g->caller);
+#endif
+
+	// Resumed
+	bval* x = g->transfer;
+	g->transfer = NULL;
+
+	if(g->closing) {
+		if(x) bval_del(x);
+		return bval_err("Generator closed");
+	}
+	return (x) ? x : bval_sexpr();
+}
+
+// (resume g [v]) continues g and returns {value} it yields, {} once it has finished
+bval* builtin_resume(benv* e, bval* a) {
+	BASSERT(a, a->count == 1 || a->count == 2,
+		"Function 'resume' passed %i arguments, Expected 1 or 2.", a->count);
+	BASSERT_TYPE("resume", a, 0, BVAL_GEN);
+
+	bval* send = (a->count == 2) ? bval_pop(a, 1) : NULL;
+
+	// 'a' keeps the generator alive while it runs
+	bval* x = gen_next(a->cell[0]->gen, send);
+	bval_del(a);
+
+	if(!x) return bval_qexpr();
+	if(x->type == BVAL_ERR) return x;
+	return bval_add(bval_qexpr(), x);
+}
+
+
+/**
+ * 
+ * LOOP FUNCTIONS
+ * 
+ * */
+
+/**
+ * Loops evaluate their body with bval_eval_list, which leaves the
+ * Q-Expression as it is, so the same body is used by every iteration.
+ * Evaluating 'break' gives an error marked with num = 1 that goes up
+ * like any other error until a loop stops it
+ * */
+bval* bval_eval_list(benv* e, bval* v);
+
+bval* bval_break() {
+	bval* x = bval_err("'break' outside of a loop");
+	x->num = 1;
+	return x;
+}
+
+// Runs one iteration, returns NULL or the value that ends the loop
+bval* loop_step(benv* e, bval* body) {
+	bval* x = EVAL_TICK();
+	if(x) return x;
+
+	x = bval_eval_list(e, body);
+	if(x->type == BVAL_ERR) return x;
+
+	bval_del(x);
+	return NULL;
+}
+
+// Value a loop returns after it was ended by 'x'
+bval* loop_end(bval* x) {
+	if(x->type == BVAL_ERR && x->num) {
+		bval_del(x);
+		return bval_sexpr();
+	}
+	return x;
+}
+
+// (while {cond} {body}) evaluates body while cond is true
+bval* builtin_while_fast(benv* e, int argc, bval** argv) {
+	FASSERT_NUM("while", argc, 2);
+	FASSERT_TYPE("while", argv, 0, BVAL_QEXPR);
+	FASSERT_TYPE("while", argv, 1, BVAL_QEXPR);
+
+	while(1) {
+		bval* c = bval_eval_list(e, argv[0]);
+		if(c->type == BVAL_ERR) return loop_end(c);
+		if(!bval_is_num(c)) {
+			bval* err = bval_err(
+				"Function 'while' condition is %s, Expected %s.",
+				btype_name(c->type), btype_name(BVAL_NUM));
+			bval_del(c);
+			return err;
+		}
+
+		int t = bval_val(c);
+		bval_del(c);
+		if(!t) break;
+
+		bval* x = loop_step(e, argv[1]);
+		if(x) return loop_end(x);
+	}
+	return bval_sexpr();
+}
+
+// (do-times n {body}) evaluates body n times
+bval* builtin_do_times_fast(benv* e, int argc, bval** argv) {
+	FASSERT_NUM("do-times", argc, 2);
+	FASSERT_NUMBER("do-times", argv, 0);
+	FASSERT_TYPE("do-times", argv, 1, BVAL_QEXPR);
+
+	// A double is cast only once it is known to fit, NaN and infinities don't
+	FASSERT(argv[0]->type == BVAL_INT
+		|| (isfinite(argv[0]->num) && fabs(argv[0]->num) < 9223372036854775807.0),
+		"Function 'do-times' passed %g times, Expected a number that fits in 64 bits.", argv[0]->num);
+	long long n = (argv[0]->type == BVAL_INT) ? argv[0]->integer : (long long)argv[0]->num;
+	for(long long i=0; i<n; i++) {
+		bval* x = loop_step(e, argv[1]);
+		if(x) return loop_end(x);
+	}
+	return bval_sexpr();
+}
+
+/**
+ * (for {i} {list} {body}) binds i to each element of list in turn, a
+ * range is counted through as its start, stop and step would be.
+ * (for {i} start stop {body}) and (for {i} start stop step {body})
+ * bind i to the numbers from start up to, but not including, stop
+ * without building a list of them. If start, stop and step are all
+ * integers i is an integer, otherwise a double.
+ * i lives in a frame made once for the whole loop, whose parent is
+ * the calling environment. '=' in the body still sets variables of
+ * the calling environment
+ * */
+bval* builtin_for_fast(benv* e, int argc, bval** argv) {
+	FASSERT(argc >= 3 && argc <= 5,
+		"Function 'for' passed %i arguments, Expected 3 to 5.", argc);
+	FASSERT_TYPE("for", argv, 0, BVAL_QEXPR);
+	FASSERT(argv[0]->count == 1 && argv[0]->cell[0]->type == BVAL_SYM,
+		"Function 'for' first argument must be a single symbol.");
+	FASSERT_TYPE("for", argv, argc-1, BVAL_QEXPR);
+
+	bval* sym  = argv[0]->cell[0];
+	bval* body = argv[argc-1];
+
+	// Range of numbers
+	double start = 0, stop = 0, step = 1;
+	long long istart = 0, istop = 0, istep = 1;
+	long long first  = 0; // Index of the first number, a tail of a range skips some
+	int is_int = 1;
+	if(argc == 3 && argv[1]->type == BVAL_RANGE) {
+		brange* r = argv[1]->range;
+		is_int = r->integer;
+		istart = r->istart + r->first * r->istep;
+		istop  = r->istop;
+		istep  = r->istep;
+		start  = r->start;
+		stop   = r->stop;
+		step   = r->step;
+		first  = r->first;
+	} else if(argc == 3) {
+		FASSERT(argv[1]->type == BVAL_QEXPR || argv[1]->type == BVAL_GEN,
+			"Function '%s' Got %s type for argument %i, Expected %s.",
+			"for", btype_name(argv[1]->type), 1, btype_name(BVAL_QEXPR));
+	} else {
+		for(int i=1; i<argc-1; i++) {
+			FASSERT_NUMBER("for", argv, i);
+			if(argv[i]->type != BVAL_INT) is_int = 0;
+		}
+		start = bval_to_double(argv[1]);
+		stop  = bval_to_double(argv[2]);
+		if(argc == 5) step = bval_to_double(argv[3]);
+		FASSERT(step != 0, "Function 'for' passed 0 as step.");
+		if(is_int) {
+			istart = argv[1]->integer;
+			istop  = argv[2]->integer;
+			istep  = (argc == 5) ? argv[3]->integer : 1;
+		}
+	}
+
+	benv* frame = benv_new();
+	frame->par  = e;
+	frame->loop = 1;
+
+	bval* x = NULL;
+	if(argc == 3 && argv[1]->type == BVAL_GEN) {
+		// Each value is bound as it is yielded, so the whole stream is never held
+		bval* v;
+		while(!x && (v = gen_next(argv[1]->gen, NULL))) {
+			if(v->type == BVAL_ERR) {
+				x = v;
+				break;
+			}
+			benv_put(frame, sym, v);
+			bval_del(v);
+			x = loop_step(frame, body);
+		}
+	} else if(argc == 3 && argv[1]->type != BVAL_RANGE) {
+		bval* list = argv[1];
+		for(int i=0; i<list->count && !x; i++) {
+			benv_put(frame, sym, list->cell[i]);
+			x = loop_step(frame, body);
+		}
+	} else if(is_int) {
+		long long v = istart;
+
+		bval* n = bval_int(v);
+		benv_put(frame, sym, n);
+		bval_del(n);
+
+		while(!x && ((istep > 0) ? (v < istop) : (v > istop))) {
+			if(frame->vals[0]->type == BVAL_INT) {
+				frame->vals[0]->integer = v;
+			} else {
+				n = bval_int(v);
+				benv_put(frame, sym, n);
+				bval_del(n);
+			}
+			x = loop_step(frame, body);
+
+			// Stop before v goes past the integer range
+			long long next;
+			if(!op_int(OP_ADD, v, istep, &next)) break;
+			v = next;
+		}
+	} else {
+		bval* n = bval_num(start);
+		benv_put(frame, sym, n);
+		bval_del(n);
+
+		// Multiply instead of adding step so errors don't add up
+		for(long long i=first; !x; i++) {
+			double v = start + i*step;
+			if((step > 0) ? (v >= stop) : (v <= stop)) break;
+
+			// i is the first binding, update it in place unless body changed its type
+			if(frame->vals[0]->type == BVAL_NUM) {
+				frame->vals[0]->num = v;
+			} else {
+				n = bval_num(v);
+				benv_put(frame, sym, n);
+				bval_del(n);
+			}
+			x = loop_step(frame, body);
+		}
+	}
+
+	benv_del(frame);
+	return (x) ? loop_end(x) : bval_sexpr();
+}
+
+// (do a b c) evaluates its arguments in order and returns the last one
+bval* builtin_do_fast(benv* e, int argc, bval** argv) {
+	FASSERT(argc > 0, "Function 'do' passed no arguments.");
+
+	bval* x = argv[argc-1];
+	argv[argc-1] = NULL;
+	return x;
+}
+
+bval* builtin_while(benv* e, bval* a) {
+	return builtin_fast(e, a, builtin_while_fast);
+}
+
+bval* builtin_do_times(benv* e, bval* a) {
+	return builtin_fast(e, a, builtin_do_times_fast);
+}
+
+bval* builtin_for(benv* e, bval* a) {
+	return builtin_fast(e, a, builtin_for_fast);
+}
+
+bval* builtin_do(benv* e, bval* a) {
+	return builtin_fast(e, a, builtin_do_fast);
+}
+
+
+/**
+ * 
+ * HIGHER ORDER FUNCTIONS
+ * 
+ * */
+
+/**
+ * map, filter and the folds walk their list once with a bseq, which
+ * takes the elements out of a Q-Expression instead of copying them and
+ * also reads lazy sequences and generators. The function is called
+ * with bval_call_argv, builtins with a fast path get the values where
+ * they are and lambdas a S-Expression of the right size
+ * */
+typedef struct {
+	bval* src; // Taken from the arguments
+	long long i; // Next cell of a Q-Expression or element of a range, or 1 once the head of a lazy sequence was used
+} bseq;
+
+// Q-Expressions, lazy sequences, generators and ranges
+#define FASSERT_SEQ(func, argv, index) \
+	FASSERT(argv[index]->type == BVAL_QEXPR || argv[index]->type == BVAL_LSEQ \
+		|| argv[index]->type == BVAL_GEN || argv[index]->type == BVAL_RANGE, \
+		"Function '%s' Got %s type for argument %i, Expected %s.", \
+		func, btype_name(argv[index]->type), index, btype_name(BVAL_QEXPR))
+
+#define FASSERT_CALLABLE(func, argv, index) \
+	FASSERT(bval_callable(argv[index]), \
+		"Function '%s' Got %s type for argument %i, Expected %s.", \
+		func, btype_name(argv[index]->type), index, btype_name(BVAL_FUN))
+
+// Takes 'argv[index]'
+bseq bseq_take(bval** argv, int index) {
+	bseq s = { argv[index], 0 };
+	argv[index] = NULL;
+	return s;
+}
+
+// Next element, NULL at the end or an error
+bval* bseq_next(bseq* s) {
+	if(s->src->type == BVAL_GEN) return gen_next(s->src->gen, NULL);
+	if(s->src->type == BVAL_RANGE)
+		return (s->i < brange_len(s->src->range)) ? brange_at(s->src->range, s->i++) : NULL;
+
+	// The rest of a lazy sequence is only forced when it is reached
+	if(s->src->type == BVAL_LSEQ && s->i) {
+		bval* r = bval_lseq_rest(s->src);
+		bval_del(s->src);
+		s->i = 0;
+		if(r->type == BVAL_ERR) {
+			s->src = bval_qexpr();
+			return r;
+		}
+		s->src = r;
+	}
+	if(s->src->type == BVAL_LSEQ) {
+		s->i = 1;
+		return bval_copy(s->src->cell[0]);
+	}
+
+	if(s->i == s->src->count) return NULL;
+	bval* x = s->src->cell[s->i];
+	s->src->cell[s->i++] = NULL;
+	return x;
+}
+
+void bseq_del(bseq* s) {
+	// Cells that were taken are NULL
+	if(s->src->type == BVAL_QEXPR) bval_del_args(s->src);
+	else bval_del(s->src);
+}
+
+// Calls 'f' with the 'argc' values of 'argv', which it takes
+bval* bval_call_argv(benv* e, bval* f, int argc, bval** argv) {
+	if(f->type == BVAL_FUN && f->fast) {
+		bval* x = f->fast(e, argc, argv);
+		for(int i=0; i<argc; i++) {
+			if(argv[i]) bval_del(argv[i]);
+		}
+		return x;
+	}
+
+	bval* a = bval_sexpr();
+	a->count = argc;
+	a->cell  = malloc(sizeof(bval*) * argc);
+	memcpy(a->cell, argv, sizeof(bval*) * argc);
+	return bval_call(e, f, a);
+}
+
+// Elements gathered into a growing array, made into a Q-Expression by bcells_qexpr
+typedef struct {
+	bval** cell;
+	int count;
+	int cap;
+} bcells;
+
+// Takes 'x', returns an error if there is no room for it
+bval* bcells_add(bcells* c, bval* x) {
+	if(c->count == c->cap) {
+		int cap = c->cap ? c->cap * 2 : 8;
+		bval** cell = (c->cap <= INT_MAX / 2) ? realloc(c->cell, sizeof(bval*) * cap) : NULL;
+		if(!cell) {
+			bval_del(x);
+			return bval_err("Could not allocate room for more than %i elements.", c->count);
+		}
+		c->cell = cell;
+		c->cap  = cap;
+	}
+	c->cell[c->count++] = x;
+	return NULL;
+}
+
+bval* bcells_qexpr(bcells* c) {
+	bval* x = bval_qexpr();
+	x->count = c->count;
+	x->cell  = c->cell;
+	return x;
+}
+
+void bcells_del(bcells* c) {
+	for(int i=0; i < c->count; i++) bval_del(c->cell[i]);
+	free(c->cell);
+}
+
+#define BCELLS_RANGE_MAX 4096 // Most elements allocated up front for a range
+
+/**
+ * Room for the elements of a Q-Expression, so it is allocated once.
+ * A range may be long and only a few of its elements kept (filter),
+ * so at most BCELLS_RANGE_MAX are allocated for it
+ * */
+bcells bcells_for(bseq* s) {
+	bcells c = { NULL, 0, 0 };
+	if(s->src->type == BVAL_QEXPR && s->src->count)
+		c.cap = s->src->count;
+	if(s->src->type == BVAL_RANGE && brange_len(s->src->range))
+		c.cap = (brange_len(s->src->range) < BCELLS_RANGE_MAX) ? brange_len(s->src->range) : BCELLS_RANGE_MAX;
+
+	if(c.cap) {
+		c.cell = malloc(sizeof(bval*) * c.cap);
+		if(!c.cell) c.cap = 0; // Grown by bcells_add instead
+	}
+	return c;
+}
+
+// (map f list) returns {(f x) ...} for each x of list
+bval* builtin_map_fast(benv* e, int argc, bval** argv) {
+	FASSERT_NUM("map", argc, 2);
+	FASSERT_CALLABLE("map", argv, 0);
+	FASSERT_SEQ("map", argv, 1);
+
+	bval* f = argv[0];
+	bseq s = bseq_take(argv, 1);
+	bcells out = bcells_for(&s);
+
+	bval* x;
+	while((x = bseq_next(&s))) {
+		if(x->type != BVAL_ERR) {
+			bval* arg = x;
+			x = bval_call_argv(e, f, 1, &arg);
+		}
+		if(x->type == BVAL_ERR) break;
+		if((x = bcells_add(&out, x))) break;
+	}
+	bseq_del(&s);
+
+	if(x) {
+		bcells_del(&out);
+		return x;
+	}
+	return bcells_qexpr(&out);
+}
+
+// (filter f list) returns the elements of list for which (f x) is true
+bval* builtin_filter_fast(benv* e, int argc, bval** argv) {
+	FASSERT_NUM("filter", argc, 2);
+	FASSERT_CALLABLE("filter", argv, 0);
+	FASSERT_SEQ("filter", argv, 1);
+
+	bval* f = argv[0];
+	bseq s = bseq_take(argv, 1);
+	bcells out = bcells_for(&s);
+
+	bval* x;
+	bval* err = NULL;
+	while((x = bseq_next(&s))) {
+		if(x->type == BVAL_ERR) {
+			err = x;
+			break;
+		}
+
+		// f takes its argument, x is kept for the result
+		bval* arg = bval_copy(x);
+		bval* t = bval_call_argv(e, f, 1, &arg);
+		if(t->type == BVAL_ERR) {
+			bval_del(x);
+			err = t;
+			break;
+		}
+
+		if(bval_val(t)) err = bcells_add(&out, x);
+		else bval_del(x);
+		bval_del(t);
+		if(err) break;
+	}
+	bseq_del(&s);
+
+	if(err) {
+		bcells_del(&out);
+		return err;
+	}
+	return bcells_qexpr(&out);
+}
+
+// Calls (f acc x) for each x of 's' from the first, takes 'acc'
+bval* fold_left(benv* e, bval* f, bval* acc, bseq* s) {
+	bval* x;
+	while(acc->type != BVAL_ERR && (x = bseq_next(s))) {
+		if(x->type == BVAL_ERR) {
+			bval_del(acc);
+			acc = x;
+			break;
+		}
+		bval* args[2] = { acc, x };
+		acc = bval_call_argv(e, f, 2, args);
+	}
+	bseq_del(s);
+	return acc;
+}
+
+// (foldl f init list) returns (f (f (f init x0) x1) ...)
+bval* builtin_foldl_fast(benv* e, int argc, bval** argv) {
+	FASSERT_NUM("foldl", argc, 3);
+	FASSERT_CALLABLE("foldl", argv, 0);
+	FASSERT_SEQ("foldl", argv, 2);
+
+	bval* acc = argv[1];
+	argv[1] = NULL;
+	bseq s = bseq_take(argv, 2);
+	return fold_left(e, argv[0], acc, &s);
+}
+
+// (reduce f list) is foldl with the first element of list as init
+bval* builtin_reduce_fast(benv* e, int argc, bval** argv) {
+	FASSERT_NUM("reduce", argc, 2);
+	FASSERT_CALLABLE("reduce", argv, 0);
+	FASSERT_SEQ("reduce", argv, 1);
+
+	bseq s = bseq_take(argv, 1);
+	bval* acc = bseq_next(&s);
+	if(!acc) {
+		bseq_del(&s);
+		return bval_err("Function 'reduce' passed {} for argument 1.");
+	}
+	return fold_left(e, argv[0], acc, &s);
+}
+
+// (foldr f init list) returns (f x0 (f x1 (... (f xn init))))
+bval* builtin_foldr_fast(benv* e, int argc, bval** argv) {
+	FASSERT_NUM("foldr", argc, 3);
+	FASSERT_CALLABLE("foldr", argv, 0);
+	FASSERT_SEQ("foldr", argv, 2);
+
+	// The last element is needed first, so everything is read before calling f
+	bseq s = bseq_take(argv, 2);
+	bcells all = bcells_for(&s);
+	bval* x;
+	while((x = bseq_next(&s)) && x->type != BVAL_ERR) {
+		if((x = bcells_add(&all, x))) break;
+	}
+	bseq_del(&s);
+	if(x) {
+		bcells_del(&all);
+		return x;
+	}
+
+	bval* acc = argv[1];
+	argv[1] = NULL;
+	while(all.count && acc->type != BVAL_ERR) {
+		bval* args[2] = { all.cell[--all.count], acc };
+		acc = bval_call_argv(e, argv[0], 2, args);
+	}
+	bcells_del(&all);
+	return acc;
+}
+
+bval* builtin_map(benv* e, bval* a) {
+	return builtin_fast(e, a, builtin_map_fast);
+}
+
+bval* builtin_filter(benv* e, bval* a) {
+	return builtin_fast(e, a, builtin_filter_fast);
+}
+
+bval* builtin_foldl(benv* e, bval* a) {
+	return builtin_fast(e, a, builtin_foldl_fast);
+}
+
+bval* builtin_foldr(benv* e, bval* a) {
+	return builtin_fast(e, a, builtin_foldr_fast);
+}
+
+bval* builtin_reduce(benv* e, bval* a) {
+	return builtin_fast(e, a, builtin_reduce_fast);
+}
+
+
+/**
+ * 
+ * VECTOR FUNCTIONS
+ * 
+ * */
+
+/**
+ * A vector holds doubles next to each other instead of a bval for each
+ * element. (vec list) and (vec-range start stop [step]) build one,
+ * (vec->list v) gives the numbers back. The arithmetic builtins work on
+ * them element by element, a number given with a vector is used for every
+ * element, (min v) and (max v) give the smallest and largest element.
+ * Elements follow IEEE rules, dividing by 0 gives inf instead of an error.
+ *
+ * The loops are run by kernels picked on first use: AVX when the CPU has
+ * it, SSE2 otherwise, and plain C on other machines. Element by element
+ * they all give the same results, sums (sum, dot) are added in a
+ * different order by each so the last bits may differ
+ * */
+
+// Takes no elements yet, 'n' are allocated, NULL if there is no memory for them
+bvec* bvec_new(long n) {
+	bvec* v = malloc(sizeof(bvec) + sizeof(double) * (n ? n : 1));
+	if(!v) return NULL;
+	v->refs  = 1;
+	v->count = n;
+	return v;
+}
+
+bval* bval_vec(bvec* vec) {
+	bval* v = malloc(sizeof(bval));
+	v->type = BVAL_VEC;
+	v->vec  = vec;
+	return v;
+}
+
+/**
+ * out[i] = x[i] op y[i], where a NULL x or y stands for sx or sy
+ * repeated, so a number is used against each element.
+ * fold gives the sum (OP_ADD), the sum of x[i] * y[i] (OP_MUL),
+ * the smallest (OP_MIN) or the largest (OP_MAX) element
+ * */
+typedef void (*bvec_map_kernel)(enum OperatorCode op, double* out,
+	const double* x, const double* y, double sx, double sy, long n);
+typedef double (*bvec_fold_kernel)(enum OperatorCode op, const double* x, const double* y, long n);
+
+void bvec_map_scalar(enum OperatorCode op, double* out,
+	const double* x, const double* y, double sx, double sy, long n) {
+	for(long i=0; i<n; i++)
+		out[i] = op_double(op, x ? x[i] : sx, y ? y[i] : sy);
+}
+
+double bvec_fold_scalar(enum OperatorCode op, const double* x, const double* y, long n) {
+	if(op == OP_MIN || op == OP_MAX) {
+		double r = x[0];
+		for(long i=1; i<n; i++) r = op_double(op, x[i], r);
+		return r;
+	}
+
+	double r = 0;
+	for(long i=0; i<n; i++) r += y ? x[i] * y[i] : x[i];
+	return r;
+}
+
+#ifdef ALTBAT_SIMD
+/**
+ * Same loops over W doubles at a time, the elements left at the end go
+ * through the scalar kernel. % and ^ have no instruction so they are
+ * left to it entirely
+ * */
+#define VEC_MAP_LOOP(W, T, LOAD, STORE, SET1, OP) { \
+	T kx = SET1(sx), ky = SET1(sy); \
+	for(; i+W <= n; i += W) \
+		STORE(out+i, OP(x ? LOAD(x+i) : kx, y ? LOAD(y+i) : ky)); \
+}
+
+#define VEC_MAP_KERNEL(NAME, ATTR, W, T, LOAD, STORE, SET1, ADD, SUB, MUL, DIV, MIN, MAX) \
+ATTR void NAME(enum OperatorCode op, double* out, \
+	const double* x, const double* y, double sx, double sy, long n) { \
+	long i = 0; \
+	switch (op) { \
+		case OP_ADD: VEC_MAP_LOOP(W, T, LOAD, STORE, SET1, ADD); break; \
+		case OP_SUB: VEC_MAP_LOOP(W, T, LOAD, STORE, SET1, SUB); break; \
+		case OP_MUL: VEC_MAP_LOOP(W, T, LOAD, STORE, SET1, MUL); break; \
+		case OP_DIV: VEC_MAP_LOOP(W, T, LOAD, STORE, SET1, DIV); break; \
+		case OP_MIN: VEC_MAP_LOOP(W, T, LOAD, STORE, SET1, MIN); break; \
+		case OP_MAX: VEC_MAP_LOOP(W, T, LOAD, STORE, SET1, MAX); break; \
+		default: break; \
+	} \
+	bvec_map_scalar(op, out+i, x ? x+i : NULL, y ? y+i : NULL, sx, sy, n-i); \
+}
+
+VEC_MAP_KERNEL(bvec_map_sse2, , 2, __m128d, _mm_loadu_pd, _mm_storeu_pd, _mm_set1_pd,
+	_mm_add_pd, _mm_sub_pd, _mm_mul_pd, _mm_div_pd, _mm_min_pd, _mm_max_pd)
+VEC_MAP_KERNEL(bvec_map_avx, __attribute__((target("avx"))), 4, __m256d,
+	_mm256_loadu_pd, _mm256_storeu_pd, _mm256_set1_pd,
+	_mm256_add_pd, _mm256_sub_pd, _mm256_mul_pd, _mm256_div_pd, _mm256_min_pd, _mm256_max_pd)
+
+// Lanes are reduced into W partial results, which are then folded in order
+#define VEC_FOLD_KERNEL(NAME, ATTR, W, T, LOAD, STORE, SET1, ADD, MUL, MIN, MAX) \
+ATTR double NAME(enum OperatorCode op, const double* x, const double* y, long n) { \
+	if(n < W) return bvec_fold_scalar(op, x, y, n); \
+	long i = W; \
+	T acc; \
+	double lanes[W]; \
+	if(op == OP_MIN || op == OP_MAX) { \
+		acc = LOAD(x); \
+		for(; i+W <= n; i += W) acc = (op == OP_MIN) ? MIN(LOAD(x+i), acc) : MAX(LOAD(x+i), acc); \
+		STORE(lanes, acc); \
+		double r = lanes[0]; \
+		for(int k=1; k<W; k++) r = op_double(op, lanes[k], r); \
+		for(; i<n; i++) r = op_double(op, x[i], r); \
+		return r; \
+	} \
+	acc = y ? MUL(LOAD(x), LOAD(y)) : LOAD(x); \
+	for(; i+W <= n; i += W) acc = ADD(acc, y ? MUL(LOAD(x+i), LOAD(y+i)) : LOAD(x+i)); \
+	STORE(lanes, acc); \
+	double r = 0; \
+	for(int k=0; k<W; k++) r += lanes[k]; \
+	for(; i<n; i++) r += y ? x[i] * y[i] : x[i]; \
+	return r; \
+}
+
+VEC_FOLD_KERNEL(bvec_fold_sse2, , 2, __m128d, _mm_loadu_pd, _mm_storeu_pd, _mm_set1_pd,
+	_mm_add_pd, _mm_mul_pd, _mm_min_pd, _mm_max_pd)
+VEC_FOLD_KERNEL(bvec_fold_avx, __attribute__((target("avx"))), 4, __m256d,
+	_mm256_loadu_pd, _mm256_storeu_pd, _mm256_set1_pd,
+	_mm256_add_pd, _mm256_mul_pd, _mm256_min_pd, _mm256_max_pd)
+#endif
+
+// Kernels start as these, which pick the best ones the CPU runs (CPUID) and replace themselves
+void bvec_map_pick(enum OperatorCode op, double* out,
+	const double* x, const double* y, double sx, double sy, long n);
+double bvec_fold_pick(enum OperatorCode op, const double* x, const double* y, long n);
+
+bvec_map_kernel  bvec_map  = bvec_map_pick;
+bvec_fold_kernel bvec_fold = bvec_fold_pick;
+
+void bvec_pick() {
+#ifdef ALTBAT_SIMD
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx")) {
+		bvec_map  = bvec_map_avx;
+		bvec_fold = bvec_fold_avx;
+	} else {
+		bvec_map  = bvec_map_sse2;
+		bvec_fold = bvec_fold_sse2;
+	}
+#else
+	bvec_map  = bvec_map_scalar;
+	bvec_fold = bvec_fold_scalar;
+#endif
+}
+
+void bvec_map_pick(enum OperatorCode op, double* out,
+	const double* x, const double* y, double sx, double sy, long n) {
+	bvec_pick();
+	bvec_map(op, out, x, y, sx, sy, n);
+}
+
+double bvec_fold_pick(enum OperatorCode op, const double* x, const double* y, long n) {
+	bvec_pick();
+	return bvec_fold(op, x, y, n);
+}
+
+/**
+ * Called by builtin_op_fast when an argument is a vector. Folds the
+ * arguments like it does, the result is written over once it exists
+ * so a long call allocates a single vector
+ * */
+bval* bvec_op_fast(int argc, bval** argv, enum OperatorCode op) {
+	long n = -1;
+	for(int i=0; i < argc; i++) {
+		if(argv[i]->type == BVAL_VEC) {
+			if(n == -1) n = argv[i]->vec->count;
+			FASSERT(argv[i]->vec->count == n,
+				"Cannot operate vectors of different lengths, %li and %li.", n, argv[i]->vec->count);
+		} else if(!bval_is_num(argv[i])) {
+			return bval_err("Cannot operate non-numbers!");
+		}
+	}
+
+	if(op == OP_UNKNOWN)
+		return bval_err("Bad Operator!");
+
+	// Smallest or largest element
+	if((op == OP_MIN || op == OP_MAX) && argc == 1) {
+		FASSERT(n > 0, "Function '%s' passed an empty vector.", (op == OP_MIN) ? "min" : "max");
+		return bval_num(bvec_fold(op, argv[0]->vec->data, NULL, n));
+	}
+
+	bvec* r;
+
+	// Unary negation, multiplying keeps the sign of 0
+	if(op == OP_SUB && argc == 1) {
+		r = bvec_new(n);
+		if(!r) return bval_err("Could not allocate a vector of %li elements.", n);
+		bvec_map(OP_MUL, r->data, argv[0]->vec->data, NULL, 0, -1, n);
+		return bval_vec(r);
+	}
+
+	// Anything else on a single vector gives it back
+	if(argc == 1) {
+		bval* x = argv[0];
+		argv[0] = NULL;
+		return x;
+	}
+
+	r = bvec_new(n);
+	if(!r) return bval_err("Could not allocate a vector of %li elements.", n);
+
+	// Numbers before the first vector are folded as numbers
+	double s = 0;
+	double* x = NULL;
+	int i = 0;
+	if(argv[0]->type == BVAL_VEC) {
+		x = argv[0]->vec->data;
+	} else {
+		s = bval_to_double(argv[0]);
+		while(argv[++i]->type != BVAL_VEC) s = op_double(op, s, bval_to_double(argv[i]));
+		i--;
+	}
+
+	for(i++; i < argc; i++) {
+		bval* y = argv[i];
+		if(y->type == BVAL_VEC)
+			bvec_map(op, r->data, x, y->vec->data, s, 0, n);
+		else
+			bvec_map(op, r->data, x, NULL, s, bval_to_double(y), n);
+		x = r->data;
+	}
+
+	return bval_vec(r);
+}
+
+// (vec list) returns a vector of the numbers of a Q-Expression, lazy sequence or generator
+bval* builtin_vec_fast(benv* e, int argc, bval** argv) {
+	FASSERT_NUM("vec", argc, 1);
+	if(argv[0]->type == BVAL_VEC) {
+		bval* x = argv[0];
+		argv[0] = NULL;
+		return x;
+	}
+	FASSERT_SEQ("vec", argv, 0);
+
+	bseq s = bseq_take(argv, 0);
+	long cap = (s.src->type == BVAL_QEXPR) ? s.src->count : 16;
+	bvec* v = bvec_new(cap);
+	if(!v) {
+		bseq_del(&s);
+		return bval_err("Function 'vec' could not allocate %li elements.", cap);
+	}
+	v->count = 0;
+
+	bval* x;
+	while((x = bseq_next(&s))) {
+		if(!bval_is_num(x)) {
+			bval* err = (x->type == BVAL_ERR) ? x : bval_err(
+				"Function 'vec' Got %s type for element %li, Expected %s.",
+				btype_name(x->type), v->count, btype_name(BVAL_NUM));
+			if(err != x) bval_del(x);
+			bseq_del(&s);
+			free(v);
+			return err;
+		}
+
+		if(v->count == cap) {
+			bvec* grown = realloc(v, sizeof(bvec) + sizeof(double) * cap * 2);
+			if(!grown) {
+				bval_del(x);
+				bseq_del(&s);
+				free(v);
+				return bval_err("Function 'vec' could not allocate %li elements.", cap * 2);
+			}
+			v = grown;
+			cap *= 2;
+		}
+		v->data[v->count++] = bval_to_double(x);
+		bval_del(x);
+	}
+	bseq_del(&s);
+	return bval_vec(v);
+}
+
+// (vec-range start stop [step]) returns the vector {start start+step ...} stopping before stop
+bval* builtin_vec_range_fast(benv* e, int argc, bval** argv) {
+	FASSERT(argc == 2 || argc == 3,
+		"Function 'vec-range' passed %i arguments, Expected 2 or 3.", argc);
+	for(int i=0; i<argc; i++) FASSERT_NUMBER("vec-range", argv, i);
+
+	double start = bval_to_double(argv[0]);
+	double stop  = bval_to_double(argv[1]);
+	double step  = (argc == 3) ? bval_to_double(argv[2]) : 1;
+	FASSERT(step != 0, "Function 'vec-range' passed 0 as step.");
+
+	double count = ceil((stop - start) / step);
+	if(!(count > 0)) count = 0;
+	FASSERT(count < LONG_MAX / sizeof(double), "Function 'vec-range' range is too large.");
+
+	long n = count;
+	bvec* v = bvec_new(n);
+	FASSERT(v, "Function 'vec-range' could not allocate %li elements.", n);
+
+	// Multiply instead of adding step so errors don't add up, as 'for' does
+	for(long i=0; i<n; i++) v->data[i] = start + i*step;
+	return bval_vec(v);
+}
+
+// (vec->list v) returns the elements of v as a Q-Expression of numbers
+bval* builtin_vec_list_fast(benv* e, int argc, bval** argv) {
+	FASSERT_NUM("vec->list", argc, 1);
+	FASSERT_TYPE("vec->list", argv, 0, BVAL_VEC);
+
+	bvec* v = argv[0]->vec;
+	bval* x = bval_qexpr();
+	x->cell  = malloc(sizeof(bval*) * (v->count ? v->count : 1));
+	if(!x->cell) {
+		bval_del(x);
+		return bval_err("Function 'vec->list' could not allocate %li elements.", v->count);
+	}
+	x->count = v->count;
+	for(long i=0; i < v->count; i++) x->cell[i] = bval_num(v->data[i]);
+	return x;
+}
+
+// (sum v) returns the sum of the elements of v
+bval* builtin_sum_fast(benv* e, int argc, bval** argv) {
+	FASSERT_NUM("sum", argc, 1);
+	FASSERT_TYPE("sum", argv, 0, BVAL_VEC);
+	return bval_num(bvec_fold(OP_ADD, argv[0]->vec->data, NULL, argv[0]->vec->count));
+}
+
+// (dot v w) returns the sum of the products of the elements of v and w
+bval* builtin_dot_fast(benv* e, int argc, bval** argv) {
+	FASSERT_NUM("dot", argc, 2);
+	FASSERT_TYPE("dot", argv, 0, BVAL_VEC);
+	FASSERT_TYPE("dot", argv, 1, BVAL_VEC);
+
+	bvec* x = argv[0]->vec;
+	bvec* y = argv[1]->vec;
+	FASSERT(x->count == y->count,
+		"Function 'dot' passed vectors of different lengths, %li and %li.", x->count, y->count);
+	return bval_num(bvec_fold(OP_MUL, x->data, y->data, x->count));
+}
+
+bval* builtin_vec(benv* e, bval* a) {
+	return builtin_fast(e, a, builtin_vec_fast);
+}
+
+bval* builtin_vec_range(benv* e, bval* a) {
+	return builtin_fast(e, a, builtin_vec_range_fast);
+}
+
+bval* builtin_vec_list(benv* e, bval* a) {
+	return builtin_fast(e, a, builtin_vec_list_fast);
+}
+
+bval* builtin_sum(benv* e, bval* a) {
+	return builtin_fast(e, a, builtin_sum_fast);
+}
+
+bval* builtin_dot(benv* e, bval* a) {
+	return builtin_fast(e, a, builtin_dot_fast);
+}
+
+/**
+ * 
+ * DICTIONARY FUNCTIONS
+ * 
+ * */
+
+/**
+ * A dictionary maps keys to values, keys are compared with bval_eq and
+ * hashed with bval_hash, so 1 and 1.0 are the same key.
+ * (dict k v ...) builds one, (get d k [default]), (has d k), (keys d)
+ * and (vals d) read it, (set d k v ...) and (del d k) return a new
+ * dictionary and leave d as it is.
+ *
+ * It is a hash array mapped trie: each node holds up to 32 slots picked
+ * by 5 bits of the hash, a slot is an entry or the node of the next 5
+ * bits. set and del copy only the nodes on the way to the key and share
+ * the rest with the dictionary they came from, so they take O(log n)
+ * and copies of a dictionary cost nothing. Once all the bits of the hash
+ * are used, entries with the same hash are kept in a list
+ * */
+#define DICT_BITS   5
+#define DICT_LEVELS ((int)(sizeof(unsigned long) * CHAR_BIT + DICT_BITS - 1) / DICT_BITS)
+
+typedef struct bdict_entry {
+	int refs; // Nodes holding it
+	unsigned long hash;
+	bval* key;
+	bval* val;
+} bdict_entry;
+
+// Either an entry or a node
+typedef struct {
+	bdict_entry* entry;
+	bdict_node* node;
+} bdict_slot;
+
+struct bdict_node {
+	int refs; // Dictionaries and nodes holding it
+	unsigned int bitmap; // Bit i is set if the slot for the 5 bits i is used, 0 for a list of entries
+	int count;
+	bdict_slot slot[];
+};
+
+int dict_popcount(unsigned int x) {
+#ifdef __GNUC__
+	return __builtin_popcount(x);
+#else
+	x = x - ((x >> 1) & 0x55555555u);
+	x = (x & 0x33333333u) + ((x >> 2) & 0x33333333u);
+	return (int)((((x + (x >> 4)) & 0x0F0F0F0Fu) * 0x01010101u) >> 24);
+#endif
+}
+
+// Bits of 'hash' that pick the slot in a node of 'level'
+unsigned int dict_bit(unsigned long hash, int level) {
+	return 1u << ((hash >> (level * DICT_BITS)) & ((1u << DICT_BITS) - 1));
+}
+
+// Takes 'key' and 'val'
+bdict_entry* dict_entry_new(bval* key, bval* val) {
+	bdict_entry* x = malloc(sizeof(bdict_entry));
+	x->refs = 1;
+	x->hash = bval_hash(key);
+	x->key  = key;
+	x->val  = val;
+	return x;
+}
+
+void dict_entry_release(bdict_entry* x) {
+	if(--x->refs > 0) return;
+	bval_del(x->key);
+	bval_del(x->val);
+	free(x);
+}
+
+void dict_node_release(bdict_node* n) {
+	if(!n || --n->refs > 0) return;
+	for(int i=0; i < n->count; i++) {
+		if(n->slot[i].node) dict_node_release(n->slot[i].node);
+		else dict_entry_release(n->slot[i].entry);
+	}
+	free(n);
+}
+
+bdict_node* dict_node_new(int count, unsigned int bitmap) {
+	bdict_node* n = malloc(sizeof(bdict_node) + sizeof(bdict_slot) * count);
+	n->refs   = 1;
+	n->bitmap = bitmap;
+	n->count  = count;
+	return n;
+}
+
+// Slot 'from' of 'n' held by 'to' as well
+void dict_slot_share(bdict_slot* to, bdict_slot* from) {
+	*to = *from;
+	if(to->node) to->node->refs++;
+	else to->entry->refs++;
+}
+
+void dict_slot_release(bdict_slot* s) {
+	if(s->node) dict_node_release(s->node);
+	else dict_entry_release(s->entry);
+}
+
+// Copy of 'n' sharing its slots, except slot 'skip' which is left for the caller (-1 for none)
+bdict_node* dict_node_copy(bdict_node* n, int skip) {
+	bdict_node* x = dict_node_new(n->count, n->bitmap);
+	for(int i=0; i < n->count; i++) {
+		if(i != skip) dict_slot_share(&x->slot[i], &n->slot[i]);
+	}
+	return x;
+}
+
+// Copy of 'n' with a slot 'at' added (to_add) or removed (!to_add)
+bdict_node* dict_node_resize(bdict_node* n, int at, unsigned int bitmap, int to_add) {
+	int count = (n ? n->count : 0) + (to_add ? 1 : -1);
+	bdict_node* x = dict_node_new(count, bitmap);
+	for(int i=0, k=0; i < count; i++, k++) {
+		if(i == at && to_add) {
+			k--;
+			continue;
+		}
+		if(k == at && !to_add) k++;
+		dict_slot_share(&x->slot[i], &n->slot[k]);
+	}
+	return x;
+}
+
+// Value of 'key' in 'n', NULL if it has none
+bval* dict_find(bdict_node* n, unsigned long hash, bval* key) {
+	for(int level=0; n; level++) {
+		if(level == DICT_LEVELS) {
+			for(int i=0; i < n->count; i++) {
+				if(bval_eq(n->slot[i].entry->key, key)) return n->slot[i].entry->val;
+			}
+			return NULL;
+		}
+
+		unsigned int bit = dict_bit(hash, level);
+		if(!(n->bitmap & bit)) return NULL;
+
+		bdict_slot* s = &n->slot[dict_popcount(n->bitmap & (bit-1))];
+		if(s->node) {
+			n = s->node;
+			continue;
+		}
+		return (s->entry->hash == hash && bval_eq(s->entry->key, key)) ? s->entry->val : NULL;
+	}
+	return NULL;
+}
+
+/**
+ * New node with 'e' put in 'n', which can be NULL and is left as it is.
+ * Takes 'e', sets 'added' if the key was not in 'n'
+ * */
+bdict_node* dict_insert(bdict_node* n, int level, bdict_entry* e, int* added) {
+	// A list of entries, past the last bits of the hash
+	if(level == DICT_LEVELS) {
+		int count = n ? n->count : 0;
+		for(int i=0; i < count; i++) {
+			if(bval_eq(n->slot[i].entry->key, e->key)) {
+				bdict_node* x = dict_node_copy(n, i);
+				x->slot[i] = (bdict_slot){ e, NULL };
+				return x;
+			}
+		}
+
+		bdict_node* x = dict_node_resize(n, count, 0, 1);
+		x->slot[count] = (bdict_slot){ e, NULL };
+		*added = 1;
+		return x;
+	}
+
+	unsigned int bit = dict_bit(e->hash, level);
+	unsigned int bitmap = n ? n->bitmap : 0;
+	int at = dict_popcount(bitmap & (bit-1));
+
+	// Free slot
+	if(!(bitmap & bit)) {
+		bdict_node* x = dict_node_resize(n, at, bitmap | bit, 1);
+		x->slot[at] = (bdict_slot){ e, NULL };
+		*added = 1;
+		return x;
+	}
+
+	bdict_slot s = n->slot[at];
+	bdict_node* x = dict_node_copy(n, at);
+
+	if(s.node) {
+		x->slot[at] = (bdict_slot){ NULL, dict_insert(s.node, level+1, e, added) };
+	} else if(s.entry->hash == e->hash && bval_eq(s.entry->key, e->key)) {
+		x->slot[at] = (bdict_slot){ e, NULL };
+	} else {
+		// Another key in the slot, both go to a node of the next level
+		int ignore = 0;
+		s.entry->refs++;
+		bdict_node* one = dict_insert(NULL, level+1, s.entry, &ignore);
+		x->slot[at] = (bdict_slot){ NULL, dict_insert(one, level+1, e, added) };
+		dict_node_release(one);
+	}
+	return x;
+}
+
+/**
+ * New node without 'key', NULL if nothing is left. If 'n' doesn't have
+ * it, n is given back with one more reference and 'removed' stays 0
+ * */
+bdict_node* dict_remove(bdict_node* n, int level, unsigned long hash, bval* key, int* removed) {
+	int at = -1;
+	unsigned int bit = 0;
+
+	if(level == DICT_LEVELS) {
+		for(int i=0; i < n->count && at == -1; i++) {
+			if(bval_eq(n->slot[i].entry->key, key)) at = i;
+		}
+	} else {
+		bit = dict_bit(hash, level);
+		if(n->bitmap & bit) at = dict_popcount(n->bitmap & (bit-1));
+	}
+
+	if(at == -1) {
+		n->refs++;
+		return n;
+	}
+
+	bdict_slot* s = &n->slot[at];
+	if(s->node) {
+		bdict_node* child = dict_remove(s->node, level+1, hash, key, removed);
+		if(!*removed) {
+			dict_node_release(child);
+			n->refs++;
+			return n;
+		}
+
+		if(child) {
+			bdict_node* x = dict_node_copy(n, at);
+
+			// A node left with a single entry is replaced by it
+			if(child->count == 1 && !child->slot[0].node) {
+				dict_slot_share(&x->slot[at], &child->slot[0]);
+				dict_node_release(child);
+			} else {
+				x->slot[at] = (bdict_slot){ NULL, child };
+			}
+			return x;
+		}
+	} else if(level != DICT_LEVELS && !(s->entry->hash == hash && bval_eq(s->entry->key, key))) {
+		n->refs++;
+		return n;
+	}
+
+	*removed = 1;
+	if(n->count == 1) return NULL;
+	return dict_node_resize(n, at, n->bitmap & ~bit, 0);
+}
+
+// Adds the entries under 'n' to 'out' from 'i', returns the next free index
+long dict_entries(bdict_node* n, bdict_entry** out, long i) {
+	for(int k=0; n && k < n->count; k++) {
+		if(n->slot[k].node) i = dict_entries(n->slot[k].node, out, i);
+		else out[i++] = n->slot[k].entry;
+	}
+	return i;
+}
+
+// Array of all the entries of 'd', freed by the caller
+bdict_entry** bdict_list(bdict* d) {
+	bdict_entry** x = malloc(sizeof(bdict_entry*) * (d->count ? d->count : 1));
+	dict_entries(d->root, x, 0);
+	return x;
+}
+
+// Takes 'root'
+bval* bval_dict(bdict_node* root, long count) {
+	bdict* d = malloc(sizeof(bdict));
+	d->refs  = 1;
+	d->count = count;
+	d->root  = root;
+
+	bval* v = malloc(sizeof(bval));
+	v->type = BVAL_DICT;
+	v->dict = d;
+	return v;
+}
+
+void bdict_release(bdict* d) {
+	if(--d->refs > 0) return;
+	dict_node_release(d->root);
+	free(d);
+}
+
+void bdict_print(FILE* out, bdict* d) {
+	bdict_entry** all = bdict_list(d);
+	fprintf(out, "(dict");
+	for(long i=0; i < d->count; i++) {
+		fputc(' ', out); bval_fprint(out, all[i]->key);
+		fputc(' ', out); bval_fprint(out, all[i]->val);
+	}
+	fputc(')', out);
+	free(all);
+}
+
+int bdict_eq(bdict* x, bdict* y) {
+	if(x == y) return 1;
+	if(x->count != y->count) return 0;
+
+	bdict_entry** all = bdict_list(x);
+	int eq = 1;
+	for(long i=0; i < x->count && eq; i++) {
+		bval* v = dict_find(y->root, all[i]->hash, all[i]->key);
+		eq = v && bval_eq(v, all[i]->val);
+	}
+	free(all);
+	return eq;
+}
+
+// Entries are added up so the order they are found in doesn't matter
+unsigned long bdict_hash(bdict* d) {
+	bdict_entry** all = bdict_list(d);
+	unsigned long h = 0;
+	for(long i=0; i < d->count; i++) h += all[i]->hash * 31 + bval_hash(all[i]->val);
+	free(all);
+	return h;
+}
+
+// Puts the pairs of 'argv' in 'd', taking them
+bval* dict_put_pairs(char* func, bdict_node* root, long count, int argc, bval** argv) {
+	FASSERT(argc % 2 == 0,
+		"Function '%s' passed %i keys and values, Expected pairs of key and value.", func, argc);
+
+	for(int i=0; i < argc; i += 2) {
+		int added = 0;
+		bdict_node* x = dict_insert(root, 0, dict_entry_new(argv[i], argv[i+1]), &added);
+		argv[i] = argv[i+1] = NULL;
+
+		dict_node_release(root);
+		root   = x;
+		count += added;
+	}
+	return bval_dict(root, count);
+}
+
+// (dict k v ...) returns a dictionary of the keys k with the values v
+bval* builtin_dict_fast(benv* e, int argc, bval** argv) {
+	return dict_put_pairs("dict", NULL, 0, argc, argv);
+}
+
+// (set d k v ...) returns d with k set to v
+bval* builtin_set_fast(benv* e, int argc, bval** argv) {
+	FASSERT(argc >= 1, "Function 'set' passed no arguments.");
+	FASSERT_TYPE("set", argv, 0, BVAL_DICT);
+
+	FASSERT((argc-1) % 2 == 0,
+		"Function '%s' passed %i keys and values, Expected pairs of key and value.", "set", argc-1);
+
+	// The root is only shared once nothing can fail
+	bdict* d = argv[0]->dict;
+	if(d->root) d->root->refs++;
+	return dict_put_pairs("set", d->root, d->count, argc-1, argv+1);
+}
+
+// (get d k [default]) returns the value of k, default or an error if d doesn't have it
+bval* builtin_get_fast(benv* e, int argc, bval** argv) {
+	FASSERT(argc == 2 || argc == 3,
+		"Function 'get' passed %i arguments, Expected 2 or 3.", argc);
+	FASSERT_TYPE("get", argv, 0, BVAL_DICT);
+
+	bval* v = dict_find(argv[0]->dict->root, bval_hash(argv[1]), argv[1]);
+	if(v) return bval_copy(v);
+
+	FASSERT(argc == 3, "Key not found!");
+	v = argv[2];
+	argv[2] = NULL;
+	return v;
+}
+
+// (has d k) returns 1 if d has the key k
+bval* builtin_has_fast(benv* e, int argc, bval** argv) {
+	FASSERT_NUM("has", argc, 2);
+	FASSERT_TYPE("has", argv, 0, BVAL_DICT);
+	return bval_int(dict_find(argv[0]->dict->root, bval_hash(argv[1]), argv[1]) != NULL);
+}
+
+// (del d k) returns d without k
+bval* builtin_del_fast(benv* e, int argc, bval** argv) {
+	FASSERT_NUM("del", argc, 2);
+	FASSERT_TYPE("del", argv, 0, BVAL_DICT);
+
+	bdict* d = argv[0]->dict;
+	if(!d->root) {
+		bval* x = argv[0];
+		argv[0] = NULL;
+		return x;
+	}
+
+	int removed = 0;
+	bdict_node* root = dict_remove(d->root, 0, bval_hash(argv[1]), argv[1], &removed);
+	return bval_dict(root, d->count - removed);
+}
+
+// Q-Expression of the keys (vals = 0) or the values (vals = 1) of a dictionary
+bval* dict_column(char* func, int argc, bval** argv, int vals) {
+	FASSERT_NUM(func, argc, 1);
+	FASSERT_TYPE(func, argv, 0, BVAL_DICT);
+
+	bdict* d = argv[0]->dict;
+	bdict_entry** all = bdict_list(d);
+	bval* x = bval_qexpr();
+	x->count = d->count;
+	x->cell  = malloc(sizeof(bval*) * (d->count ? d->count : 1));
+	for(long i=0; i < d->count; i++) x->cell[i] = bval_copy(vals ? all[i]->val : all[i]->key);
+	free(all);
+	return x;
+}
+
+// (keys d) returns the keys of d, (vals d) the values in the same order
+bval* builtin_keys_fast(benv* e, int argc, bval** argv) {
+	return dict_column("keys", argc, argv, 0);
+}
+
+bval* builtin_vals_fast(benv* e, int argc, bval** argv) {
+	return dict_column("vals", argc, argv, 1);
+}
+
+bval* builtin_dict(benv* e, bval* a) {
+	return builtin_fast(e, a, builtin_dict_fast);
+}
+
+bval* builtin_set(benv* e, bval* a) {
+	return builtin_fast(e, a, builtin_set_fast);
+}
+
+bval* builtin_get(benv* e, bval* a) {
+	return builtin_fast(e, a, builtin_get_fast);
+}
+
+bval* builtin_has(benv* e, bval* a) {
+	return builtin_fast(e, a, builtin_has_fast);
+}
+
+bval* builtin_del(benv* e, bval* a) {
+	return builtin_fast(e, a, builtin_del_fast);
+}
+
+bval* builtin_keys(benv* e, bval* a) {
+	return builtin_fast(e, a, builtin_keys_fast);
+}
+
+bval* builtin_vals(benv* e, bval* a) {
+	return builtin_fast(e, a, builtin_vals_fast);
+}
+
+
+/**
+ * 
+ * SORT FUNCTIONS
+ * 
+ * */
+
+/**
+ * (sort list) orders numbers by value and strings byte by byte, lists
+ * of them element by element. (sort f list) uses f instead, (f x y) is
+ * true when x goes before y. (sort-by f list) calls f once for each
+ * element and orders the elements by what it returned. Equal elements
+ * keep their order.
+ *
+ * Lists of only integers or only doubles are radix sorted on the bits
+ * of the numbers, strings are compared by their first 8 bytes before
+ * strcmp and anything else is merge sorted
+ * */
+typedef struct {
+	unsigned long long bits; // Radix key of a number, first bytes of a string
+	bval* key; // Compared, the element itself unless sort-by
+	bval* val; // Element
+} bsort_item;
+
+typedef struct {
+	char* func;
+	benv* e;
+	bval* f; // Comparator, NULL for the default order
+	int strings; // The keys are all strings, so bits can be compared first
+	bval* err; // First error, once set nothing is compared anymore
+} bsort;
+
+// -1, 0 or 1 as 'x' goes before, with or after 'y' in the default order, 2 if they can't be compared
+int bval_order(bval* x, bval* y) {
+	int xnum = x->type == BVAL_NUM || x->type == BVAL_INT;
+	int ynum = y->type == BVAL_NUM || y->type == BVAL_INT;
+	if(xnum && ynum) return bval_num_cmp(x, y);
+	if(x->type != y->type) return 2;
+
+	if(x->type == BVAL_STR) {
+		int c = strcmp(x->str, y->str);
+		return (c > 0) - (c < 0);
+	}
+	if(x->type == BVAL_QEXPR) {
+		for(int i=0; i < x->count && i < y->count; i++) {
+			int c = bval_order(x->cell[i], y->cell[i]);
+			if(c) return c;
+		}
+		return (x->count > y->count) - (x->count < y->count);
+	}
+	return 2;
+}
+
+// 1 if 'x' goes before 'y'
+int sort_less(bsort* s, bsort_item* x, bsort_item* y) {
+	if(s->err) return 0;
+
+	if(s->f) {
+		bval* args[2] = { bval_copy(x->key), bval_copy(y->key) };
+		bval* t = bval_call_argv(s->e, s->f, 2, args);
+		if(t->type == BVAL_ERR) {
+			s->err = t;
+			return 0;
+		}
+		int r = bval_val(t);
+		bval_del(t);
+		return r;
+	}
+
+	if(s->strings && x->bits != y->bits) return x->bits < y->bits;
+
+	int c = bval_order(x->key, y->key);
+	if(c == 2) {
+		s->err = bval_err("Function '%s' can't compare %s with %s.",
+			s->func, btype_name(x->key->type), btype_name(y->key->type));
+		return 0;
+	}
+	return c == -1;
+}
+
+// Stable merge sort of 'a', 'tmp' has room for half of it
+void sort_merge(bsort* s, bsort_item* a, bsort_item* tmp, long n) {
+	if(n <= 16) {
+		for(long i=1; i < n; i++) {
+			bsort_item x = a[i];
+			long j = i;
+			for(; j > 0 && sort_less(s, &x, &a[j-1]); j--) a[j] = a[j-1];
+			a[j] = x;
+		}
+		return;
+	}
+
+	long h = n / 2;
+	sort_merge(s, a, tmp, h);
+	sort_merge(s, a + h, tmp, n - h);
+
+	// Halves already in order
+	if(!sort_less(s, &a[h], &a[h-1])) return;
+
+	// The first half is moved out of the way, the merge never writes past what it read of the second
+	memcpy(tmp, a, sizeof(bsort_item) * h);
+	long i = 0, j = h, k = 0;
+	while(i < h && j < n) a[k++] = sort_less(s, &a[j], &tmp[i]) ? a[j++] : tmp[i++];
+	while(i < h) a[k++] = tmp[i++];
+}
+
+// Stable LSD radix sort of 'a' on bits, a byte at a time, 'tmp' has room for all of it
+void sort_radix(bsort_item* a, bsort_item* tmp, long n) {
+	long count[8][256] = {{ 0 }};
+	for(long i=0; i < n; i++) {
+		for(int b=0; b < 8; b++) count[b][(a[i].bits >> (b * 8)) & 255]++;
+	}
+
+	bsort_item* src = a;
+	bsort_item* dst = tmp;
+	for(int b=0; b < 8; b++) {
+		// Every key has the same byte here, nothing would move
+		if(count[b][(src[0].bits >> (b * 8)) & 255] == n) continue;
+
+		long at = 0;
+		for(int k=0; k < 256; k++) {
+			long c = count[b][k];
+			count[b][k] = at;
+			at += c;
+		}
+		for(long i=0; i < n; i++) dst[count[b][(src[i].bits >> (b * 8)) & 255]++] = src[i];
+
+		bsort_item* t = src;
+		src = dst;
+		dst = t;
+	}
+	if(src != a) memcpy(a, src, sizeof(bsort_item) * n);
+}
+
+// Radix key of a number, unsigned order of the keys is the order of the numbers
+unsigned long long sort_bits(bval* x) {
+	if(x->type == BVAL_INT) return (unsigned long long)x->integer ^ (1ULL << 63);
+
+	// Positive doubles get the sign bit set, negative ones are flipped so the larger magnitude is smaller
+	double d = x->num + 0.0; // -0 is 0
+	unsigned long long bits;
+	memcpy(&bits, &d, sizeof(bits));
+	return (bits >> 63) ? ~bits : bits | (1ULL << 63);
+}
+
+// First 8 bytes of a string, big endian so unsigned order is the order of strcmp
+unsigned long long sort_prefix(char* str) {
+	unsigned long long bits = 0;
+	int i = 0;
+	for(; i < 8 && str[i]; i++) bits = (bits << 8) | (unsigned char)str[i];
+	return i ? bits << ((8 - i) * 8) : 0;
+}
+
+// Sorts the elements of 'argv[list]' by 'f' (f_is_key = 0) or by what f returns for them (f_is_key = 1)
+bval* sort_list(char* func, benv* e, bval** argv, int list, bval* f, int f_is_key) {
+	bseq s = bseq_take(argv, list);
+	bcells all = bcells_for(&s);
+	bval* x;
+	while((x = bseq_next(&s)) && x->type != BVAL_ERR) {
+		if((x = bcells_add(&all, x))) break;
+	}
+	bseq_del(&s);
+	if(x) {
+		bcells_del(&all);
+		return x;
+	}
+
+	long n = all.count;
+	bsort_item* items = malloc(sizeof(bsort_item) * (n ? n : 1));
+	bsort st = { func, e, f_is_key ? NULL : f, 1, NULL };
+	int ints = 1, nums = 1;
+
+	for(long i=0; i < n; i++) {
+		items[i].val = all.cell[i];
+		items[i].key = all.cell[i];
+		if(f_is_key && !st.err) {
+			bval* arg = bval_copy(all.cell[i]);
+			items[i].key = bval_call_argv(e, f, 1, &arg);
+			if(items[i].key->type == BVAL_ERR) st.err = bval_copy(items[i].key);
+		}
+
+		int t = items[i].key->type;
+		ints = ints && t == BVAL_INT;
+		nums = nums && t == BVAL_NUM;
+		st.strings = st.strings && t == BVAL_STR;
+	}
+
+	if(!st.err && n > 1) {
+		if(!st.f && (ints || nums)) {
+			bsort_item* tmp = malloc(sizeof(bsort_item) * n);
+			for(long i=0; i < n; i++) items[i].bits = sort_bits(items[i].key);
+			sort_radix(items, tmp, n);
+			free(tmp);
+		} else {
+			st.strings = st.strings && !st.f;
+			bsort_item* tmp = malloc(sizeof(bsort_item) * (n / 2 + 1));
+			for(long i=0; i < n && st.strings; i++) items[i].bits = sort_prefix(items[i].key->str);
+			sort_merge(&st, items, tmp, n);
+			free(tmp);
+		}
+	}
+
+	// The order of the elements follows the items
+	for(long i=0; i < n; i++) {
+		if(f_is_key && items[i].key != items[i].val) bval_del(items[i].key);
+		all.cell[i] = items[i].val;
+	}
+	free(items);
+
+	if(st.err) {
+		bcells_del(&all);
+		return st.err;
+	}
+	return bcells_qexpr(&all);
+}
+
+// (sort list) returns the elements of list in order, (sort f list) with (f x y) true when x goes before y
+bval* builtin_sort_fast(benv* e, int argc, bval** argv) {
+	FASSERT(argc == 1 || argc == 2,
+		"Function 'sort' passed %i arguments, Expected 1 or 2.", argc);
+	if(argc == 2) FASSERT_CALLABLE("sort", argv, 0);
+	FASSERT_SEQ("sort", argv, argc-1);
+
+	return sort_list("sort", e, argv, argc-1, (argc == 2) ? argv[0] : NULL, 0);
+}
+
+// (sort-by f list) returns the elements of list ordered by (f x)
+bval* builtin_sort_by_fast(benv* e, int argc, bval** argv) {
+	FASSERT_NUM("sort-by", argc, 2);
+	FASSERT_CALLABLE("sort-by", argv, 0);
+	FASSERT_SEQ("sort-by", argv, 1);
+
+	return sort_list("sort-by", e, argv, 1, argv[0], 1);
+}
+
+bval* builtin_sort(benv* e, bval* a) {
+	return builtin_fast(e, a, builtin_sort_fast);
+}
+
+bval* builtin_sort_by(benv* e, bval* a) {
+	return builtin_fast(e, a, builtin_sort_by_fast);
+}
+
+
+/**
+ * 
+ * REGEX FUNCTIONS
+ * 
+ * */
+
+/**
+ * (re-match re s) is 1 if all of s matches re, (re-find-all re s)
+ * returns the matches of re in s from the left, without overlapping
+ * them and skipping empty ones, (re-replace re s new) returns s with
+ * each of those matches replaced by new.
+ *
+ * A pattern is compiled to a DFA: a table with the next state for each
+ * state and byte. From where it starts it reads each byte once, never going back,
+ * and matches the longest text it can, so "a*a" matches "aa". \D, \S
+ * and \W match a single byte that is not a digit, space or letter.
+ * '^' and '$' match at the start and end of the string.
+ * To find matches the string is first read once from its end by a DFA
+ * of the pattern read backwards, which marks each byte a match starts
+ * at, so a string with no match is read twice. Each match found is then
+ * read from its start as far as the DFA can go, which may be past its end.
+ * A DFA can't match \b, patterns with it (or needing too many states)
+ * are compiled by mpc_re instead, whose repetitions take all they can
+ * and never give any back, so "a*a\\b" matches nothing.
+ * What a string is compiled to is kept in a cache keyed by the pattern,
+ * when it is full the one used least recently is dropped, so a pattern
+ * used in a loop is only compiled once.
+ *
+ * (re-dfa pattern) returns the DFA of a pattern, or an error saying why
+ * there can't be one
+ * */
+#define RE_CACHE_SIZE 64
+#define RE_NFA_MAX 4096 // States of the NFA a DFA is made from
+#define RE_DFA_MAX 1024 // States of a DFA
+
+typedef struct {
+	char* pattern; // NULL if unused
+	unsigned long hash;
+	unsigned long used; // re_ticks when it was last used, the smallest is dropped first
+	bdfa* dfa; // NULL if the pattern can't be one, then the parsers are used
+	mpc_parser_t* whole; // Matches all of a string
+	mpc_parser_t* scan; // Reads a string as a list of matches and the single bytes between them
+} bre_cached;
+
+bre_cached re_cache[RE_CACHE_SIZE];
+unsigned long re_ticks = 0;
+
+// A match in a string
+typedef struct {
+	long at;
+	long len;
+} bre_match;
+
+// What 'scan' gives, a match or NULL for each byte not in one
+typedef struct {
+	int count;
+	char** seg;
+} bre_segs;
+
+mpc_val_t* re_fold_segs(int n, mpc_val_t** xs) {
+	bre_segs* s = malloc(sizeof(bre_segs));
+	s->count = n;
+	s->seg   = malloc(sizeof(char*) * (n ? n : 1));
+	for(int i=0; i<n; i++) s->seg[i] = xs[i];
+	return s;
+}
+
+mpc_val_t* re_skip(mpc_val_t* x) {
+	free(x);
+	return NULL;
+}
+
+int re_nonempty(mpc_val_t** x) {
+	return ((char*)*x)[0] != '\0';
+}
+
+bdfa* bdfa_new(char* pattern, char** err);
+
+// DFA or parsers of 'pattern', NULL if it is not a valid pattern
+bre_cached* re_lookup(char* pattern) {
+	unsigned long h = bval_hash_str(pattern);
+	bre_cached* lru = &re_cache[0];
+	re_ticks++;
+
+	for(int i=0; i < RE_CACHE_SIZE; i++) {
+		bre_cached* c = &re_cache[i];
+		if(c->pattern && c->hash == h && strcmp(c->pattern, pattern)==0) {
+			c->used = re_ticks;
+			return c;
+		}
+		// Unused entries have 'used' 0, so they are taken first
+		if(c->used < lru->used) lru = c;
+	}
+
+	// \b is left to mpc_re, so the reason a DFA can't be made isn't needed
+	char* err = NULL;
+	bdfa* d = bdfa_new(pattern, &err);
+
+	mpc_parser_t* re = NULL;
+	if(!d) {
+		// An invalid pattern gives a parser that always fails saying so
+		re = mpc_re(pattern);
+		mpc_result_t r;
+		if(mpc_parse("<regex>", "", re, &r)) {
+			free(r.output);
+		} else {
+			char* msg = mpc_err_string(r.error);
+			int invalid = strstr(msg, "Invalid Regex") != NULL;
+			free(msg);
+			mpc_err_delete(r.error);
+			if(invalid) {
+				mpc_delete(re);
+				return NULL;
+			}
+		}
+	}
+
+	if(lru->pattern) {
+		free(lru->pattern);
+		if(lru->dfa) {
+			bdfa_release(lru->dfa);
+		} else {
+			mpc_delete(lru->whole);
+			mpc_delete(lru->scan);
+		}
+	}
+
+	lru->pattern = malloc(strlen(pattern) + 1);
+	strcpy(lru->pattern, pattern);
+	lru->hash  = h;
+	lru->used  = re_ticks;
+	lru->dfa   = d;
+	lru->whole = NULL;
+	lru->scan  = NULL;
+	if(re) {
+		// Not mpc_whole, its end of input fails after a '$' in the pattern already matched it
+		lru->whole = mpc_and(2, mpcf_fst, mpc_copy(re), mpc_not(mpc_any(), free), free);
+		lru->scan  = mpc_many(re_fold_segs, mpc_or(2,
+			mpc_check(re, free, re_nonempty, "a match"),
+			mpc_apply(mpc_any(), re_skip)));
+	}
+	return lru;
+}
+
+typedef struct {
+	int type;
+	int out;
+	int out1; // Second way out of a NFA_SPLIT
+	unsigned char set[32]; // Bytes a NFA_SET state reads
+} bnfa_state;
+
+// NFA_START and NFA_END only let through before the first byte read and after the last,
+// they are '^' and '$', or '$' and '^' when the string is read from its end
+enum { NFA_SET, NFA_SPLIT, NFA_EPS, NFA_MATCH, NFA_START, NFA_END };
+
+// Pattern being compiled to a NFA
+typedef struct {
+	char* p; // Next byte of the pattern
+	bnfa_state* s;
+	int count;
+	char* err;
+	int back; // Compiled to be read from the end of the string
+} bnfa;
+
+// Part of a NFA, 'end' is a NFA_EPS state whose out is set by what follows it
+typedef struct {
+	int start;
+	int end;
+} bnfa_frag;
+
+int nfa_state(bnfa* n, int type) {
+	if(n->count == RE_NFA_MAX) {
+		n->err = "is too large";
+		return 0;
+	}
+	bnfa_state* s = &n->s[n->count];
+	memset(s, 0, sizeof(bnfa_state));
+	s->type = type;
+	s->out  = -1;
+	s->out1 = -1;
+	return n->count++;
+}
+
+bnfa_frag nfa_empty(bnfa* n) {
+	int e = nfa_state(n, NFA_EPS);
+	return (bnfa_frag){ e, e };
+}
+
+bnfa_frag nfa_set(bnfa* n, unsigned char* set) {
+	int s = nfa_state(n, NFA_SET);
+	int e = nfa_state(n, NFA_EPS);
+	memcpy(n->s[s].set, set, 32);
+	n->s[s].out = e;
+	return (bnfa_frag){ s, e };
+}
+
+bnfa_frag nfa_concat(bnfa* n, bnfa_frag a, bnfa_frag b) {
+	n->s[a.end].out = b.start;
+	return (bnfa_frag){ a.start, b.end };
+}
+
+bnfa_frag nfa_anchor(bnfa* n, int type) {
+	int s = nfa_state(n, type);
+	int e = nfa_state(n, NFA_EPS);
+	n->s[s].out = e;
+	return (bnfa_frag){ s, e };
+}
+
+bnfa_frag nfa_split(bnfa* n, int out, int out1) {
+	int s = nfa_state(n, NFA_SPLIT);
+	n->s[s].out  = out;
+	n->s[s].out1 = out1;
+	return (bnfa_frag){ s, s };
+}
+
+void set_add(unsigned char* set, int c) {
+	set[(unsigned char)c >> 3] |= 1 << (c & 7);
+}
+
+int set_has(unsigned char* set, int c) {
+	return set[c >> 3] & (1 << (c & 7));
+}
+
+void set_add_all(unsigned char* set, char* chars) {
+	for(; *chars; chars++) set_add(set, *chars);
+}
+
+void set_invert(unsigned char* set) {
+	for(int i=0; i < 32; i++) set[i] = ~set[i];
+}
+
+#define RE_DIGITS "0123456789"
+#define RE_SPACES " \f\n\r\t\v"
+#define RE_WORD   "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_"
+
+// Byte of an escape such as \n, 0 if 'c' is not one
+char re_escape_byte(char c) {
+	switch(c) {
+		case 'a': return '\a';
+		case 'f': return '\f';
+		case 'n': return '\n';
+		case 'r': return '\r';
+		case 't': return '\t';
+		case 'v': return '\v';
+		default: return 0;
+	}
+}
+
+// Adds the bytes of a \d, \s or \w class, returns 0 if 'c' is not one
+int re_escape_class(unsigned char* set, char c) {
+	switch(c) {
+		case 'd': set_add_all(set, RE_DIGITS); return 1;
+		case 's': set_add_all(set, RE_SPACES); return 1;
+		case 'w': set_add_all(set, RE_WORD); return 1;
+		default: return 0;
+	}
+}
+
+// Bytes of a [...] range, after the '['
+void nfa_range(bnfa* n, unsigned char* set) {
+	int negate = *n->p == '^';
+	if(negate) n->p++;
+	if(*n->p == ']' || *n->p == '\0') {
+		n->err = "has an invalid range";
+		return;
+	}
+
+	int prev = -1; // Last single byte, the start of a-z
+	while(*n->p && *n->p != ']') {
+		char c = *n->p++;
+		if(c == '\\' && *n->p) {
+			c = *n->p++;
+			char b = re_escape_byte(c);
+			prev = -1;
+			if(c == 'b') b = '\b';
+			if(b || !re_escape_class(set, c)) {
+				prev = (unsigned char)(b ? b : c);
+				set_add(set, prev);
+			}
+		} else if(c == '-' && prev != -1 && *n->p && *n->p != ']') {
+			int end = (unsigned char)*n->p++;
+			for(int i = prev; i <= end; i++) set_add(set, i);
+			prev = -1;
+		} else {
+			prev = (unsigned char)c;
+			set_add(set, c);
+		}
+	}
+
+	if(*n->p != ']') {
+		n->err = "has a range without ']'";
+		return;
+	}
+	n->p++;
+	if(negate) {
+		set_invert(set);
+		set[0] &= ~1; // Not the 0 after the string
+	}
+}
+
+bnfa_frag nfa_regex(bnfa* n);
+
+bnfa_frag nfa_base(bnfa* n) {
+	unsigned char set[32] = { 0 };
+	char c = *n->p++;
+
+	switch(c) {
+		case '(': {
+			bnfa_frag f = nfa_regex(n);
+			if(*n->p != ')') n->err = "has a '(' without ')'";
+			else n->p++;
+			return f;
+		}
+		case '[': nfa_range(n, set); break;
+
+		case '.':
+			set_invert(set);
+			set[0] &= ~1;
+			set[1] &= ~(1 << ('\n' - 8));
+			break;
+
+		case '^': return nfa_anchor(n, n->back ? NFA_END : NFA_START);
+		case '$': return nfa_anchor(n, n->back ? NFA_START : NFA_END);
+
+		case '\\':
+			c = *n->p;
+			if(!c) {
+				n->err = "ends with '\\'";
+				break;
+			}
+			n->p++;
+			if(strchr("bBAZ", c)) {
+				n->err = "has a \\b, \\B, \\A or \\Z, which a DFA can't match";
+			} else if(strchr("DSW", c)) {
+				re_escape_class(set, tolower(c));
+				set_invert(set);
+				set[0] &= ~1;
+			} else if(!re_escape_class(set, c)) {
+				set_add(set, re_escape_byte(c) ? re_escape_byte(c) : c);
+			}
+			break;
+
+		default: set_add(set, c); break;
+	}
+	return nfa_set(n, set);
+}
+
+bnfa_frag nfa_factor(bnfa* n) {
+	char* start = n->p;
+	bnfa_frag f = nfa_base(n);
+	int s, e;
+
+	switch(*n->p) {
+		case '*':
+			n->p++;
+			e = nfa_state(n, NFA_EPS);
+			s = nfa_split(n, f.start, e).start;
+			n->s[f.end].out = s;
+			return (bnfa_frag){ s, e };
+
+		case '+':
+			n->p++;
+			e = nfa_state(n, NFA_EPS);
+			s = nfa_split(n, f.start, e).start;
+			n->s[f.end].out = s;
+			return (bnfa_frag){ f.start, e };
+
+		case '?':
+			n->p++;
+			e = nfa_state(n, NFA_EPS);
+			s = nfa_split(n, f.start, e).start;
+			n->s[f.end].out = e;
+			return (bnfa_frag){ s, e };
+
+		case '{': {
+			// Only {digits} repeats, anything else is read as a '{'
+			char* end;
+			long times = strtol(n->p + 1, &end, 10);
+			if(!isdigit((unsigned char)n->p[1]) || *end != '}') return f;
+
+			if(times == 0) f = nfa_empty(n);
+			for(long i=1; i < times && !n->err; i++) {
+				// The base is read again for each copy
+				n->p = start;
+				f = nfa_concat(n, f, nfa_base(n));
+			}
+			n->p = end + 1;
+			return f;
+		}
+
+		default: return f;
+	}
+}
+
+bnfa_frag nfa_regex(bnfa* n) {
+	bnfa_frag f = nfa_empty(n);
+	while(*n->p && *n->p != '|' && *n->p != ')' && !n->err) {
+		bnfa_frag g = nfa_factor(n);
+		f = n->back ? nfa_concat(n, g, f) : nfa_concat(n, f, g);
+	}
+
+	if(*n->p != '|' || n->err) return f;
+	n->p++;
+
+	// a|b, both end in the same state
+	bnfa_frag g = nfa_regex(n);
+	int e = nfa_state(n, NFA_EPS);
+	n->s[f.end].out = e;
+	n->s[g.end].out = e;
+	return (bnfa_frag){ nfa_split(n, f.start, g.start).start, e };
+}
+
+/**
+ * Adds to 'set' the states of the NFA 'n' reached from 's' without reading,
+ * going past the anchors of type 'pass' (-1 for none). 'mark' is where it was visited
+ * */
+void nfa_closure(bnfa* n, int s, int pass, int* mark, int gen, int* set, int* count) {
+	while(s != -1 && mark[s] != gen) {
+		mark[s] = gen;
+		bnfa_state* x = &n->s[s];
+		if(x->type == NFA_SET || x->type == NFA_MATCH
+			|| ((x->type == NFA_START || x->type == NFA_END) && x->type != pass)) {
+			set[(*count)++] = s;
+			return;
+		}
+		if(x->type == NFA_SPLIT) nfa_closure(n, x->out1, pass, mark, gen, set, count);
+		s = x->out;
+	}
+}
+
+int int_cmp(const void* a, const void* b) {
+	return *(int*)a - *(int*)b;
+}
+
+void bdfa_release(bdfa* d) {
+	if(--d->refs > 0) return;
+	if(d->back) bdfa_release(d->back);
+	bval_del(d->pattern);
+	free(d->next);
+	free(d->accept);
+	free(d);
+}
+
+// State of 'd' for the 'size' NFA states in 'set', added if it is new. -1 if there is no room for it
+int dfa_state(bdfa* d, int** sets, int* sizes, int* set, int size) {
+	qsort(set, size, sizeof(int), int_cmp);
+	for(int k=0; k < d->count; k++) {
+		if(sizes[k] == size && memcmp(sets[k], set, sizeof(int) * size)==0) return k;
+	}
+	if(d->count == RE_DFA_MAX) return -1;
+
+	sets[d->count] = malloc(sizeof(int) * (size ? size : 1));
+	memcpy(sets[d->count], set, sizeof(int) * size);
+	sizes[d->count] = size;
+	return d->count++;
+}
+
+/**
+ * DFA of 'pattern', NULL with the reason in 'err' if it can't be made.
+ * With 'back' it reads the string from its end, and accepts after each
+ * byte a match that isn't empty starts at
+ * */
+bdfa* dfa_build(char* pattern, int back, char** err) {
+	bnfa n = { pattern, malloc(sizeof(bnfa_state) * RE_NFA_MAX), 0, NULL, back };
+	bnfa_frag f = nfa_regex(&n);
+	if(*n.p == ')' && !n.err) n.err = "has a ')' without '('";
+	n.s[f.end].out = nfa_state(&n, NFA_MATCH);
+	if(n.err) {
+		*err = n.err;
+		free(n.s);
+		return NULL;
+	}
+
+	bdfa* d = malloc(sizeof(bdfa));
+	d->refs = 1;
+	d->pattern = bval_str(pattern);
+	d->back = NULL;
+
+	// Bytes are split into classes by every set they are or aren't in
+	int rep[256]; // A byte of each class
+	memset(d->cls, 0, sizeof(d->cls));
+	d->classes = 1;
+	for(int i=0; i < n.count; i++) {
+		if(n.s[i].type != NFA_SET) continue;
+		int split[256][2];
+		int classes = 0;
+		for(int c=0; c < d->classes; c++) split[c][0] = split[c][1] = -1;
+		for(int b=0; b < 256; b++) {
+			int* to = &split[d->cls[b]][set_has(n.s[i].set, b) ? 1 : 0];
+			if(*to == -1) *to = classes++;
+			d->cls[b] = *to;
+		}
+		d->classes = classes;
+	}
+	for(int b=255; b >= 0; b--) rep[d->cls[b]] = b;
+
+	// Each state of the DFA is the sorted set of NFA states it can be in
+	int** sets = malloc(sizeof(int*) * RE_DFA_MAX);
+	int* sizes = malloc(sizeof(int) * RE_DFA_MAX);
+	int* mark = calloc(n.count, sizeof(int));
+	int* set = malloc(sizeof(int) * n.count);
+	int gen = 1;
+
+	d->next   = malloc(sizeof(int) * RE_DFA_MAX * d->classes);
+	d->accept = malloc(RE_DFA_MAX);
+	d->count  = 0;
+
+	// States a match starts in. Read backwards no match has started yet, these are added before each byte
+	int starts = 0;
+	int* start = malloc(sizeof(int) * n.count);
+	nfa_closure(&n, f.start, -1, mark, gen, start, &starts);
+	memcpy(set, start, sizeof(int) * starts);
+	dfa_state(d, sets, sizes, set, back ? 0 : starts);
+
+	// At the start of the string the '^'s it reached let through
+	int size = 0;
+	gen++;
+	for(int i=0; i < starts; i++) nfa_closure(&n, start[i], NFA_START, mark, gen, set, &size);
+	d->first = dfa_state(d, sets, sizes, set, size);
+
+	// Each state found is added at the end and gets its own row
+	for(int s=0; s < d->count && !*err; s++) {
+		// A match past a '$' only ends where the string does
+		size = 0;
+		gen++;
+		for(int i=0; i < sizes[s]; i++) nfa_closure(&n, sets[s][i], NFA_END, mark, gen, set, &size);
+		d->accept[s] = 0;
+		for(int i=0; i < size; i++) {
+			if(n.s[set[i]].type == NFA_MATCH) d->accept[s] = 2;
+		}
+		for(int i=0; i < sizes[s]; i++) {
+			if(n.s[sets[s][i]].type == NFA_MATCH) d->accept[s] = 1;
+		}
+
+		for(int c=0; c < d->classes && !*err; c++) {
+			size = 0;
+			gen++;
+			for(int i=0; i < sizes[s] + (back ? starts : 0); i++) {
+				bnfa_state* x = &n.s[i < sizes[s] ? sets[s][i] : start[i - sizes[s]]];
+				if(x->type == NFA_SET && set_has(x->set, rep[c]))
+					nfa_closure(&n, x->out, -1, mark, gen, set, &size);
+			}
+
+			// Read backwards there is always a next state, the one with no match started
+			int to = -1;
+			if(size || back) {
+				to = dfa_state(d, sets, sizes, set, size);
+				if(to == -1) *err = "needs too many states";
+			}
+			d->next[s * d->classes + c] = to;
+		}
+	}
+
+	for(int i=0; i < d->count; i++) free(sets[i]);
+	free(sets);
+	free(sizes);
+	free(mark);
+	free(set);
+	free(start);
+	free(n.s);
+
+	if(*err) {
+		bdfa_release(d);
+		return NULL;
+	}
+
+	// Room was made for the most states there could be
+	d->next   = realloc(d->next, sizeof(int) * d->count * d->classes);
+	d->accept = realloc(d->accept, d->count);
+	return d;
+}
+
+// DFA of 'pattern', NULL with the reason in 'err' if it can't be made
+bdfa* bdfa_new(char* pattern, char** err) {
+	bdfa* d = dfa_build(pattern, 0, err);
+	if(!d) return NULL;
+
+	// Without it each byte is tried as the start of a match
+	char* back_err = NULL;
+	d->back = dfa_build(pattern, 1, &back_err);
+	return d;
+}
+
+// Length of the longest match of 'd' at 'at' in 's', -1 if there is none
+long dfa_longest(bdfa* d, unsigned char* s, long at, long len) {
+	long last = -1;
+	int st = at ? 0 : d->first;
+	for(long i = at; st >= 0; i++) {
+		if(d->accept[st] == 1 || (d->accept[st] && i == len)) last = i - at;
+		if(i == len) break;
+		st = d->next[st * d->classes + d->cls[s[i]]];
+	}
+	return last;
+}
+
+#define FASSERT_REGEX(func, argv, index) \
+	FASSERT(argv[index]->type == BVAL_STR || argv[index]->type == BVAL_REGEX, \
+		"Function '%s' Got %s type for argument %i, Expected %s.", \
+		func, btype_name(argv[index]->type), index, btype_name(BVAL_STR))
+
+// Matches of 're' in 's', the number of them in 'count'. Returns an error or NULL
+bval* re_find(char* func, bval* re, bval* s, bre_match** out, long* count) {
+	long cap = 8;
+	*out = malloc(sizeof(bre_match) * cap);
+	*count = 0;
+
+	bre_cached* c = NULL;
+	if(re->type == BVAL_STR) {
+		c = re_lookup(re->str);
+		if(!c) return bval_err("Function '%s' passed an invalid pattern \"%s\".", func, re->str);
+	}
+
+	bdfa* d = c ? c->dfa : re->dfa;
+	if(d) {
+		unsigned char* str = (unsigned char*)s->str;
+
+		// Reading the string once from its end marks the bytes a match starts at
+		char* starts = d->back ? malloc(s->len + 1) : NULL;
+		if(starts) {
+			bdfa* b = d->back;
+			int st = b->first;
+			for(long i = s->len - 1; i >= 0; i--) {
+				st = b->next[st * b->classes + b->cls[str[i]]];
+				starts[i] = b->accept[st] == 1 || (b->accept[st] && i == 0);
+			}
+		}
+
+		for(long at = 0; at < s->len; ) {
+			// Bytes no match starts with are skipped without running the DFA
+			int st = at ? 0 : d->first;
+			if(starts ? !starts[at] : d->next[st * d->classes + d->cls[str[at]]] < 0) {
+				at++;
+				continue;
+			}
+
+			long len = dfa_longest(d, str, at, s->len);
+			if(len <= 0) {
+				at++;
+				continue;
+			}
+			if(*count == cap) *out = realloc(*out, sizeof(bre_match) * (cap *= 2));
+			(*out)[(*count)++] = (bre_match){ at, len };
+			at += len;
+		}
+		free(starts);
+		return NULL;
+	}
+
+	mpc_result_t r;
+	if(!mpc_parse("<regex>", s->str, c->scan, &r)) {
+		mpc_err_delete(r.error);
+		return bval_err("Function '%s' could not search the string.", func);
+	}
+
+	// Each segment is a match or a single byte
+	bre_segs* segs = r.output;
+	long at = 0;
+	for(int i=0; i < segs->count; i++) {
+		if(!segs->seg[i]) {
+			at++;
+			continue;
+		}
+		long len = strlen(segs->seg[i]);
+		if(*count == cap) *out = realloc(*out, sizeof(bre_match) * (cap *= 2));
+		(*out)[(*count)++] = (bre_match){ at, len };
+		at += len;
+		free(segs->seg[i]);
+	}
+	free(segs->seg);
+	free(segs);
+	return NULL;
+}
+
+// (re-dfa pattern) returns pattern compiled to a DFA
+bval* builtin_re_dfa_fast(benv* e, int argc, bval** argv) {
+	FASSERT_NUM("re-dfa", argc, 1);
+	FASSERT_TYPE("re-dfa", argv, 0, BVAL_STR);
+
+	char* err = NULL;
+	bdfa* d = bdfa_new(argv[0]->str, &err);
+	FASSERT(d, "Function 're-dfa' pattern \"%s\" %s.", argv[0]->str, err);
+
+	bval* v = malloc(sizeof(bval));
+	v->type = BVAL_REGEX;
+	v->dfa  = d;
+	return v;
+}
+
+// (re-match re s) returns 1 if all of s matches re
+bval* builtin_re_match_fast(benv* e, int argc, bval** argv) {
+	FASSERT_NUM("re-match", argc, 2);
+	FASSERT_REGEX("re-match", argv, 0);
+	FASSERT_TYPE("re-match", argv, 1, BVAL_STR);
+
+	bval* s = argv[1];
+	bre_cached* c = NULL;
+	if(argv[0]->type == BVAL_STR) {
+		c = re_lookup(argv[0]->str);
+		FASSERT(c, "Function 're-match' passed an invalid pattern \"%s\".", argv[0]->str);
+	}
+
+	bdfa* d = c ? c->dfa : argv[0]->dfa;
+	if(d) {
+		int st = d->first;
+		for(long i=0; i < s->len && st >= 0; i++) st = d->next[st * d->classes + d->cls[(unsigned char)s->str[i]]];
+		return bval_int(st >= 0 && d->accept[st]);
+	}
+
+	mpc_result_t r;
+	int ok = mpc_parse("<regex>", s->str, c->whole, &r);
+	if(ok) free(r.output);
+	else mpc_err_delete(r.error);
+	return bval_int(ok);
+}
+
+// (re-find-all re s) returns the matches of re in s
+bval* builtin_re_find_all_fast(benv* e, int argc, bval** argv) {
+	FASSERT_NUM("re-find-all", argc, 2);
+	FASSERT_REGEX("re-find-all", argv, 0);
+	FASSERT_TYPE("re-find-all", argv, 1, BVAL_STR);
+
+	bre_match* m;
+	long count;
+	bval* err = re_find("re-find-all", argv[0], argv[1], &m, &count);
+	if(err) {
+		free(m);
+		return err;
+	}
+
+	bval* x = bval_qexpr();
+	x->count = count;
+	x->cell  = malloc(sizeof(bval*) * (count ? count : 1));
+	for(long i=0; i < count; i++) x->cell[i] = bval_str_len(argv[1]->str + m[i].at, m[i].len);
+	free(m);
+	return x;
+}
+
+// (re-replace re s new) returns s with the matches of re replaced by new
+bval* builtin_re_replace_fast(benv* e, int argc, bval** argv) {
+	FASSERT_NUM("re-replace", argc, 3);
+	FASSERT_REGEX("re-replace", argv, 0);
+	FASSERT_TYPE("re-replace", argv, 1, BVAL_STR);
+	FASSERT_TYPE("re-replace", argv, 2, BVAL_STR);
+
+	bre_match* m;
+	long count;
+	bval* err = re_find("re-replace", argv[0], argv[1], &m, &count);
+	if(err) {
+		free(m);
+		return err;
+	}
+
+	bval* s = argv[1];
+	bval* new = argv[2];
+	long len = s->len + count * new->len;
+	for(long i=0; i < count; i++) len -= m[i].len;
+
+	char* r = malloc(len + 1);
+	char* to = r;
+	long from = 0;
+	for(long i=0; i < count; i++) {
+		memcpy(to, s->str + from, m[i].at - from);
+		to += m[i].at - from;
+		memcpy(to, new->str, new->len);
+		to += new->len;
+		from = m[i].at + m[i].len;
+	}
+	memcpy(to, s->str + from, s->len - from);
+	r[len] = '\0';
+	free(m);
+	return bval_str_take(r, len);
+}
+
+bval* builtin_re_dfa(benv* e, bval* a) {
+	return builtin_fast(e, a, builtin_re_dfa_fast);
+}
+
+bval* builtin_re_match(benv* e, bval* a) {
+	return builtin_fast(e, a, builtin_re_match_fast);
+}
+
+bval* builtin_re_find_all(benv* e, bval* a) {
+	return builtin_fast(e, a, builtin_re_find_all_fast);
+}
+
+bval* builtin_re_replace(benv* e, bval* a) {
+	return builtin_fast(e, a, builtin_re_replace_fast);
+}
+
+
+/*************************/
+/* JIT                   */
+/*************************/
+
+/**
+ * Lambdas called JIT_THRESHOLD times by the interpreter are compiled
+ * to x86-64 code, if their body only uses numbers, their formals,
+ * + - * / (or add sub mul div), comparisons, 'if', '&&', '||' and
+ * calls to lambdas that can be compiled too.
+ * Each lambda is compiled for integer or for double arguments, by the
+ * arguments of the call that reached the threshold, and the type of
+ * every expression is known when compiling: integers are kept in rax
+ * and doubles in xmm0. The formals are read from an array and
+ * intermediate results are pushed on the native stack.
+ *
+ * The code is only entered with arguments of the type it was compiled
+ * for, and each name
+ * it uses must still be bound to what it was when compiled (guards).
+ * Anything the code can't handle, like a division by zero, an integer
+ * overflow or an integer division with a remainder (the interpreter
+ * promotes those to doubles), makes it bail: it returns 1 and the call is evaluated by the interpreter
+ * from the start, which is fine because the code has no side effects.
+ * It also bails when eval_ticks runs out, so the evaluation limits are
+ * checked by the interpreter.
+ *
+ * 'jit_enabled' is cleared by --no-jit or (jit 0).
+ * With --jit-verify each native call is evaluated by the interpreter
+ * as well and differences are printed
+ * */
+int jit_enabled = 1;
+int jit_verify = 0;
+
+#ifdef ALTBAT_JIT
+
+#define JIT_THRESHOLD 100
+
+// Code being generated
+typedef struct {
+	unsigned char* buf;
+	int len;
+	int cap;
+
+	int* labels; // Position of each label, -1 until bound
+	int nlabels;
+	int* fixups; // Pairs of position of a rel32 and its label
+	int nfixups;
+
+	int depth;     // 8 byte slots pushed below the saved registers
+	benv* e;       // Environment names are resolved in
+	bval* self;    // Function being compiled
+	bjit* j;
+	int ok;        // Cleared when something can't be compiled
+	int self_call; // Set if the body calls the function being compiled
+} bjitc;
+
+void jit_byte(bjitc* c, int b) {
+	if(c->len == c->cap) {
+		c->cap = c->cap ? c->cap*2 : 256;
+		c->buf = realloc(c->buf, c->cap);
+	}
+	c->buf[c->len++] = b;
+}
+
+// Write 'n' bytes
+void jit_emit(bjitc* c, int n, ...) {
+	va_list va;
+	va_start(va, n);
+	for(int i=0; i<n; i++) jit_byte(c, va_arg(va, int));
+	va_end(va);
+}
+
+void jit_i32(bjitc* c, int x) {
+	for(int i=0; i<4; i++) jit_byte(c, (x >> (8*i)) & 0xFF);
+}
+
+void jit_i64(bjitc* c, unsigned long long x) {
+	for(int i=0; i<8; i++) jit_byte(c, (x >> (8*i)) & 0xFF);
+}
+
+int jit_label(bjitc* c) {
+	c->labels = realloc(c->labels, sizeof(int) * (c->nlabels+1));
+	c->labels[c->nlabels] = -1;
+	return c->nlabels++;
+}
+
+void jit_bind(bjitc* c, int label) {
+	c->labels[label] = c->len;
+}
+
+// Write a rel32 to 'label', after the opcode of a jump
+void jit_rel(bjitc* c, int label) {
+	c->fixups = realloc(c->fixups, sizeof(int) * 2 * (c->nfixups+1));
+	c->fixups[2*c->nfixups]   = c->len;
+	c->fixups[2*c->nfixups+1] = label;
+	c->nfixups++;
+	jit_i32(c, 0);
+}
+
+// xmm0 = x
+void jit_load_num(bjitc* c, double x) {
+	unsigned long long bits;
+	memcpy(&bits, &x, sizeof(bits));
+	jit_emit(c, 2, 0x48, 0xB8); jit_i64(c, bits);  // mov rax, imm64
+	jit_emit(c, 5, 0x66, 0x48, 0x0F, 0x6E, 0xC0);   // movq xmm0, rax
+}
+
+// rax = x
+void jit_load_int(bjitc* c, long long x) {
+	jit_emit(c, 2, 0x48, 0xB8); jit_i64(c, (unsigned long long)x); // mov rax, imm64
+}
+
+// xmm0 = rax, if 'exact' bail when the double is not the same number
+void jit_to_num(bjitc* c, int exact) {
+	jit_emit(c, 5, 0xF2, 0x48, 0x0F, 0x2A, 0xC0);     // cvtsi2sd xmm0, rax
+	if(exact) {
+		jit_emit(c, 5, 0xF2, 0x48, 0x0F, 0x2C, 0xD0); // cvttsd2si rdx, xmm0
+		jit_emit(c, 3, 0x48, 0x39, 0xC2);             // cmp rdx, rax
+		jit_emit(c, 2, 0x0F, 0x85); jit_rel(c, 1);    // jne bail
+	}
+}
+
+// Push rax or xmm0, by type 't'
+void jit_push(bjitc* c, int t) {
+	if(t == JIT_INT) {
+		jit_byte(c, 0x50);                            // push rax
+	} else {
+		jit_emit(c, 4, 0x48, 0x83, 0xEC, 0x08);       // sub rsp, 8
+		jit_emit(c, 5, 0xF2, 0x0F, 0x11, 0x04, 0x24); // movsd [rsp], xmm0
+	}
+	c->depth++;
+}
+
+/**
+ * Pop the left operand, of type 'tl', the right one of type 'tr' is in
+ * rax or xmm0. For 't' JIT_INT leaves them in rax and rcx, for JIT_NUM
+ * in xmm0 and xmm1 converting integers (see jit_to_num for 'exact')
+ * */
+void jit_pop_operands(bjitc* c, int tl, int tr, int t, int exact) {
+	if(t == JIT_INT) {
+		jit_emit(c, 3, 0x48, 0x89, 0xC1);             // mov rcx, rax
+		jit_byte(c, 0x58);                            // pop rax
+	} else {
+		if(tr == JIT_INT) jit_to_num(c, exact);
+		jit_emit(c, 4, 0x66, 0x0F, 0x28, 0xC8);       // movapd xmm1, xmm0
+		if(tl == JIT_INT) {
+			jit_byte(c, 0x58);                        // pop rax
+			jit_to_num(c, exact);
+		} else {
+			jit_emit(c, 5, 0xF2, 0x0F, 0x10, 0x04, 0x24); // movsd xmm0, [rsp]
+			jit_emit(c, 4, 0x48, 0x83, 0xC4, 0x08);       // add rsp, 8
+		}
+	}
+	c->depth--;
+}
+
+// Jump to 'label' if the value of type 't' is false, NaN is true like in C
+void jit_jump_false(bjitc* c, int t, int label) {
+	if(t == JIT_INT) {
+		jit_emit(c, 3, 0x48, 0x85, 0xC0);        // test rax, rax
+		jit_emit(c, 2, 0x0F, 0x84); jit_rel(c, label); // je label
+		return;
+	}
+	jit_emit(c, 4, 0x66, 0x0F, 0x57, 0xC9);  // xorpd xmm1, xmm1
+	jit_emit(c, 4, 0x66, 0x0F, 0x2E, 0xC1);  // ucomisd xmm0, xmm1
+	jit_emit(c, 2, 0x7A, 0x06);              // jp +6
+	jit_emit(c, 2, 0x0F, 0x84); jit_rel(c, label); // je label
+}
+
+void jit_jump_true(bjitc* c, int t, int label) {
+	if(t == JIT_INT) {
+		jit_emit(c, 3, 0x48, 0x85, 0xC0);        // test rax, rax
+		jit_emit(c, 2, 0x0F, 0x85); jit_rel(c, label); // jne label
+		return;
+	}
+	jit_emit(c, 4, 0x66, 0x0F, 0x57, 0xC9);  // xorpd xmm1, xmm1
+	jit_emit(c, 4, 0x66, 0x0F, 0x2E, 0xC1);  // ucomisd xmm0, xmm1
+	jit_emit(c, 2, 0x0F, 0x8A); jit_rel(c, label); // jp label
+	jit_emit(c, 2, 0x0F, 0x85); jit_rel(c, label); // jne label
+}
+
+// rax = rax / rcx, bailing unless the interpreter would give the same integer
+void jit_int_div(bjitc* c) {
+	int other = jit_label(c);
+	int end   = jit_label(c);
+
+	jit_emit(c, 3, 0x48, 0x85, 0xC9);              // test rcx, rcx
+	jit_emit(c, 2, 0x0F, 0x84); jit_rel(c, 1);     // je bail
+
+	// idiv faults on LLONG_MIN / -1
+	jit_emit(c, 4, 0x48, 0x83, 0xF9, 0xFF);        // cmp rcx, -1
+	jit_emit(c, 2, 0x0F, 0x85); jit_rel(c, other); // jne other
+	jit_emit(c, 3, 0x48, 0xF7, 0xD8);              // neg rax
+	jit_emit(c, 2, 0x0F, 0x80); jit_rel(c, 1);     // jo bail
+	jit_byte(c, 0xE9); jit_rel(c, end);            // jmp end
+
+	jit_bind(c, other);
+	jit_emit(c, 2, 0x48, 0x99);                    // cqo
+	jit_emit(c, 3, 0x48, 0xF7, 0xF9);              // idiv rcx
+	jit_emit(c, 3, 0x48, 0x85, 0xD2);              // test rdx, rdx
+	jit_emit(c, 2, 0x0F, 0x85); jit_rel(c, 1);     // jnz bail
+	jit_bind(c, end);
+}
+
+// Add a guard, 'name' must mean the same for every use
+void jit_guard(bjitc* c, char* name, bbuiltin builtin, bval* body, bval* fn) {
+	bjit* j = c->j;
+	for(int i=0; i < j->nguards; i++) {
+		if(strcmp(j->guards[i].name, name)==0) {
+			if(j->guards[i].builtin != builtin || j->guards[i].body != body) c->ok = 0;
+			if(fn) bval_del(fn);
+			return;
+		}
+	}
+
+	j->guards = realloc(j->guards, sizeof(struct JitGuard) * (j->nguards+1));
+	struct JitGuard* g = &j->guards[j->nguards++];
+	g->name = malloc(strlen(name)+1);
+	strcpy(g->name, name);
+	g->builtin = builtin;
+	g->body = body;
+	g->fn = fn;
+}
+
+// Position of 'sym' in the formals, -1 if not one
+int jit_formal(bjitc* c, char* sym) {
+	bval* formals = c->self->formals;
+	for(int i=0; i < formals->count; i++) {
+		if(strcmp(formals->cell[i]->sym, sym)==0) return i;
+	}
+	return -1;
+}
+
+void jit_compile(benv* e, bval* f, int mode);
+int jit_list(bjitc* c, bval* v);
+
+// Leaves the value of 'v' in rax or xmm0, returns its type
+int jit_expr(bjitc* c, bval* v) {
+	if(!c->ok) return JIT_NUM;
+
+	switch(v->type) {
+		case BVAL_NUM:
+			jit_load_num(c, v->num);
+			return JIT_NUM;
+
+		case BVAL_INT:
+			jit_load_int(c, v->integer);
+			return JIT_INT;
+
+		case BVAL_SYM: {
+			int i = jit_formal(c, v->sym);
+			if(i == -1) { c->ok = 0; return JIT_NUM; }
+
+			if(c->j->mode == JIT_INT)
+				jit_emit(c, 3, 0x48, 0x8B, 0x83);       // mov rax, [rbx + 8*i]
+			else
+				jit_emit(c, 4, 0xF2, 0x0F, 0x10, 0x83); // movsd xmm0, [rbx + 8*i]
+			jit_i32(c, 8*i);
+			return c->j->mode;
+		}
+
+		case BVAL_SEXPR: return jit_list(c, v);
+
+		// Inlined calls are compiled as the original call
+		case BVAL_GUARD: return jit_expr(c, v->fallback);
+	}
+
+	c->ok = 0;
+	return JIT_NUM;
+}
+
+/**
+ * Call of lambda 'f', the arguments are the cells of 'v' after the first.
+ * 'f' is compiled for the type of the arguments if it wasn't yet
+ * */
+int jit_call_code(bjitc* c, bval* v, bval* f) {
+	int n = v->count-1;
+	if(f->formals->count != n) { c->ok = 0; return JIT_NUM; }
+
+	// Space for the arguments and the result, keeping rsp aligned for the call
+	int k = n+1;
+	if((c->depth + k) % 2) k++;
+	int base = -16 - 8*(c->depth + k);
+
+	jit_emit(c, 3, 0x48, 0x81, 0xEC); jit_i32(c, 8*k);  // sub rsp, 8*k
+	c->depth += k;
+
+	int mode = -1;
+	for(int i=0; i<n; i++) {
+		int t = jit_expr(c, v->cell[i+1]);
+		if(mode != -1 && t != mode) c->ok = 0;
+		mode = t;
+
+		if(t == JIT_INT)
+			jit_emit(c, 3, 0x48, 0x89, 0x85);       // mov [rbp+disp], rax
+		else
+			jit_emit(c, 4, 0xF2, 0x0F, 0x11, 0x85); // movsd [rbp+disp], xmm0
+		jit_i32(c, base + 8*i);
+	}
+	if(!c->ok) return JIT_NUM;
+
+	char* name = v->cell[0]->sym;
+	int self = (f->body == c->self->body);
+	int ret;
+	if(self) {
+		if(mode != c->j->mode) { c->ok = 0; return JIT_NUM; }
+		jit_guard(c, name, NULL, f->body, NULL);
+		c->self_call = 1;
+		ret = c->j->ret;
+	} else {
+		if(f->jit->state == JIT_NONE) jit_compile(c->e, f, mode);
+		if(f->jit->state != JIT_DONE || f->jit->mode != mode) { c->ok = 0; return JIT_NUM; }
+
+		// Hold a copy so its code stays, and take its guards
+		jit_guard(c, name, NULL, f->body, bval_copy(f));
+		for(int i=0; i < f->jit->nguards; i++) {
+			struct JitGuard* g = &f->jit->guards[i];
+			jit_guard(c, g->name, g->builtin, g->body, NULL);
+		}
+		ret = f->jit->ret;
+	}
+
+	jit_emit(c, 3, 0x48, 0x8D, 0xBD); jit_i32(c, base);       // lea rdi, [rbp+args]
+	jit_emit(c, 3, 0x48, 0x8D, 0xB5); jit_i32(c, base + 8*n); // lea rsi, [rbp+out]
+
+	if(self) {
+		jit_byte(c, 0xE8); jit_i32(c, -(c->len + 4)); // call start
+	} else {
+		jit_emit(c, 2, 0x48, 0xB8); jit_i64(c, (unsigned long long)(size_t)f->jit->code); // mov rax, code
+		jit_emit(c, 2, 0xFF, 0xD0); // call rax
+	}
+
+	// Bail if it did
+	jit_emit(c, 2, 0x85, 0xC0);                    // test eax, eax
+	jit_emit(c, 2, 0x0F, 0x85); jit_rel(c, 1);     // jnz bail
+
+	if(ret == JIT_INT)
+		jit_emit(c, 3, 0x48, 0x8B, 0x85);          // mov rax, [rbp+out]
+	else
+		jit_emit(c, 4, 0xF2, 0x0F, 0x10, 0x85);    // movsd xmm0, [rbp+out]
+	jit_i32(c, base + 8*n);
+	jit_emit(c, 3, 0x48, 0x81, 0xC4); jit_i32(c, 8*k); // add rsp, 8*k
+	c->depth -= k;
+	return ret;
+}
+
+// Leaves the value of the cells of 'v', evaluated as a S-Expression, in rax or xmm0
+int jit_list(bjitc* c, bval* v) {
+	if(!c->ok) return JIT_NUM;
+	if(v->count == 0) { c->ok = 0; return JIT_NUM; }
+	if(v->count == 1) return jit_expr(c, v->cell[0]);
+
+	bval* head = v->cell[0];
+	int n = v->count-1;
+
+	if(head->type != BVAL_SYM || jit_formal(c, head->sym) != -1) { c->ok = 0; return JIT_NUM; }
+	bval* f = benv_lookup(c->e, head->sym, NULL);
+	if(!f || f->type != BVAL_FUN) { c->ok = 0; return JIT_NUM; }
+
+	// Calls to lambdas
+	if(!f->builtin) return jit_call_code(c, v, f);
+
+	bbuiltin b = f->builtin;
+	jit_guard(c, head->sym, b, NULL, NULL);
+
+	// Arithmetic, folding from the left like builtin_op_fast
+	if(b == builtin_add || b == builtin_sub || b == builtin_mul || b == builtin_div) {
+		int t = jit_expr(c, v->cell[1]);
+
+		if(n == 1 && b == builtin_sub) {
+			if(t == JIT_INT) {
+				jit_emit(c, 3, 0x48, 0xF7, 0xD8);          // neg rax
+				jit_emit(c, 2, 0x0F, 0x80); jit_rel(c, 1); // jo bail
+			} else {
+				jit_emit(c, 2, 0x48, 0xB8); jit_i64(c, 0x8000000000000000ULL); // mov rax, sign bit
+				jit_emit(c, 5, 0x66, 0x48, 0x0F, 0x6E, 0xC8);  // movq xmm1, rax
+				jit_emit(c, 4, 0x66, 0x0F, 0x57, 0xC1);        // xorpd xmm0, xmm1
+			}
+			return t;
+		}
+
+		for(int i=2; i<=n; i++) {
+			jit_push(c, t);
+			int tr = jit_expr(c, v->cell[i]);
+			int r = (t == JIT_INT && tr == JIT_INT) ? JIT_INT : JIT_NUM;
+			jit_pop_operands(c, t, tr, r, 0);
+			t = r;
+
+			// Integers bail on overflow, where the interpreter gives a double
+			if(t == JIT_INT) {
+				if(b == builtin_add) jit_emit(c, 3, 0x48, 0x01, 0xC8);       // add rax, rcx
+				if(b == builtin_sub) jit_emit(c, 3, 0x48, 0x29, 0xC8);       // sub rax, rcx
+				if(b == builtin_mul) jit_emit(c, 4, 0x48, 0x0F, 0xAF, 0xC1); // imul rax, rcx
+				if(b == builtin_div) jit_int_div(c);
+				else { jit_emit(c, 2, 0x0F, 0x80); jit_rel(c, 1); }         // jo bail
+				continue;
+			}
+
+			if(b == builtin_add) jit_emit(c, 4, 0xF2, 0x0F, 0x58, 0xC1); // addsd xmm0, xmm1
+			if(b == builtin_sub) jit_emit(c, 4, 0xF2, 0x0F, 0x5C, 0xC1); // subsd xmm0, xmm1
+			if(b == builtin_mul) jit_emit(c, 4, 0xF2, 0x0F, 0x59, 0xC1); // mulsd xmm0, xmm1
+			if(b == builtin_div) {
+				// Bail on division by zero, the interpreter gives the error
+				jit_emit(c, 4, 0x66, 0x0F, 0x57, 0xD2);        // xorpd xmm2, xmm2
+				jit_emit(c, 4, 0x66, 0x0F, 0x2E, 0xCA);        // ucomisd xmm1, xmm2
+				jit_emit(c, 2, 0x0F, 0x84); jit_rel(c, 1);     // je bail
+				jit_emit(c, 4, 0xF2, 0x0F, 0x5E, 0xC1);        // divsd xmm0, xmm1
+			}
+		}
+		return t;
+	}
+
+	// Comparisons, giving the integer 1 or 0
+	if(b == builtin_gt || b == builtin_lt || b == builtin_ge
+		|| b == builtin_le || b == builtin_eq || b == builtin_ne) {
+		if(n != 2) { c->ok = 0; return JIT_NUM; }
+
+		int tl = jit_expr(c, v->cell[1]);
+		jit_push(c, tl);
+		int tr = jit_expr(c, v->cell[2]);
+		int t = (tl == JIT_INT && tr == JIT_INT) ? JIT_INT : JIT_NUM;
+
+		// The interpreter compares integers and doubles exactly
+		jit_pop_operands(c, tl, tr, t, 1);
+
+		if(t == JIT_INT) {
+			jit_emit(c, 3, 0x48, 0x39, 0xC8); // cmp rax, rcx
+			if(b == builtin_gt) jit_emit(c, 3, 0x0F, 0x9F, 0xC0); // setg al
+			if(b == builtin_lt) jit_emit(c, 3, 0x0F, 0x9C, 0xC0); // setl al
+			if(b == builtin_ge) jit_emit(c, 3, 0x0F, 0x9D, 0xC0); // setge al
+			if(b == builtin_le) jit_emit(c, 3, 0x0F, 0x9E, 0xC0); // setle al
+			if(b == builtin_eq) jit_emit(c, 3, 0x0F, 0x94, 0xC0); // sete al
+			if(b == builtin_ne) jit_emit(c, 3, 0x0F, 0x95, 0xC0); // setne al
+			jit_emit(c, 3, 0x0F, 0xB6, 0xC0); // movzx eax, al
+			return JIT_INT;
+		}
+
+		// xmm0 and xmm1 are swapped for < and <= so NaN gives false
+		if(b == builtin_lt || b == builtin_le)
+			jit_emit(c, 4, 0x66, 0x0F, 0x2E, 0xC8); // ucomisd xmm1, xmm0
+		else
+			jit_emit(c, 4, 0x66, 0x0F, 0x2E, 0xC1); // ucomisd xmm0, xmm1
+
+		if(b == builtin_gt || b == builtin_lt) jit_emit(c, 3, 0x0F, 0x97, 0xC0); // seta al
+		if(b == builtin_ge || b == builtin_le) jit_emit(c, 3, 0x0F, 0x93, 0xC0); // setae al
+		if(b == builtin_eq) {
+			jit_emit(c, 3, 0x0F, 0x94, 0xC0); // sete al
+			jit_emit(c, 3, 0x0F, 0x9B, 0xC1); // setnp cl
+			jit_emit(c, 2, 0x20, 0xC8);       // and al, cl
+		}
+		if(b == builtin_ne) {
+			jit_emit(c, 3, 0x0F, 0x95, 0xC0); // setne al
+			jit_emit(c, 3, 0x0F, 0x9A, 0xC1); // setp cl
+			jit_emit(c, 2, 0x08, 0xC8);       // or al, cl
+		}
+		jit_emit(c, 3, 0x0F, 0xB6, 0xC0);     // movzx eax, al
+		return JIT_INT;
+	}
+
+	if(b == builtin_if) {
+		if(n != 3 || v->cell[2]->type != BVAL_QEXPR || v->cell[3]->type != BVAL_QEXPR) {
+			c->ok = 0;
+			return JIT_NUM;
+		}
+
+		int other = jit_label(c);
+		int end   = jit_label(c);
+
+		jit_jump_false(c, jit_expr(c, v->cell[1]), other);
+		int ta = jit_list(c, v->cell[2]);
+		jit_byte(c, 0xE9); jit_rel(c, end); // jmp end
+		jit_bind(c, other);
+		int tb = jit_list(c, v->cell[3]);
+		jit_bind(c, end);
+
+		// Both branches must leave their value in the same register
+		if(ta != tb) c->ok = 0;
+		return ta;
+	}
+
+	if(b == builtin_and || b == builtin_or) {
+		int done = jit_label(c);
+		int end  = jit_label(c);
+
+		for(int i=1; i<=n; i++) {
+			int t = jit_expr(c, v->cell[i]);
+			if(b == builtin_and) jit_jump_false(c, t, done);
+			else jit_jump_true(c, t, done);
+		}
+
+		// All true for &&, all false for ||
+		jit_byte(c, 0xB8); jit_i32(c, b == builtin_and); // mov eax, imm32
+		jit_byte(c, 0xE9); jit_rel(c, end);
+		jit_bind(c, done);
+		jit_byte(c, 0xB8); jit_i32(c, b != builtin_and);
+		jit_bind(c, end);
+		return JIT_INT;
+	}
+
+	c->ok = 0;
+	return JIT_NUM;
+}
+
+// Compile lambda 'f' for arguments of type 'mode', names in its body are resolved in 'e'
+void jit_compile(benv* e, bval* f, int mode) {
+	bjit* j = f->jit;
+	j->state = JIT_BUSY;
+	j->mode = mode;
+	j->ret = mode;
+
+	// Only fixed, distinct formals
+	bval* formals = f->formals;
+	int ok = formals->count > 0;
+	for(int i=0; i < formals->count && ok; i++) {
+		if(strcmp(formals->cell[i]->sym, "&")==0) ok = 0;
+		for(int k=0; k<i; k++) {
+			if(strcmp(formals->cell[i]->sym, formals->cell[k]->sym)==0) ok = 0;
+		}
+	}
+
+	// Self calls are compiled expecting the type of the arguments as result,
+	// if the body gives the other type it is compiled again expecting that
+	for(int tries=0; tries < 2 && ok && !j->code; tries++) {
+		bjitc c = { NULL, 0, 0, NULL, 0, NULL, 0, 0, e, f, j, 1, 0 };
+		int exit = jit_label(&c);
+		int bail = jit_label(&c); // Label 1, used by jit_rel(c, 1)
+
+		// int code(bjit_value* args, bjit_value* out)
+		jit_byte(&c, 0x55);                  // push rbp
+		jit_emit(&c, 3, 0x48, 0x89, 0xE5);   // mov rbp, rsp
+		jit_byte(&c, 0x53);                  // push rbx
+		jit_emit(&c, 2, 0x41, 0x54);         // push r12
+		jit_emit(&c, 3, 0x48, 0x89, 0xFB);   // mov rbx, rdi
+		jit_emit(&c, 3, 0x49, 0x89, 0xF4);   // mov r12, rsi
+
+		// Each call is a step of the evaluation limits, the interpreter checks them
+		jit_emit(&c, 2, 0x48, 0xB8); jit_i64(&c, (unsigned long long)(size_t)&eval_ticks); // mov rax, &eval_ticks
+		jit_emit(&c, 3, 0x48, 0xFF, 0x08);                      // dec qword [rax]
+		jit_emit(&c, 2, 0x0F, 0x8E); jit_rel(&c, 1);            // jle bail
+
+		int t = jit_list(&c, f->body);
+
+		if(t == JIT_INT)
+			jit_emit(&c, 4, 0x49, 0x89, 0x04, 0x24);             // mov [r12], rax
+		else
+			jit_emit(&c, 6, 0xF2, 0x41, 0x0F, 0x11, 0x04, 0x24); // movsd [r12], xmm0
+		jit_emit(&c, 2, 0x31, 0xC0);                         // xor eax, eax
+		jit_byte(&c, 0xE9); jit_rel(&c, exit);               // jmp exit
+		jit_bind(&c, bail);
+		jit_byte(&c, 0xB8); jit_i32(&c, 1);                  // mov eax, 1
+		jit_bind(&c, exit);
+		jit_emit(&c, 4, 0x48, 0x8D, 0x65, 0xF0);             // lea rsp, [rbp-16]
+		jit_emit(&c, 2, 0x41, 0x5C);                         // pop r12
+		jit_byte(&c, 0x5B);                                  // pop rbx
+		jit_byte(&c, 0x5D);                                  // pop rbp
+		jit_byte(&c, 0xC3);                                  // ret
+
+		// In dynamic scope a formal named like a guarded name would hide it from callees
+		for(int i=0; i < j->nguards && c.ok; i++) {
+			if(jit_formal(&c, j->guards[i].name) != -1) c.ok = 0;
+		}
+
+		if(c.ok && c.self_call && t != j->ret) {
+			j->ret = t;
+			c.ok = 0;
+			bjit_clear(j);
+		} else if(c.ok) {
+			j->ret = t;
+			ok = 0;
+
+			for(int i=0; i < c.nfixups; i++) {
+				int at = c.fixups[2*i];
+				int rel = c.labels[c.fixups[2*i+1]] - (at + 4);
+				memcpy(c.buf + at, &rel, 4);
+			}
+
+			// Write the code then make it executable
+			long page = sysconf(_SC_PAGESIZE);
+			size_t size = ((c.len + page-1) / page) * page;
+			void* mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+			if(mem != MAP_FAILED) {
+				memcpy(mem, c.buf, c.len);
+				if(mprotect(mem, size, PROT_READ | PROT_EXEC) == 0) {
+					*(void**)(&j->code) = mem;
+					j->size = size;
+				} else {
+					munmap(mem, size);
+				}
+			}
+		} else {
+			ok = 0;
+		}
+
+		free(c.buf); free(c.labels); free(c.fixups);
+	}
+
+	if(j->code) {
+		j->state = JIT_DONE;
+	} else {
+		bjit_clear(j);
+		j->state = JIT_FAILED;
+	}
+}
+
+// Check every guarded name still means the same in 'e'
+int jit_guards_pass(benv* e, bjit* j) {
+	if(!e->par && j->epoch == benv_epoch) return 1;
+
+	for(int i=0; i < j->nguards; i++) {
+		struct JitGuard* g = &j->guards[i];
+		bval* f = benv_lookup(e, g->name, NULL);
+		if(!f || f->type != BVAL_FUN || f->builtin != g->builtin) return 0;
+		if(!g->builtin && f->body != g->body) return 0;
+	}
+
+	// Only bindings of the root environment are known not to change without a new epoch
+	if(!e->par) j->epoch = benv_epoch;
+	return 1;
+}
+
+// Results the interpreter and the native code must agree on, with the same type
+int jit_same(bval* x, bval* y) {
+	if(x->type != y->type) return 0;
+	if(x->type == BVAL_NUM) {
+		if(isnan(x->num) && isnan(y->num)) return 1;
+		return x->num == y->num && signbit(x->num) == signbit(y->num);
+	}
+	return bval_eq(x, y);
+}
+
+bval* bval_call(benv* e, bval* f, bval* a);
+
+/**
+ * Called by bval_call for a lambda 'f' with as many arguments 'a' as formals.
+ * Returns NULL if the call must be evaluated by the interpreter
+ * */
+bval* jit_call(benv* e, bval* f, bval* a) {
+	bjit* j = f->jit;
+	if(a->count == 0) return NULL;
+
+	// The arguments must be all integers or all doubles
+	int mode = (a->cell[0]->type == BVAL_INT) ? JIT_INT : JIT_NUM;
+	bjit_value args[a->count];
+	for(int i=0; i < a->count; i++) {
+		bval* x = a->cell[i];
+		if(mode == JIT_INT && x->type == BVAL_INT) args[i].integer = x->integer;
+		else if(mode == JIT_NUM && x->type == BVAL_NUM) args[i].num = x->num;
+		else return NULL;
+	}
+
+	if(j->state == JIT_NONE && ++j->calls >= JIT_THRESHOLD) jit_compile(e, f, mode);
+	if(j->state != JIT_DONE || j->mode != mode) return NULL;
+
+	if(!jit_guards_pass(e, j)) return NULL;
+
+	bjit_value out;
+	if(j->code(args, &out)) return NULL;
+
+	bval* x = (j->ret == JIT_INT) ? bval_int(out.integer) : bval_num(out.num);
+	if(jit_verify) {
+		// Same call by the interpreter alone
+		jit_enabled = 0;
+		bval* y = bval_call(e, f, bval_copy(a));
+		jit_enabled = 1;
+
+		if(!jit_same(x, y)) {
+			printf("jit: got ");
+			bval_print(x);
+			printf(" expected ");
+			bval_print(y);
+			printf(" for ");
+			bval_println(a);
+
+			bval_del(x);
+			x = y;
+		} else {
+			bval_del(y);
+		}
+	}
+
+	bval_del(a);
+	return x;
+}
+
+#endif
+
+// Switch the JIT on or off, returns if it was on
+bval* builtin_jit(benv* e, bval* a) {
+	BASSERT_NUM("jit", a, 1);
+	BASSERT_NUMBER("jit", a, 0);
+
+	bval* x = bval_int(jit_enabled);
+	jit_enabled = bval_val(a->cell[0]);
+
+	bval_del(a);
+	return x;
+}
+
+
+
+
+/**
+ * For each builtin we want to create a function lval and
+ * symbol lval with the given name. We then register these
+ * with the environment using benv_put.
+ * The environment always takes or returns copies
+ * of a values, so we need to remember to delete these
+ * two lval after registration as we won't need them any more.
+ * */
+void benv_add_builtin(benv* e, char* name, bbuiltin func) {
+	bval* k = bval_sym(name);
+	bval* v = bval_fun(func);
+	benv_put(e, k, v);
+	bval_del(k); bval_del(v);
+}
+
+// Same as above for a builtin that also has a fast path
+void benv_add_fast(benv* e, char* name, bbuiltin func, bfast fast) {
+	bval* k = bval_sym(name);
+	bval* v = bval_fun(func);
+	v->fast = fast;
+	benv_put(e, k, v);
+	bval_del(k); bval_del(v);
+}
+
+/**
+ * Same as above for a special form, which the evaluator calls with
+ * the arguments as written instead of evaluating them first.
+ * 'func' is still used when the builtin is called some other way,
+ * e.g. passed to another function, with already evaluated arguments
+ * */
+void benv_add_special(benv* e, char* name, bbuiltin func, bfast special) {
+	bval* k = bval_sym(name);
+	bval* v = bval_fun(func);
+	v->special = special;
+	benv_put(e, k, v);
+	bval_del(k); bval_del(v);
+}
+
+void benv_add_builtins(benv* e) {
+	// Variable functions
+	benv_add_builtin(e, "def", builtin_def);
+	benv_add_builtin(e, "\\", builtin_lambda);
+	benv_add_builtin(e, "=",   builtin_put);
+	benv_add_special(e, "let", builtin_let, builtin_let_special);
+
+	// Comparasion Functions
+	benv_add_special(e, "if", builtin_if, builtin_if_special);
+	benv_add_fast(e, "==", builtin_eq, builtin_eq_fast);
+	benv_add_fast(e, "!=", builtin_ne, builtin_ne_fast);
+	benv_add_fast(e, ">",  builtin_gt, builtin_gt_fast);
+	benv_add_fast(e, "<",  builtin_lt, builtin_lt_fast);
+	benv_add_fast(e, ">=", builtin_ge, builtin_ge_fast);
+	benv_add_fast(e, "<=", builtin_le, builtin_le_fast);
+
+	// Logical Operators
+	benv_add_special(e, "&&", builtin_and, builtin_and_special);
+	benv_add_special(e, "||", builtin_or, builtin_or_special);
+
+	// String functions
+	benv_add_builtin(e, "require", builtin_req);
+	benv_add_builtin(e, "error", builtin_error);
+	benv_add_special(e, "try", builtin_try, builtin_try_special);
+	benv_add_builtin(e, "print", builtin_print);
+	benv_add_fast(e, "str-len", builtin_str_len, builtin_str_len_fast);
+	benv_add_fast(e, "concat", builtin_concat, builtin_concat_fast);
+	benv_add_fast(e, "substr", builtin_substr, builtin_substr_fast);
+	benv_add_fast(e, "index-of", builtin_index_of, builtin_index_of_fast);
+	benv_add_fast(e, "split", builtin_split, builtin_split_fast);
+	benv_add_fast(e, "replace", builtin_replace, builtin_replace_fast);
+	benv_add_fast(e, "upper", builtin_upper, builtin_upper_fast);
+	benv_add_fast(e, "lower", builtin_lower, builtin_lower_fast);
+	benv_add_fast(e, "str->num", builtin_str_num, builtin_str_num_fast);
+	benv_add_fast(e, "num->str", builtin_num_str, builtin_num_str_fast);
+	benv_add_fast(e, "builder", builtin_builder, builtin_builder_fast);
+	benv_add_fast(e, "append", builtin_append, builtin_append_fast);
+	benv_add_fast(e, "build", builtin_build, builtin_build_fast);
+
+
+	// Memoization Functions
+	benv_add_builtin(e, "memo", builtin_memo);
+	benv_add_builtin(e, "memo-stats", builtin_memo_stats);
+	benv_add_builtin(e, "memo-clear", builtin_memo_clear);
+
+	// Lazy functions
+	benv_add_builtin(e, "delay", builtin_delay);
+	benv_add_builtin(e, "force", builtin_force);
+	benv_add_builtin(e, "lazy-cons", builtin_lazy_cons);
+	benv_add_builtin(e, "take", builtin_take);
+	benv_add_fast(e, "range", builtin_range, builtin_range_fast);
+	benv_add_fast(e, "range->list", builtin_range_list, builtin_range_list_fast);
+	benv_add_builtin(e, "jit", builtin_jit);
+
+	// Generators
+	benv_add_builtin(e, "gen", builtin_gen);
+	benv_add_builtin(e, "yield", builtin_yield);
+	benv_add_builtin(e, "resume", builtin_resume);
+
+	// Loop Functions
+	benv_add_fast(e, "while", builtin_while, builtin_while_fast);
+	benv_add_fast(e, "do-times", builtin_do_times, builtin_do_times_fast);
+	benv_add_fast(e, "for", builtin_for, builtin_for_fast);
+	benv_add_fast(e, "do", builtin_do, builtin_do_fast);
+
+	bval* k = bval_sym("break");
+	bval* v = bval_break();
+	benv_put(e, k, v);
+	bval_del(k); bval_del(v);
+
+	// List Functions
+	benv_add_builtin(e, "list", builtin_list);
+	benv_add_fast(e, "head", builtin_head, builtin_head_fast);
+	benv_add_fast(e, "tail", builtin_tail, builtin_tail_fast);
+	benv_add_special(e, "eval", builtin_eval, builtin_eval_special);
+	benv_add_builtin(e, "join", builtin_join);
+	benv_add_fast(e, "len", builtin_len, builtin_len_fast);
+	benv_add_builtin(e, "cons", builtin_cons);
+	benv_add_builtin(e, "env", builtin_env);
+
+	// Higher Order Functions
+	benv_add_fast(e, "map", builtin_map, builtin_map_fast);
+	benv_add_fast(e, "filter", builtin_filter, builtin_filter_fast);
+	benv_add_fast(e, "foldl", builtin_foldl, builtin_foldl_fast);
+	benv_add_fast(e, "foldr", builtin_foldr, builtin_foldr_fast);
+	benv_add_fast(e, "reduce", builtin_reduce, builtin_reduce_fast);
+
+	// Vector Functions
+	benv_add_fast(e, "vec", builtin_vec, builtin_vec_fast);
+	benv_add_fast(e, "vec-range", builtin_vec_range, builtin_vec_range_fast);
+	benv_add_fast(e, "vec->list", builtin_vec_list, builtin_vec_list_fast);
+	benv_add_fast(e, "sum", builtin_sum, builtin_sum_fast);
+	benv_add_fast(e, "dot", builtin_dot, builtin_dot_fast);
+
+	// Dictionary Functions
+	benv_add_fast(e, "dict", builtin_dict, builtin_dict_fast);
+	benv_add_fast(e, "get", builtin_get, builtin_get_fast);
+	benv_add_fast(e, "set", builtin_set, builtin_set_fast);
+	benv_add_fast(e, "has", builtin_has, builtin_has_fast);
+	benv_add_fast(e, "del", builtin_del, builtin_del_fast);
+	benv_add_fast(e, "keys", builtin_keys, builtin_keys_fast);
+	benv_add_fast(e, "vals", builtin_vals, builtin_vals_fast);
+
+	// Sort Functions
+	benv_add_fast(e, "sort", builtin_sort, builtin_sort_fast);
+	benv_add_fast(e, "sort-by", builtin_sort_by, builtin_sort_by_fast);
+
+	// Regex Functions
+	benv_add_fast(e, "re-match", builtin_re_match, builtin_re_match_fast);
+	benv_add_fast(e, "re-find-all", builtin_re_find_all, builtin_re_find_all_fast);
+	benv_add_fast(e, "re-replace", builtin_re_replace, builtin_re_replace_fast);
+	benv_add_fast(e, "re-dfa", builtin_re_dfa, builtin_re_dfa_fast);
+
+	// Mathematical Functions
+	benv_add_fast(e, "+", builtin_add, builtin_add_fast);
+	benv_add_fast(e, "add", builtin_add, builtin_add_fast);
+
+	benv_add_fast(e, "-", builtin_sub, builtin_sub_fast);
+	benv_add_fast(e, "sub", builtin_sub, builtin_sub_fast);
+
+	benv_add_fast(e, "*", builtin_mul, builtin_mul_fast);
+	benv_add_fast(e, "mul", builtin_mul, builtin_mul_fast);
+
+	benv_add_fast(e, "/", builtin_div, builtin_div_fast);
+	benv_add_fast(e, "div", builtin_div, builtin_div_fast);
+
+	benv_add_fast(e, "%", builtin_res, builtin_res_fast);
+	benv_add_fast(e, "res", builtin_res, builtin_res_fast);
+
+	benv_add_fast(e, "^", builtin_pow, builtin_pow_fast);
+	benv_add_fast(e, "pow", builtin_pow, builtin_pow_fast);
+
+
+	benv_add_fast(e, "min", builtin_min, builtin_min_fast);
+	benv_add_fast(e, "max", builtin_max, builtin_max_fast);
+
+}
+
+/**
+ * First it checks the passed in arguments against the formals.
+ * If there are enough it binds them in a new environment (the frame)
+ * whose parent is the evaluation environment, and evaluates the body there.
+ * Otherwise returns a partial function holding the arguments given,
+ * without copying the function's body.
+ * Formals like {x & rest} take the remaining arguments as a Q-Expression
+ * */
+bval* bval_call(benv* e, bval* f, bval* a) {
+	// If partial call the function with the arguments bound before the given ones
+	if(f->type == BVAL_PART) {
+		bval* args = bval_sexpr();
+		args->count = f->count + a->count;
+		args->cell  = malloc(sizeof(bval*) * args->count);
+
+		for(int i=0; i<f->count; i++)
+			args->cell[i] = bval_copy(f->cell[i]);
+		memcpy(args->cell + f->count, a->cell, sizeof(bval*) * a->count);
+
+		free(a->cell); free(a);
+		return bval_call(e, f->fn, args);
+	}
+
+	if(f->type == BVAL_MEMO)
+		return bmemo_call(e, f->memo, a);
+
+	// If builtin then simply apply that
+	if(f->builtin)
+		return f->builtin(e, a);
+
+	bval* formals = f->formals;
+
+	// Record argument counts
+	int given = a->count;
+	int total = formals->count;
+
+	// Find '&', formals before it are required
+	int rest = -1;
+	for(int i=0; i<total; i++) {
+		if(strcmp(formals->cell[i]->sym, "&")==0) {
+			rest = i;
+			break;
+		}
+	}
+
+	// Check to ensure that & is not passed invadily
+	if(rest != -1 && rest != total-2) {
+		bval_del(a);
+		return bval_err("Function format invalid. "
+			"Symbol '&' not followed by single symbol");
+	}
+
+	int required = (rest == -1) ? total : rest;
+
+	if(rest == -1 && given > total) {
+		bval_del(a);
+		return bval_err(
+			"Function passed too many arguments. "
+			"Got %i, Expected %i.", given, total);
+	}
+
+	// Not all formals given, return partially evaluated function
+	if(given < required)
+		return bval_part(bval_copy(f), a);
+
+#ifdef ALTBAT_JIT
+	// Numeric functions called often run as native code (see jit_call), which counts its own steps
+	if(jit_enabled && rest == -1) {
+		bval* x = jit_call(e, f, a);
+		if(x) return x;
+	}
+#endif
+
+	bval* limit = EVAL_TICK();
+	if(limit) {
+		bval_del(a);
+		return limit;
+	}
+
+	benv* frame = benv_new();
+	frame->par = e;
+
+	// Bind a copy of each argument into the frame
+	for(int i=0; i<required; i++)
+		benv_put(frame, formals->cell[i], a->cell[i]);
+
+	// Remaining arguments go into the symbol after '&'
+	if(rest != -1) {
+		bval* list = bval_qexpr();
+		for(int i=required; i<given; i++) {
+			list = bval_add(list, a->cell[i]);
+			a->cell[i] = NULL;
+		}
+		benv_put(frame, formals->cell[rest+1], list);
+		bval_del(list);
+	}
+
+	// Argument list is now bound so can be cleaned up
+	bval_del_args(a);
+
+	// Evaluate the body as if builtin_eval was called on it, without copying it
+	bval* x = bval_eval_list(frame, f->body);
+	benv_del(frame);
+	return x;
+}
+
+
+// Define struct of methods
+struct BuiltinMethods {
+	char* name;
+	bval* (*func)(benv*, bval*);
+} bultin_map[] = {
+	{ "list",  builtin_list },
+	{ "head",  builtin_head },
+	{ "tail",  builtin_tail },
+	{ "join",  builtin_join },
+	{ "eval",  builtin_eval },
+	{ "len",   builtin_len  },
+	{ "cons",  builtin_cons }
+	// { "+-/*", builtin_op }
+};
+
+bval* builtin(benv* e, bval* a, char* func) {
+	int num_methods = sizeof(bultin_map) / sizeof(bultin_map[0]); // Find array lenght
+
+	// Get operator index
+	// bval* builtin;
+	for(int i=0; i<num_methods; i++) {
+		if(strcmp(func, bultin_map[i].name)==0)
+			return bultin_map[i].func(e, a);
+		else if(strstr("+-*/%^ \
+						add sub mul div res pow min max", func))
+			return builtin_op(e, a, func);
+	}
+
+	bval_del(a);
+	return bval_err("Unknown Function!");
+}
+
+
+/**
+ * Calls to builtins with a fast path skip copying the function out of
+ * the environment, and the arguments are passed as the cells of the
+ * S-Expression instead of being popped into a new one
+ * */
+bval* bval_eval_fast(benv* e, bfast fast, bval* v) {
+	// Evaluate arguments, the symbol of the function is left as is
+	for(int i=1; i < v->count; i++) {
+		v->cell[i] = bval_eval(e, v->cell[i]);
+
+		// Stop at the first error, cells after it are deleted without being evaluated
+		if(v->cell[i]->type == BVAL_ERR) return bval_take(v, i);
+	}
+
+	bval* x = fast(e, v->count-1, v->cell+1);
+	bval_del_args(v);
+	return x;
+}
+
+// Special forms get the arguments as they are, they evaluate what they need
+bval* bval_eval_special(benv* e, bfast special, bval* v) {
+	bval* x = special(e, v->count-1, v->cell+1);
+	bval_del_args(v);
+	return x;
+}
+
+// Calls an S-Expression whose cells are already evaluated and are not errors
+bval* bval_apply(benv* e, bval* v) {
+	// Empty Expression
+	if(v->count == 0) return v;
+
+	// Single Expression
+	if(v->count == 1) return bval_take(v, 0);
+
+	// Builtins with a fast path take the arguments where they are
+	bval* f = v->cell[0];
+	if(f->type == BVAL_FUN && f->fast) {
+		bval* x = f->fast(e, v->count-1, v->cell+1);
+		bval_del_args(v);
+		return x;
+	}
+
+	// Ensure First Element is a function after evaluation
+	f = bval_pop(v, 0);
+	if(!bval_callable(f)) {
+		bval* err = bval_err(
+			"S-Expression starts with incorrect type "
+			"Got %s, Expected %s",
+			btype_name(f->type), btype_name(BVAL_FUN));
+
+		bval_del(v); bval_del(f);
+		return err;
+	}
+
+	// If so call function to get result
+	bval* result = bval_call(e, f, v);
+	bval_del(f);
+	return result;
+}
+
+// Same as bval_apply for cells that may be errors, like the ones compiled code evaluates
+bval* bval_eval_call(benv* e, bval* v) {
+	for(int i=0; i < v->count; i++) {
+		if(v->cell[i]->type == BVAL_ERR) return bval_take(v, i);
+	}
+	return bval_apply(e, v);
+}
+
+bval* bval_eval_sexpr(benv* e, bval* v) {
+	// Call special forms and builtins with a fast path directly
+	if(v->count > 1 && v->cell[0]->type == BVAL_SYM) {
+		bval* f = benv_lookup(e, v->cell[0]->sym, NULL);
+		if(f && f->type == BVAL_FUN && f->special)
+			return bval_eval_special(e, f->special, v);
+		if(f && f->type == BVAL_FUN && f->fast)
+			return bval_eval_fast(e, f->fast, v);
+	}
+
+	// Evaluate Children, stopping at the first error
+	for(int i=0; i < v->count; i++) {
+		v->cell[i] = bval_eval(e, v->cell[i]);
+		if(v->cell[i]->type == BVAL_ERR) return bval_take(v, i);
+	}
+
+	return bval_apply(e, v);
+}
+
+bval* bval_eval_guard(benv* e, bval* v);
+bval* bval_eval(benv* e, bval* v) {
+	// Evaluate Sexpressions
+	if(v->type == BVAL_SYM) {
+		bval* x = benv_get(e, v);
+		bval_del(v);
+		return x;
+	}
+	if(v->type == BVAL_SEXPR) return bval_eval_sexpr(e, v);
+	if(v->type == BVAL_GUARD) return bval_eval_guard(e, v);
+	return v;
+
+	// All other bval types ramin the same
+
+}
+
+/**
+ * Same as bval_eval but 'v' is left as it is, so it can be
+ * evaluated again (e.g. a loop body). Only the values that
+ * end up in the result are copied
+ * */
+int opt_guard_valid(benv* e, bval* g);
+bval* bval_eval_keep(benv* e, bval* v) {
+	if(v->type == BVAL_SYM) return benv_get(e, v);
+	if(v->type == BVAL_SEXPR) return bval_eval_list(e, v);
+	if(v->type == BVAL_GUARD)
+		return bval_eval_keep(e, opt_guard_valid(e, v) ? v->inlined : v->fallback);
+	return bval_copy(v);
+}
+
+// Evaluates the cells of 'v' as a S-Expression, even if it is a Q-Expression
+bval* bval_eval_list(benv* e, bval* v) {
+	if(v->count == 0) return bval_sexpr();
+
+	// Special forms take their arguments unevaluated and leave them as they are
+	if(v->count > 1 && v->cell[0]->type == BVAL_SYM) {
+		bval* f = benv_lookup(e, v->cell[0]->sym, NULL);
+		if(f && f->type == BVAL_FUN && f->special)
+			return f->special(e, v->count-1, v->cell+1);
+
+		// Builtins with a fast path are called without copying them out of the environment
+		if(f && f->type == BVAL_FUN && f->fast) {
+			bfast fast = f->fast;
+
+			bval* a = bval_sexpr();
+			a->count = v->count-1;
+			a->cell  = malloc(sizeof(bval*) * a->count);
+			for(int i=0; i < a->count; i++) {
+				a->cell[i] = bval_eval_keep(e, v->cell[i+1]);
+				if(a->cell[i]->type == BVAL_ERR) {
+					a->count = i+1;
+					return bval_take(a, i);
+				}
+			}
+
+			bval* x = fast(e, a->count, a->cell);
+			bval_del_args(a);
+			return x;
+		}
+	}
+
+	bval* x = bval_sexpr();
+	x->count = v->count;
+	x->cell  = malloc(sizeof(bval*) * x->count);
+
+	for(int i=0; i < v->count; i++) {
+		x->cell[i] = bval_eval_keep(e, v->cell[i]);
+
+		// Stop at the first error, cells after it are not evaluated
+		if(x->cell[i]->type == BVAL_ERR) {
+			x->count = i+1;
+			return bval_take(x, i);
+		}
+	}
+
+	return bval_apply(e, x);
+}
+
+
+
+
+/*************************/
+/* READ                  */
+/*************************/
+
+// Numbers without a '.' are integers, unless they don't fit in 64 bits
+bval* bval_read_num(mpc_ast_t* t) {
+	errno = 0;
+	if(!strchr(t->contents, '.')) {
+		long long n = strtoll(t->contents, NULL, 10);
+		if(errno != ERANGE) return bval_int(n);
+		errno = 0;
+	}
+
+	double x = strtod(t->contents, NULL);
+	return (errno != ERANGE) ? bval_num(x)
+		: bval_err("Error: Invalid Number!");
+}
+
+bval* bval_read_str(mpc_ast_t* t) {
+	// Cut off the final quote character
+	t->contents[strlen(t->contents)-1] = '\0';
+
+	// Copy the string missing out the first quote character
+	char* unescaped = malloc(strlen(t->contents+1)+1);
+	strcpy(unescaped, t->contents+1);
+
+	// Pass through the unescaped function
+	unescaped = mpcf_unescape(unescaped);
+	bval* str = bval_str(unescaped);
+
+	// Free the string and return
+	free(unescaped);
+	return str;
+}
+
+bval* bval_read(mpc_ast_t* t) {
+	// If Symbol or Number return conversion to that type
+	if(strstr(t->tag, "number")) return bval_read_num(t);
+	if(strstr(t->tag, "symbol")) return bval_sym(t->contents);
+
+	if(strstr(t->tag, "string")) return bval_read_str(t);
+
+	// If root (>) or sexpr then create empty list
+	bval* x = NULL;
+	if(strcmp(t->tag, ">")==0) x = bval_sexpr();
+	if(strstr(t->tag, "sexpr")) x = bval_sexpr();
+	if(strstr(t->tag, "qexpr")) x = bval_qexpr();
+
+	// Fill this list with any valid expression contained within
+	for(int i=0; i < t->children_num; i++) {
+		if(strcmp(t->children[i]->contents, "(")==0
+			|| strcmp(t->children[i]->contents, ")")==0
+			|| strcmp(t->children[i]->contents, "{")==0
+			|| strcmp(t->children[i]->contents, "}")==0
+			|| strcmp(t->children[i]->tag, "regex")==0
+			|| strstr(t->children[i]->tag, "comment")) continue;
+
+		x = bval_add(x, bval_read(t->children[i]));
+	}
+
+	return x;
+}
+
+
+
+
+/*************************/
+/* OPTIMIZE              */
+/*************************/
+
+/**
+ * The optimizer runs over the tree given by bval_read just before
+ * it is evaluated. It folds calls to pure builtins (arithmetic,
+ * comparison and logic) whose arguments are all literals, so that
+ * something like (* 60 60 24) inside a function body is computed
+ * once when the code is loaded instead of on every call.
+ *
+ * Folding only happens while the builtin name is still bound to the
+ * original builtin, and never for an expression that rebinds one of
+ * these names itself (as a lambda formal, 'def' or '=').
+ * A lambda body runs later, when the name may have been redefined or
+ * bound by the formal of a caller, so a fold in one is wrapped in a
+ * guard (BVAL_GUARD, see opt_inline) on each builtin it used, keeping
+ * the original call to evaluate when one of them is no longer bound.
+ * */
+int opt_enabled = 1; // -O0 disables the optimizer
+int opt_dump    = 0; // --dump-opt prints the optimized form
+int opt_body    = 0; // Lambda bodies being walked, folds in them are guarded
+
+struct FoldEntry {
+	char* name;
+	bbuiltin func;
+	int strings; // Also accepts String literals
+} fold_map[] = {
+	{ "+",   builtin_add, 0 },
+	{ "add", builtin_add, 0 },
+	{ "-",   builtin_sub, 0 },
+	{ "sub", builtin_sub, 0 },
+	{ "*",   builtin_mul, 0 },
+	{ "mul", builtin_mul, 0 },
+	{ "/",   builtin_div, 0 },
+	{ "div", builtin_div, 0 },
+	{ "%",   builtin_res, 0 },
+	{ "res", builtin_res, 0 },
+	{ "^",   builtin_pow, 0 },
+	{ "pow", builtin_pow, 0 },
+	{ "min", builtin_min, 0 },
+	{ "max", builtin_max, 0 },
+	{ ">",   builtin_gt,  0 },
+	{ "<",   builtin_lt,  0 },
+	{ ">=",  builtin_ge,  0 },
+	{ "<=",  builtin_le,  0 },
+	{ "==",  builtin_eq,  1 },
+	{ "!=",  builtin_ne,  1 },
+	{ "&&",  builtin_and, 0 },
+	{ "||",  builtin_or,  0 }
+};
+
+struct FoldEntry* fold_find(char* name) {
+	int num_folds = sizeof(fold_map) / sizeof(fold_map[0]); // Find array lenght
+	for(int i=0; i<num_folds; i++) {
+		if(strcmp(name, fold_map[i].name)==0)
+			return &fold_map[i];
+	}
+	return NULL;
+}
+
+// Check if symbol 'name' is still bound to 'func' in the environment
+int opt_bound_to(benv* e, char* name, bbuiltin func) {
+	bval* k = bval_sym(name);
+	bval* v = benv_get(e, k);
+	int r = (v->type == BVAL_FUN && v->builtin == func);
+	bval_del(k); bval_del(v);
+	return r;
+}
+
+/**
+ * Symbols bound anywhere in the expression being optimized,
+ * collected before the tree is changed
+ * */
+bval* opt_bound = NULL;
+
+// Collect symbols bound by (\ {syms} ...), (def {syms} ...) and (= {syms} ...)
+void opt_collect(bval* v, bval* out) {
+	if(v->type != BVAL_SEXPR && v->type != BVAL_QEXPR) return;
+
+	if(v->count >= 2
+		&& v->cell[0]->type == BVAL_SYM && v->cell[1]->type == BVAL_QEXPR
+		&& (strcmp(v->cell[0]->sym, "\\")==0
+			|| strcmp(v->cell[0]->sym, "def")==0
+			|| strcmp(v->cell[0]->sym, "=")==0)) {
+
+		bval* syms = v->cell[1];
+		for(int i=0; i<syms->count; i++) {
+			if(syms->cell[i]->type == BVAL_SYM)
+				bval_add(out, bval_copy(syms->cell[i]));
+		}
+	}
+
+	for(int i=0; i<v->count; i++)
+		opt_collect(v->cell[i], out);
+}
+
+// Check if the expression being optimized binds 'name'
+int opt_binds(char* name) {
+	for(int i=0; i<opt_bound->count; i++) {
+		if(strcmp(opt_bound->cell[i]->sym, name)==0) return 1;
+	}
+	return 0;
+}
+
+int opt_site(char* name, bval* func);
+bval* bval_guard(int site, bval* inlined, bval* fallback);
+
+// Literal an argument stands for, itself or the value of a guarded fold
+bval* opt_literal(bval* v) {
+	return (v->type == BVAL_GUARD) ? v->inlined : v;
+}
+
+// Fold 'v' if it is a call to a pure builtin with only literal arguments
+bval* opt_fold(benv* e, bval* v) {
+	if(v->count < 2 || v->cell[0]->type != BVAL_SYM) return v;
+
+	struct FoldEntry* f = fold_find(v->cell[0]->sym);
+	if(!f) return v;
+
+	for(int i=1; i<v->count; i++) {
+		int t = opt_literal(v->cell[i])->type;
+		if(t != BVAL_NUM && t != BVAL_INT && !(f->strings && t == BVAL_STR)) return v;
+	}
+
+	if(opt_binds(f->name) || !opt_bound_to(e, f->name, f->func)) return v;
+
+	// Apply the builtin to a copy of the arguments
+	bval* a = bval_sexpr();
+	for(int i=1; i<v->count; i++) a = bval_add(a, bval_copy(opt_literal(v->cell[i])));
+	bval* r = f->func(e, a);
+
+	// Errors (e.g. Division by Zero) are left to be raised at runtime
+	if(!bval_is_num(r)) {
+		bval_del(r);
+		return v;
+	}
+
+	if(!opt_body) {
+		bval_del(v);
+		return r;
+	}
+
+	/**
+	 * Guarded on this builtin and on the ones folded into the arguments,
+	 * each site once. Every guard falls back to the call as written, so
+	 * the arguments are put back as they were written too, otherwise
+	 * every level of nested folds would double the size of the tree
+	 * */
+	r = bval_guard(opt_site(f->name, benv_lookup(e, f->name, NULL)), r, NULL);
+	for(int i=1; i<v->count; i++) {
+		bval* c = v->cell[i];
+		if(c->type != BVAL_GUARD) continue;
+
+		for(bval* g = c; g->type == BVAL_GUARD; g = g->inlined) {
+			int found = 0;
+			for(bval* h = r; h->type == BVAL_GUARD && !found; h = h->inlined)
+				found = h->site == g->site;
+			if(!found) r = bval_guard(g->site, r, NULL);
+		}
+
+		v->cell[i] = c->fallback;
+		c->fallback = bval_sexpr();
+		bval_del(c);
+	}
+
+	for(bval* g = r; g->type == BVAL_GUARD; g = g->inlined)
+		g->fallback = (g == r) ? v : bval_copy(v);
+	return r;
+}
+
+// Check if the list is a call to 'name' that is still the builtin 'func'
+int opt_is_call(benv* e, bval* v, char* name, bbuiltin func) {
+	return v->count > 0
+		&& v->cell[0]->type == BVAL_SYM
+		&& strcmp(v->cell[0]->sym, name)==0
+		&& !opt_binds(name)
+		&& opt_bound_to(e, name, func);
+}
+
+
+/**
+ * Small lambdas are inlined into their callers, so (inc y) with
+ * (def {inc} (\ {x} {+ x 1})) becomes (+ y 1) and the call no longer
+ * binds arguments, builds a frame or copies the body.
+ *
+ * Since 'inc' can be redefined later, the inlined call is wrapped in a
+ * guard (BVAL_GUARD) that keeps the original call. When evaluated, the
+ * guard checks 'inc' is still bound to the same lambda and otherwise
+ * evaluates the original call instead.
+ * */
+#define OPT_INLINE_MAX 16 // Maximum number of nodes in an inlined body
+
+// A function that had calls inlined, shared by all guards on it
+struct InlineSite {
+	char* name;
+	bval* func;  // Copy of the lambda that was inlined
+	bval* cache; // Last binding found equal to 'func' on the global environment
+	long epoch;  // benv_epoch when 'cache' was checked
+} *inline_sites = NULL;
+int inline_count = 0;
+
+int opt_site(char* name, bval* func) {
+	for(int i=0; i<inline_count; i++) {
+		if(strcmp(inline_sites[i].name, name)==0
+			&& bval_eq(inline_sites[i].func, func))
+			return i;
+	}
+
+	inline_count++;
+	inline_sites = realloc(inline_sites, sizeof(struct InlineSite) * inline_count);
+
+	struct InlineSite* s = &inline_sites[inline_count-1];
+	s->name  = malloc(strlen(name) + 1);
+	strcpy(s->name, name);
+	s->func  = bval_copy(func);
+	s->cache = NULL;
+	s->epoch = -1;
+	return inline_count-1;
+}
+
+// Number of nodes in a tree
+int opt_size(bval* v) {
+	if(v->type == BVAL_GUARD) return opt_size(v->inlined);
+	if(v->type != BVAL_SEXPR && v->type != BVAL_QEXPR) return 1;
+
+	int n = 1;
+	for(int i=0; i<v->count; i++)
+		n += opt_size(v->cell[i]);
+	return n;
+}
+
+// Number of times 'sym' appears in a tree
+int opt_uses(bval* v, char* sym) {
+	if(v->type == BVAL_SYM) return strcmp(v->sym, sym)==0;
+	if(v->type == BVAL_GUARD) return opt_uses(v->inlined, sym);
+	if(v->type != BVAL_SEXPR && v->type != BVAL_QEXPR) return 0;
+
+	int n = 0;
+	for(int i=0; i<v->count; i++)
+		n += opt_uses(v->cell[i], sym);
+	return n;
+}
+
+// Check if 'name' is bound to a lambda, partial or memoized function
+int opt_is_lambda(benv* e, char* name) {
+	bval* f = benv_lookup(e, name, NULL);
+	if(!f) return 0;
+	return (f->type == BVAL_FUN) ? !f->builtin : f->type == BVAL_MEMO;
+}
+
+// Check if 'name' is one of the formals
+int opt_is_formal(bval* formals, char* name) {
+	for(int i=0; i<formals->count; i++) {
+		if(strcmp(formals->cell[i]->sym, name)==0) return 1;
+	}
+	return 0;
+}
+
+/**
+ * Scoping is dynamic, a lambda called from the body would see the
+ * function's frame as its parent, which is gone once inlined. So a
+ * body can only be inlined if all its calls are to builtins and none
+ * of its symbols name a lambda. It also can't define variables, build
+ * lambdas, print, or use Q-Expressions other than the branches of an 'if'
+ * */
+int opt_inlinable(benv* e, bval* v, bval* formals) {
+	if(v->type == BVAL_GUARD) return opt_inlinable(e, v->inlined, formals);
+	if(v->type == BVAL_SYM)
+		return opt_is_formal(formals, v->sym) || !opt_is_lambda(e, v->sym);
+	if(v->type != BVAL_SEXPR && v->type != BVAL_QEXPR) return 1;
+
+	int branch = 0;
+	if(v->count > 1) {
+		if(v->cell[0]->type != BVAL_SYM) return 0;
+
+		char* head = v->cell[0]->sym;
+		bval* f = benv_lookup(e, head, NULL);
+		if(opt_is_formal(formals, head) || opt_binds(head)
+			|| !f || f->type != BVAL_FUN || !f->builtin)
+			return 0;
+
+		if(strcmp(head, "def")==0 || strcmp(head, "=")==0
+			|| strcmp(head, "\\")==0 || strcmp(head, "eval")==0
+			|| strcmp(head, "env")==0 || strcmp(head, "require")==0
+			|| strcmp(head, "print")==0 || strcmp(head, "error")==0)
+			return 0;
+		branch = strcmp(head, "if")==0;
+	}
+
+	for(int i=0; i<v->count; i++) {
+		if(v->cell[i]->type == BVAL_QEXPR && !(branch && i >= 2)) return 0;
+		if(!opt_inlinable(e, v->cell[i], formals)) return 0;
+	}
+	return 1;
+}
+
+/**
+ * 1 if 'sym' is the first thing evaluated by 'v' that isn't a literal
+ * or the builtin being called, 0 if something else comes first and -1
+ * if 'v' evaluates nothing else
+ * */
+int opt_first(bval* v, char* sym) {
+	if(v->type == BVAL_SYM) return strcmp(v->sym, sym)==0;
+	if(v->type == BVAL_GUARD) return opt_first(v->inlined, sym);
+	if(v->type != BVAL_SEXPR && v->type != BVAL_QEXPR) return -1;
+
+	for(int i=(v->count > 1); i<v->count; i++) {
+		int r = opt_first(v->cell[i], sym);
+		if(r != -1) return r;
+	}
+	return -1;
+}
+
+// Copy of 'v' with each formal symbol replaced by its argument
+bval* opt_subst(bval* v, bval* formals, bval** args) {
+	if(v->type == BVAL_SYM) {
+		for(int i=0; i<formals->count; i++) {
+			if(strcmp(v->sym, formals->cell[i]->sym)==0)
+				return bval_copy(args[i]);
+		}
+	}
+
+	if(v->type == BVAL_GUARD)
+		return bval_guard(v->site,
+			opt_subst(v->inlined, formals, args),
+			opt_subst(v->fallback, formals, args));
+
+	if(v->type != BVAL_SEXPR && v->type != BVAL_QEXPR) return bval_copy(v);
+
+	bval* x = (v->type == BVAL_SEXPR) ? bval_sexpr() : bval_qexpr();
+	for(int i=0; i<v->count; i++)
+		x = bval_add(x, opt_subst(v->cell[i], formals, args));
+	return x;
+}
+
+// Inline 'v' if it is a call to a small non-recursive lambda
+bval* opt_inline(benv* e, bval* v) {
+	if(v->type != BVAL_SEXPR || v->count < 2
+		|| v->cell[0]->type != BVAL_SYM) return v;
+
+	char* name = v->cell[0]->sym;
+	if(opt_binds(name)) return v;
+
+	bval* f = benv_lookup(e, name, NULL);
+	if(!f || f->type != BVAL_FUN || f->builtin) return v;
+
+	// Only plain lambdas with exactly as many arguments as formals
+	bval* formals = f->formals;
+	if(formals->count != v->count-1) return v;
+	for(int i=0; i<formals->count; i++) {
+		if(strcmp(formals->cell[i]->sym, "&")==0) return v;
+	}
+
+	if(opt_size(f->body) > OPT_INLINE_MAX
+		|| opt_uses(f->body, name)
+		|| !opt_inlinable(e, f->body, formals)) return v;
+
+	/**
+	 * Arguments that aren't a literal or symbol are evaluated where the
+	 * formal is used, so these must be used exactly once, and at most
+	 * one of them, and be the first thing the body evaluates to keep
+	 * the number and order of evaluations.
+	 * Every formal must be used so unbound symbols still raise errors.
+	 * A use inside 'if', '&&' or '||' may be skipped, so bodies with
+	 * these only take simple arguments
+	 * */
+	int lazy = opt_uses(f->body, "if") || opt_uses(f->body, "&&") || opt_uses(f->body, "||");
+	int complex = 0;
+	for(int i=0; i<formals->count; i++) {
+		bval* arg = v->cell[i+1];
+		int uses = opt_uses(f->body, formals->cell[i]->sym);
+		if(uses == 0) return v;
+
+		// A lambda passed by name would be called without the function's frame
+		if(arg->type == BVAL_SYM && opt_is_lambda(e, arg->sym)) return v;
+
+		if(!bval_is_num(arg) && arg->type != BVAL_STR && arg->type != BVAL_SYM) {
+			if(uses != 1 || complex || lazy
+				|| opt_first(f->body, formals->cell[i]->sym) != 1) return v;
+			complex = 1;
+		}
+	}
+
+	// Evaluate body as if builtin_eval was called on it
+	bval* inlined = opt_subst(f->body, formals, v->cell+1);
+	inlined->type = BVAL_SEXPR;
+
+	return bval_guard(opt_site(name, f), inlined, v);
+}
+
+// Check the function inlined by a guard is still the one bound
+int opt_guard_valid(benv* e, bval* g) {
+	struct InlineSite* s = &inline_sites[g->site];
+
+	benv* owner;
+	bval* f = benv_lookup(e, s->name, &owner);
+	if(!f) return 0;
+
+	// Cached on the global environment and nothing was redefined since
+	if(f == s->cache && s->epoch == benv_epoch) return 1;
+
+	if(!bval_eq(f, s->func)) return 0;
+
+	// Only cache global bindings, local ones are freed with their frame
+	if(!owner->par) {
+		s->cache = f;
+		s->epoch = benv_epoch;
+	}
+	return 1;
+}
+
+bval* bval_eval_guard(benv* e, bval* v) {
+	bval* x;
+	if(opt_guard_valid(e, v)) {
+		x = v->inlined;
+		v->inlined = bval_sexpr();
+	} else {
+		x = v->fallback;
+		v->fallback = bval_sexpr();
+	}
+
+	bval_del(v);
+	return bval_eval(e, x);
+}
+
+bval* opt_walk(benv* e, bval* v) {
+	if(v->type != BVAL_SEXPR && v->type != BVAL_QEXPR) return v;
+
+	/**
+	 * Q-Expressions are data until something evaluates them, so only
+	 * the ones known to be code are walked: a lambda body
+	 * (\ {x} {* 60 60 24}) and the branches of (if c {...} {...})
+	 * */
+	int lambda = opt_is_call(e, v, "\\", builtin_lambda);
+	int branch = opt_is_call(e, v, "if", builtin_if);
+
+	for(int i=0; i<v->count; i++) {
+		bval* c = v->cell[i];
+
+		if(c->type == BVAL_SEXPR) {
+			c = opt_inline(e, opt_fold(e, opt_walk(e, c)));
+		}
+		else if(c->type == BVAL_QEXPR
+			&& ((lambda && i == 2) || (branch && i >= 2))) {
+			if(lambda) opt_body++;
+			c = opt_walk(e, c);
+			c->type = BVAL_SEXPR;
+			c = opt_inline(e, opt_fold(e, c));
+			if(lambda) opt_body--;
+
+			// Folded body becomes a single value Q-Expression
+			if(c->type == BVAL_SEXPR)
+				c->type = BVAL_QEXPR;
+			else
+				c = bval_add(bval_qexpr(), c);
+		}
+
+		v->cell[i] = c;
+	}
+
+	return v;
+}
+
+// Optimize an expression read from user input or a file
+bval* bval_opt(benv* e, bval* v) {
+	if(opt_enabled) {
+		opt_bound = bval_qexpr();
+		opt_collect(v, opt_bound);
+
+		v = opt_inline(e, opt_fold(e, opt_walk(e, v)));
+
+		bval_del(opt_bound);
+		opt_bound = NULL;
+	}
+
+	if(opt_dump) {
+		printf("// opt: ");
+		bval_println(v);
+	}
+	return v;
+}
+
+
 
 
-		bval_del(y);
-	}
+/*************************/
+/* COMPILE               */
+/*************************/
 
-	bval_del(a); return x;
-}
+/**
+ * altbat --emit-c script.abat translates a script to C that calls this
+ * runtime, writes it to script.c and builds it with the system compiler.
+ * The generated file includes main.c, so it is built together with the
+ * interpreter: as an executable (running the script instead of the
+ * prompt) or, if the output ends with '.so', as a shared object that
+ * 'require' loads. Both call aot_load, which builds the constants the
+ * code needs and runs each top level expression in order.
+ *
+ * Top level (def {f} (\ {args} {body})) becomes a C function that
+ * behaves like a builtin with a fast path. Calls to builtins, 'if',
+ * '&&' and '||' are compiled inline behind a check that the name is
+ * still bound to the same builtin, everything else (user functions,
+ * lambdas, loops, Q-Expressions as data) is evaluated by the
+ * interpreter from a constant copy of the expression.
+ *
+ * The compiler is $CC (cc by default) with extra flags from
+ * $ALTBAT_CFLAGS, both split at spaces, and is run without a shell.
+ * main.c is looked for in $ALTBAT_HOME or else the directory of the
+ * altbat executable
+ * */
 
-bval* builtin_add(benv* e, bval* a) {
-	return builtin_op(e, a, "+");
-}
+/**
+ * Runtime used by the generated code
+ * */
 
-bval* builtin_sub(benv* e, bval* a) {
-	return builtin_op(e, a, "-");
+// Checks 'sym' is still bound to the builtin 'b' was when the code was loaded
+int aot_is(benv* e, bval* sym, bval* b) {
+	bval* f = benv_lookup(e, sym->sym, NULL);
+	return b && b->builtin && f && f->type == BVAL_FUN
+		&& f->builtin == b->builtin;
 }
 
-bval* builtin_mul(benv* e, bval* a) {
-	return builtin_op(e, a, "*");
+// Checks 'sym' is bound to a special form, whose arguments must not be evaluated first
+int aot_special(benv* e, bval* sym) {
+	bval* f = benv_lookup(e, sym->sym, NULL);
+	return f && f->type == BVAL_FUN && f->special;
 }
 
-bval* builtin_div(benv* e, bval* a) {
-	return builtin_op(e, a, "/");
+// Builtin bound to 'name' when the code is loaded, NULL if not a builtin
+bval* aot_builtin(benv* e, char* name) {
+	bval* f = benv_lookup(e, name, NULL);
+	return (f && f->type == BVAL_FUN && f->builtin) ? bval_copy(f) : NULL;
 }
 
-bval* builtin_res(benv* e, bval* a) {
-	return builtin_op(e, a, "%");
+// Expression left to the interpreter
+bval* aot_eval(benv* e, bval* x) {
+	return bval_eval(e, bval_copy(x));
 }
 
-bval* builtin_pow(benv* e, bval* a) {
-	return builtin_op(e, a, "^");
+// Truth value of 'x' for && and ||, deletes it
+int aot_truth(bval* x) {
+	int t = bval_val(x);
+	bval_del(x);
+	return t;
 }
 
-bval* builtin_min(benv* e, bval* a) {
-	return builtin_op(e, a, "min");
+// Result of 'if' when the condition is not a number
+bval* aot_if_cond(bval* x) {
+	if(x->type == BVAL_ERR) return x;
+
+	bval* err = bval_err(
+		"Function '%s' Got %s type for argument %i, Expected %s.",
+		"if", btype_name(x->type), 0, btype_name(BVAL_NUM));
+	bval_del(x);
+	return err;
 }
 
-bval* builtin_max(benv* e, bval* a) {
-	return builtin_op(e, a, "max");
+// S-Expression of the evaluated cells 'argv', which it takes
+bval* aot_sexpr(int argc, bval** argv) {
+	bval* x = bval_sexpr();
+	x->count = argc;
+	x->cell  = malloc(sizeof(bval*) * argc);
+	memcpy(x->cell, argv, sizeof(bval*) * argc);
+	return x;
 }
 
+// Calls builtin 'b' on the evaluated arguments 'argv', which it takes
+bval* aot_call(benv* e, bval* b, int argc, bval** argv) {
+	bval* x = aot_sexpr(argc, argv);
+
+	for(int i=0; i < x->count; i++) {
+		if(x->cell[i]->type == BVAL_ERR) return bval_take(x, i);
+	}
+
+	if(b->fast) {
+		bval* r = b->fast(e, x->count, x->cell);
+		bval_del_args(x);
+		return r;
+	}
+	return b->builtin(e, x);
+}
 
 /**
- * For each builtin we want to create a function lval and
- * symbol lval with the given name. We then register these
- * with the environment using benv_put.
- * The environment always takes or returns copies
- * of a values, so we need to remember to delete these
- * two lval after registration as we won't need them any more.
+ * Checks the arguments of a compiled function 'self' with 'n' formals.
+ * Returns NULL if it can run, otherwise the result of the call:
+ * an error or a partial function. Counts as a step of the evaluation limits
  * */
-void benv_add_builtin(benv* e, char* name, bbuiltin func) {
-	bval* k = bval_sym(name);
-	bval* v = bval_fun(func);
-	benv_put(e, k, v);
-	bval_del(k); bval_del(v);
+bval* aot_args(bval* self, int n, int argc, bval** argv) {
+	bval* limit = EVAL_TICK();
+	if(limit) return limit;
+
+	if(argc > n) {
+		return bval_err(
+			"Function passed too many arguments. "
+			"Got %i, Expected %i.", argc, n);
+	}
+	if(argc == n) return NULL;
+
+	bval* a = bval_sexpr();
+	for(int i=0; i<argc; i++) {
+		a = bval_add(a, argv[i]);
+		argv[i] = NULL;
+	}
+	return bval_part(bval_copy(self), a);
 }
 
-void benv_add_builtins(benv* e) {
-	// Variable functions
-	benv_add_builtin(e, "def", builtin_def);
-	benv_add_builtin(e, "\\", builtin_lambda);
-	benv_add_builtin(e, "=",   builtin_put);
+// Frame of a compiled function, binds (taking) argv to the formals in order
+benv* aot_frame(benv* c, int n, bval** formals, bval** argv) {
+	benv* e = benv_new();
+	e->par   = c;
+	e->count = n;
+	e->syms  = malloc(sizeof(char*) * n);
+	e->vals  = malloc(sizeof(bval*) * n);
+
+	for(int i=0; i<n; i++) {
+		e->syms[i] = malloc(strlen(formals[i]->sym)+1);
+		strcpy(e->syms[i], formals[i]->sym);
+		e->vals[i] = argv[i];
+		argv[i] = NULL;
+	}
+	return e;
+}
 
-	// Comparasion Functions
-	benv_add_builtin(e, "if", builtin_if);
-	benv_add_builtin(e, "==", builtin_eq);
-	benv_add_builtin(e, "!=", builtin_ne);
-	benv_add_builtin(e, ">",  builtin_gt);
-	benv_add_builtin(e, "<",  builtin_lt);
-	benv_add_builtin(e, ">=", builtin_ge);
-	benv_add_builtin(e, "<=", builtin_le);
+// Defines 'name' globally as a compiled function and returns its value
+bval* aot_def(benv* e, bval* name, bbuiltin func, bfast fast) {
+	bval* f = bval_fun(func);
+	f->fast = fast;
+	benv_def(e, name, f);
+	return f;
+}
 
-	// Logical Operators
-	benv_add_builtin(e, "&&", builtin_and);
-	benv_add_builtin(e, "||", builtin_or);
+// Runs a top level expression like 'require' does
+void aot_top(bval* x) {
+	if(x->type == BVAL_ERR) bval_println(x);
+	bval_del(x);
+}
 
-	// String functions
-	benv_add_builtin(e, "require", builtin_req);
-	benv_add_builtin(e, "error", builtin_error);
-	benv_add_builtin(e, "print", builtin_print);
 
+/**
+ * Code generation
+ * */
+typedef struct baot baot;
+struct baot {
+	benv* e;       // Environment with the builtins, to know what names mean
+	FILE* code;    // Functions
+	FILE* init;    // Statements of aot_load building the constants
+	int consts;    // Used entries of K, the constant bvals
+	int builtins;  // Used entries of B, the builtins checked against
+	int funs;      // Compiled functions, their values are in F
+	int temps;     // Temporary variables in generated code
+	int depth;     // Indentation
+	bval* formals; // Formals of the function being compiled or NULL
+};
 
-	// List Functions
-	benv_add_builtin(e, "list", builtin_list);
-	benv_add_builtin(e, "head", builtin_head);
-	benv_add_builtin(e, "tail", builtin_tail);
-	benv_add_builtin(e, "eval", builtin_eval);
-	benv_add_builtin(e, "join", builtin_join);
-	benv_add_builtin(e, "len", builtin_len);
-	benv_add_builtin(e, "cons", builtin_cons);
-	benv_add_builtin(e, "env", builtin_env);
+// Write one indented line of code
+void aot_line(baot* a, char* fmt, ...) {
+	for(int i=0; i<a->depth; i++) fputc('\t', a->code);
 
-	// Mathematical Functions
-	benv_add_builtin(e, "+", builtin_add);
-	benv_add_builtin(e, "add", builtin_add);
+	va_list va;
+	va_start(va, fmt);
+	vfprintf(a->code, fmt, va);
+	va_end(va);
 
-	benv_add_builtin(e, "-", builtin_sub);
-	benv_add_builtin(e, "sub", builtin_sub);
+	fputc('\n', a->code);
+}
 
-	benv_add_builtin(e, "*", builtin_mul);
-	benv_add_builtin(e, "mul", builtin_mul);
+// Write a string as a C literal, escaping everything but letters and digits
+void aot_cstr(FILE* f, char* s) {
+	fputc('"', f);
+	for(; *s; s++) {
+		if(isalnum((unsigned char)*s) || *s == ' ') fputc(*s, f);
+		else fprintf(f, "\\%03o", (unsigned char)*s);
+	}
+	fputc('"', f);
+}
 
-	benv_add_builtin(e, "/", builtin_div);
-	benv_add_builtin(e, "div", builtin_div);
+// Write C code that builds a copy of 'v'
+void aot_build(FILE* f, bval* v) {
+	switch(v->type) {
+		case BVAL_NUM: fprintf(f, "bval_num(%.17g)", v->num); return;
+		case BVAL_INT:
+			// LLONG_MIN can't be written as a literal
+			if(v->integer == LLONG_MIN) fputs("bval_int(LLONG_MIN)", f);
+			else fprintf(f, "bval_int(%lldLL)", v->integer);
+			return;
+		case BVAL_STR: fputs("bval_str(", f); aot_cstr(f, v->str); fputc(')', f); return;
+		case BVAL_SYM: fputs("bval_sym(", f); aot_cstr(f, v->sym); fputc(')', f); return;
+		default: break;
+	}
 
-	benv_add_builtin(e, "%", builtin_res);
-	benv_add_builtin(e, "res", builtin_res);
+	// Lists, adding each cell to the empty list
+	for(int i=0; i < v->count; i++) fputs("bval_add(", f);
+	fputs((v->type == BVAL_QEXPR) ? "bval_qexpr()" : "bval_sexpr()", f);
+	for(int i=0; i < v->count; i++) {
+		fputs(", ", f);
+		aot_build(f, v->cell[i]);
+		fputc(')', f);
+	}
+}
 
-	benv_add_builtin(e, "^", builtin_pow);
-	benv_add_builtin(e, "pow", builtin_pow);
+// Index in K of a constant copy of 'v', as a S-Expression if 'sexpr'
+int aot_const(baot* a, bval* v, int sexpr) {
+	int k = a->consts++;
+	fprintf(a->init, "\tK[%i] = ", k);
+	aot_build(a->init, v);
+	fputs(";\n", a->init);
 
+	if(sexpr) fprintf(a->init, "\tK[%i]->type = BVAL_SEXPR;\n", k);
+	return k;
+}
 
-	benv_add_builtin(e, "min", builtin_min);
-	benv_add_builtin(e, "max", builtin_max);
+// Index in B of the builtin bound to 'name' at load time
+int aot_builtin_index(baot* a, char* name) {
+	int k = a->builtins++;
+	fprintf(a->init, "\tB[%i] = aot_builtin(e, ", k);
+	aot_cstr(a->init, name);
+	fputs(");\n", a->init);
+	return k;
+}
 
+// Position of 'sym' in the formals being compiled, -1 if not one
+int aot_formal(baot* a, char* sym) {
+	if(!a->formals) return -1;
+	for(int i=0; i < a->formals->count; i++) {
+		if(strcmp(a->formals->cell[i]->sym, sym)==0) return i;
+	}
+	return -1;
 }
 
+int aot_expr(baot* a, bval* v);
+
 /**
- * First it iterates over the passed in arguments attempting
- * to place each one in the environment.
- * Then it checks if the environment is full,
- * and if so evaluates, otherwise returns a copy
- * of itself with some arguments filled
+ * Writes code evaluating the cells of 'v' as a S-Expression,
+ * returns the number of the temporary holding the result
  * */
-bval* bval_call(benv* e, bval* f, bval* a) {
-	// If builtin then simply apply that
-	if(f->builtin)
-		return f->builtin(e, a);
-
-
-	// Record argument counts
-	int given  = a->count;
-	int total = f->formals->count;
-
-	// While arguments still remain to be processed
-	while(a->count) {
-		// If ran out of formal arguments to build
-		if(f->formals->count == 0) {
-			bval_del(a);
-			return bval_err(
-				"Function passed too many arguments. "
-				"Got %i, Expected %i.", given, total);
-		}
-
-		// Pop the first symbol from the formals
-		bval* sym = bval_pop(f->formals, 0);
+int aot_list(baot* a, bval* v) {
+	int t = a->temps++;
 
-		// Special case to deal with '&'
-		if(strcmp(sym->sym, "&")==0
-			&& strcmp(f->formals->cell[0]->sym, "&")==0) {
-
-			// Check to ensure that & is not passed invadily
-			if(f->formals->count != 2)
-				return bval_err("Function format invalid. "
-					"Symbol '&' not followed by single symbol");
+	if(v->count == 0) {
+		aot_line(a, "bval* t%i = bval_sexpr();", t);
+		return t;
+	}
 
-			// Pop and delete '&' symbol
-			bval_del(bval_pop(f->formals, 0));
+	// Single Expression
+	if(v->count == 1) {
+		int x = aot_expr(a, v->cell[0]);
+		aot_line(a, "bval* t%i = t%i;", t, x);
+		return t;
+	}
 
-			// Pop next symbol and create empty list
-			bval* sym = bval_pop(f->formals, 0);
-			bval* val = bval_qexpr();
+	bval* head = v->cell[0];
+	int n = v->count-1;
+
+	// What the head means for code outside any function
+	bval* f = NULL;
+	if(head->type == BVAL_SYM && aot_formal(a, head->sym) == -1)
+		f = benv_lookup(a->e, head->sym, NULL);
+	if(f && (f->type != BVAL_FUN || !f->builtin)) f = NULL;
+
+	aot_line(a, "bval* t%i;", t);
+
+	// 'if' with literal branches becomes a C if
+	if(f && f->builtin == builtin_if && n == 3
+		&& v->cell[2]->type == BVAL_QEXPR && v->cell[3]->type == BVAL_QEXPR) {
+		int ks = aot_const(a, head, 0);
+		int kb = aot_builtin_index(a, head->sym);
+		int kx = aot_const(a, v, 1);
+
+		aot_line(a, "if(aot_is(e, K[%i], B[%i])) {", ks, kb);
+		a->depth++;
+		int c = aot_expr(a, v->cell[1]);
+		aot_line(a, "if(bval_is_num(t%i)) {", c);
+		a->depth++;
+		aot_line(a, "int b%i = bval_val(t%i);", c, c);
+		aot_line(a, "bval_del(t%i);", c);
+		aot_line(a, "if(b%i) {", c);
+		a->depth++;
+		aot_line(a, "t%i = t%i;", t, aot_list(a, v->cell[2]));
+		a->depth--;
+		aot_line(a, "} else {");
+		a->depth++;
+		aot_line(a, "t%i = t%i;", t, aot_list(a, v->cell[3]));
+		a->depth--;
+		aot_line(a, "}");
+		a->depth--;
+		aot_line(a, "} else t%i = aot_if_cond(t%i);", t, c);
+		a->depth--;
+		aot_line(a, "} else t%i = aot_eval(e, K[%i]);", t, kx);
+		return t;
+	}
 
-			// Bind to environment and delete
-			benv_put(f->env, sym, val);
-			bval_del(sym); bval_del(val);
+	// && and || evaluate their operands until the result is known
+	if(f && (f->special == builtin_and_special || f->special == builtin_or_special)) {
+		int is_and = (f->special == builtin_and_special);
+		int ks = aot_const(a, head, 0);
+		int kb = aot_builtin_index(a, head->sym);
+		int kx = aot_const(a, v, 1);
+
+		aot_line(a, "if(aot_is(e, K[%i], B[%i])) {", ks, kb);
+		a->depth++;
+		aot_line(a, "do {");
+		a->depth++;
+		for(int i=1; i<=n; i++) {
+			int x = aot_expr(a, v->cell[i]);
+			aot_line(a, "if(t%i->type == BVAL_ERR) { t%i = t%i; break; }", x, t, x);
+			aot_line(a, "if(%saot_truth(t%i)) { t%i = bval_int(%i); break; }",
+				is_and ? "!" : "", x, t, !is_and);
 		}
+		aot_line(a, "t%i = bval_int(%i);", t, is_and);
+		a->depth--;
+		aot_line(a, "} while(0);");
+		a->depth--;
+		aot_line(a, "} else t%i = aot_eval(e, K[%i]);", t, kx);
+		return t;
+	}
 
-		// Pop the next argument from the list
-		bval* val = bval_pop(a, 0);
+	// Other special forms are left to the interpreter
+	if(f && f->special) {
+		aot_line(a, "t%i = aot_eval(e, K[%i]);", t, aot_const(a, v, 1));
+		return t;
+	}
 
-		// Bind a copy into the function's environment
-		benv_put(f->env, sym, val);
+	// Other builtins are called directly with the arguments evaluated here
+	if(f) {
+		int ks = aot_const(a, head, 0);
+		int kb = aot_builtin_index(a, head->sym);
+		int kx = aot_const(a, v, 1);
+
+		aot_line(a, "if(aot_is(e, K[%i], B[%i])) {", ks, kb);
+		a->depth++;
+		int* args = malloc(sizeof(int) * n);
+		for(int i=0; i<n; i++) args[i] = aot_expr(a, v->cell[i+1]);
+
+		for(int i=0; i<a->depth; i++) fputc('\t', a->code);
+		fprintf(a->code, "bval* a%i[] = {", t);
+		for(int i=0; i<n; i++) fprintf(a->code, "%st%i", i ? ", " : "", args[i]);
+		fputs("};\n", a->code);
+		free(args);
+
+		aot_line(a, "t%i = aot_call(e, B[%i], %i, a%i);", t, kb, n, t);
+		a->depth--;
+		aot_line(a, "} else t%i = aot_eval(e, K[%i]);", t, kx);
+		return t;
+	}
 
-		// Delete symbol and value
-		bval_del(sym); bval_del(val);
+	/**
+	 * Anything else is called as the interpreter would after evaluating
+	 * the cells, unless the name turns out to be a special form
+	 * */
+	if(head->type == BVAL_SYM) {
+		int ks = aot_const(a, head, 0);
+		int kx = aot_const(a, v, 1);
+		aot_line(a, "if(aot_special(e, K[%i])) t%i = aot_eval(e, K[%i]);", ks, t, kx);
+		aot_line(a, "else {");
+	} else {
+		aot_line(a, "{");
 	}
+	a->depth++;
 
-	// Argument list is now bound so can be cleaned up
-	bval_del(a);
+	int* cells = malloc(sizeof(int) * v->count);
+	for(int i=0; i < v->count; i++) cells[i] = aot_expr(a, v->cell[i]);
 
-	// If all formals have been bound evaluate
-	if(f->formals->count == 0) {
-		// Set environment parent to evaluation environment
-		f->env->par = e;
+	for(int i=0; i<a->depth; i++) fputc('\t', a->code);
+	fprintf(a->code, "bval* a%i[] = {", t);
+	for(int i=0; i < v->count; i++) fprintf(a->code, "%st%i", i ? ", " : "", cells[i]);
+	fputs("};\n", a->code);
+	free(cells);
 
-		// Evaluate and return
-		return builtin_eval(f->env,
-			bval_add(bval_sexpr(), bval_copy(f->body)));
-	} else {
-		// Otherwise return partially evaluated function
-		return bval_copy(f);
-	}
+	aot_line(a, "t%i = bval_eval_call(e, aot_sexpr(%i, a%i));", t, v->count, t);
+	a->depth--;
+	aot_line(a, "}");
+	return t;
 }
 
+// Writes code evaluating 'v', returns the number of the temporary holding the result
+int aot_expr(baot* a, bval* v) {
+	if(v->type == BVAL_SEXPR) return aot_list(a, v);
 
-// Define struct of methods
-struct BuiltinMethods {
-	char* name;
-	bval* (*func)(benv*, bval*);
-} bultin_map[] = {
-	{ "list",  builtin_list },
-	{ "head",  builtin_head },
-	{ "tail",  builtin_tail },
-	{ "join",  builtin_join },
-	{ "eval",  builtin_eval },
-	{ "len",   builtin_len  },
-	{ "cons",  builtin_cons }
-	// { "+-/*", builtin_op }
-};
+	int t = a->temps++;
+	switch(v->type) {
+		case BVAL_NUM:
+			aot_line(a, "bval* t%i = bval_num(%.17g);", t, v->num);
+			break;
+		case BVAL_INT:
+			if(v->integer == LLONG_MIN) aot_line(a, "bval* t%i = bval_int(LLONG_MIN);", t);
+			else aot_line(a, "bval* t%i = bval_int(%lldLL);", t, v->integer);
+			break;
 
-bval* builtin(benv* e, bval* a, char* func) {
-	int num_methods = sizeof(bultin_map) / sizeof(bultin_map[0]); // Find array lenght
+		case BVAL_SYM: {
+			// Formals are the first bindings of the frame
+			int i = aot_formal(a, v->sym);
+			if(i != -1) aot_line(a, "bval* t%i = bval_copy(e->vals[%i]);", t, i);
+			else aot_line(a, "bval* t%i = benv_get(e, K[%i]);", t, aot_const(a, v, 0));
+			break;
+		}
 
-	// Get operator index
-	// bval* builtin;
-	for(int i=0; i<num_methods; i++) {
-		if(strcmp(func, bultin_map[i].name)==0)
-			return bultin_map[i].func(e, a);
-		else if(strstr("+-*/%^ \
-						add sub mul div res pow min max", func))
-			return builtin_op(e, a, func);
+		// Strings and Q-Expressions evaluate to themselves
+		default:
+			aot_line(a, "bval* t%i = bval_copy(K[%i]);", t, aot_const(a, v, 0));
+			break;
 	}
-
-	bval_del(a);
-	return bval_err("Unknown Function!");
+	return t;
 }
 
+// Checks 'v' calls 'name' and it is bound to the builtin 'func'
+int aot_is_call(baot* a, bval* v, char* name, bbuiltin func) {
+	if(v->cell[0]->type != BVAL_SYM || strcmp(v->cell[0]->sym, name)!=0) return 0;
 
-bval* bval_eval_sexpr(benv* e, bval* v) {
-	// Evaluate Children
-	for(int i=0; i < v->count; i++) {
-		v->cell[i] = bval_eval(e, v->cell[i]);
-	}
+	bval* f = benv_lookup(a->e, name, NULL);
+	return f && f->type == BVAL_FUN && f->builtin == func;
+}
 
-	// Error Checking
-	for(int i=0; i < v->count; i++) {
-		if(v->cell[i]->type == BVAL_ERR) return bval_take(v, i); 
+// Checks 'v' is (def {name} (\ {formals} {body})) with fixed, distinct formals
+int aot_is_defun(baot* a, bval* v) {
+	if(v->type != BVAL_SEXPR || v->count != 3) return 0;
+	if(!aot_is_call(a, v, "def", builtin_def)) return 0;
+	if(v->cell[1]->type != BVAL_QEXPR || v->cell[1]->count != 1
+		|| v->cell[1]->cell[0]->type != BVAL_SYM) return 0;
+
+	bval* l = v->cell[2];
+	if(l->type != BVAL_SEXPR || l->count != 3) return 0;
+	if(!aot_is_call(a, l, "\\", builtin_lambda)) return 0;
+	if(l->cell[1]->type != BVAL_QEXPR || l->cell[2]->type != BVAL_QEXPR) return 0;
+
+	bval* formals = l->cell[1];
+	for(int i=0; i < formals->count; i++) {
+		if(formals->cell[i]->type != BVAL_SYM) return 0;
+		if(strcmp(formals->cell[i]->sym, "&")==0) return 0;
+		for(int j=0; j<i; j++) {
+			if(strcmp(formals->cell[i]->sym, formals->cell[j]->sym)==0) return 0;
+		}
 	}
+	return 1;
+}
 
-	// Empty Expression
-	if(v->count == 0) return v;
-
-	// Single Expression
-	if(v->count == 1) return bval_take(v, 0);
-
-	// Ensure First Element is a function after evaluation
-	bval* f = bval_pop(v, 0);
-	if(f->type != BVAL_FUN) {
-		bval* err = bval_err(
-			"S-Expression starts with incorrect type "
-			"Got %s, Expected %s",
-			btype_name(f->type), btype_name(BVAL_FUN));
-
-		bval_del(v); bval_del(f);
-		return err;
+// Writes a function top_<n> evaluating the top level expression 'v'
+void aot_top_level(baot* a, bval* v, int n) {
+	if(aot_is_defun(a, v)) {
+		bval* formals = v->cell[2]->cell[1];
+		bval* body    = v->cell[2]->cell[2];
+		int k  = a->funs++;
+		int nf = formals->count;
+
+		// The function, with a fast path like builtins
+		int* kf = malloc(sizeof(int) * (nf ? nf : 1));
+		for(int i=0; i<nf; i++) kf[i] = aot_const(a, formals->cell[i], 0);
+
+		aot_line(a, "static bval* fn_%i_fast(benv* c, int argc, bval** argv) {", k);
+		a->depth++;
+		aot_line(a, "bval* r = aot_args(F[%i], %i, argc, argv);", k, nf);
+		aot_line(a, "if(r) return r;");
+
+		for(int i=0; i<a->depth; i++) fputc('\t', a->code);
+		fputs("bval* formals[] = {", a->code);
+		for(int i=0; i<nf; i++) fprintf(a->code, "%sK[%i]", i ? ", " : "", kf[i]);
+		fputs(nf ? "};\n" : "NULL};\n", a->code);
+		free(kf);
+
+		aot_line(a, "benv* e = aot_frame(c, %i, formals, argv);", nf);
+		a->formals = formals;
+		int x = aot_list(a, body);
+		a->formals = NULL;
+		aot_line(a, "benv_del(e);");
+		aot_line(a, "return t%i;", x);
+		a->depth--;
+		aot_line(a, "}");
+		aot_line(a, "");
+		aot_line(a, "static bval* fn_%i(benv* e, bval* a) {", k);
+		aot_line(a, "\treturn builtin_fast(e, a, fn_%i_fast);", k);
+		aot_line(a, "}");
+		aot_line(a, "");
+
+		// The definition, if 'def' and '\' still mean the builtins
+		int kd  = aot_const(a, v->cell[0], 0);
+		int kbd = aot_builtin_index(a, "def");
+		int kl  = aot_const(a, v->cell[2]->cell[0], 0);
+		int kbl = aot_builtin_index(a, "\\");
+		int kn  = aot_const(a, v->cell[1]->cell[0], 0);
+		int kx  = aot_const(a, v, 0);
+
+		aot_line(a, "static bval* top_%i(benv* e) {", n);
+		aot_line(a, "\tif(!aot_is(e, K[%i], B[%i]) || !aot_is(e, K[%i], B[%i]))", kd, kbd, kl, kbl);
+		aot_line(a, "\t\treturn aot_eval(e, K[%i]);", kx);
+		aot_line(a, "\tif(F[%i]) bval_del(F[%i]);", k, k);
+		aot_line(a, "\tF[%i] = aot_def(e, K[%i], fn_%i, fn_%i_fast);", k, kn, k, k);
+		aot_line(a, "\treturn bval_sexpr();");
+		aot_line(a, "}");
+		aot_line(a, "");
+		return;
 	}
 
-	// If so call function to get result
-	// bval* result = f->builtin(e, v);
-	// bval_del(f);
-	// return result;
-	bval* result = bval_call(e, f, v);
-	return result;
+	aot_line(a, "static bval* top_%i(benv* e) {", n);
+	a->depth++;
+	aot_line(a, "return t%i;", aot_expr(a, v));
+	a->depth--;
+	aot_line(a, "}");
+	aot_line(a, "");
 }
 
-bval* bval_eval(benv* e, bval* v) {
-	// Evaluate Sexpressions
-	if(v->type == BVAL_SYM) {
-		bval* x = benv_get(e, v);
-		bval_del(v);
-		return x;
-	}
-	if(v->type == BVAL_SEXPR) return bval_eval_sexpr(e, v);
-	return v;
-
-	// All other bval types ramin the same
+// Copy what was written to 'from' at the end of 'to'
+void aot_append(FILE* to, FILE* from) {
+	char buf[4096];
+	size_t n;
+	rewind(from);
+	while((n = fread(buf, 1, sizeof(buf), from)) > 0)
+		fwrite(buf, 1, n, to);
+}
 
+// Adds the words of 'words' split at spaces to 'argv', keeping them in 'buf'
+int aot_words(char** argv, int argc, char* words, char* buf) {
+	strcpy(buf, words);
+	for(char* w = strtok(buf, " \t"); w; w = strtok(NULL, " \t"))
+		argv[argc++] = w;
+	return argc;
 }
 
+/**
+ * Runs the command 'argv' (NULL terminated) without a shell, so paths
+ * with spaces stay a single argument. Returns its exit status
+ * */
+int aot_run(char** argv) {
+	// Printed as it could be typed again
+	for(int i=0; argv[i]; i++)
+		printf(strchr(argv[i], ' ') ? "%s\"%s\"" : "%s%s", i ? " " : "", argv[i]);
+	putchar('\n');
+	fflush(stdout);
 
+#ifdef __unix__
+	pid_t pid = fork();
+	if(pid < 0) {
+		perror("fork");
+		return 1;
+	}
+	if(pid == 0) {
+		execvp(argv[0], argv);
+		perror(argv[0]);
+		_exit(127);
+	}
 
+	int status;
+	if(waitpid(pid, &status, 0) < 0) return 1;
+	return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+#else
+	// Each argument quoted for the shell
+	size_t len = 1;
+	for(int i=0; argv[i]; i++) len += strlen(argv[i]) + 3;
+	char* cmd = malloc(len);
+	if(!cmd) return 1;
+
+	char* to = cmd;
+	for(int i=0; argv[i]; i++) to += sprintf(to, "%s\"%s\"", i ? " " : "", argv[i]);
+	int status = system(cmd);
+	free(cmd);
+	return status;
+#endif
+}
 
-/*************************/
-/* READ                  */
-/*************************/
+/**
+ * Compiles the script 'file' to C in 'cfile', then builds 'output'
+ * with the compiler, finding main.c in 'home'.
+ * Returns 0 on success
+ * */
+int aot_compile(benv* e, char* file, char* cfile, char* output, char* home) {
+	mpc_result_t r;
+	if(!mpc_parse_contents(file, Altbat, &r)) {
+		mpc_err_print(r.error);
+		mpc_err_delete(r.error);
+		return 1;
+	}
 
-bval* bval_read_num(mpc_ast_t* t) {
-	errno = 0;
-	double x = atof(t->contents);
-	return (errno != ERANGE) ? bval_num(x)
-		: bval_err("Error: Invalid Number!");
-}
+	bval* expr = bval_read(r.output);
+	mpc_ast_delete(r.output);
 
-bval* bval_read_str(mpc_ast_t* t) {
-	// Cut off the final quote character
-	t->contents[strlen(t->contents)-1] = '\0';
+	baot a = { e, tmpfile(), tmpfile(), 0, 0, 0, 0, 0, NULL };
+	if(!a.code || !a.init) {
+		fprintf(stderr, "Could not create temporary files\n");
+		bval_del(expr);
+		return 1;
+	}
 
-	// Copy the string missing out the first quote character
-	char* unescaped = malloc(strlen(t->contents+1)+1);
-	strcpy(unescaped, t->contents+1);
+	for(int i=0; i < expr->count; i++)
+		aot_top_level(&a, expr->cell[i], i);
 
-	// Pass through the unescaped function
-	unescaped = mpcf_unescape(unescaped);
-	bval* str = bval_str(unescaped);
+	FILE* out = fopen(cfile, "w");
+	if(!out) {
+		fprintf(stderr, "Could not write %s\n", cfile);
+		fclose(a.code); fclose(a.init);
+		bval_del(expr);
+		return 1;
+	}
 
-	// Free the string and return
-	free(unescaped);
-	return str;
+	fprintf(out, "// Generated by altbat --emit-c from %s\n", file);
+	fputs("#include \"main.c\"\n\n", out);
+	fprintf(out, "static bval* K[%i];\n", a.consts ? a.consts : 1);
+	fprintf(out, "static bval* B[%i];\n", a.builtins ? a.builtins : 1);
+	fprintf(out, "static bval* F[%i];\n\n", a.funs ? a.funs : 1);
+	aot_append(out, a.code);
+
+	fputs("void aot_load(benv* e) {\n", out);
+	aot_append(out, a.init);
+	fputc('\n', out);
+	for(int i=0; i < expr->count; i++)
+		fprintf(out, "\taot_top(top_%i(e));\n", i);
+	fputs("}\n", out);
+
+	fclose(out);
+	fclose(a.code); fclose(a.init);
+	bval_del(expr);
+
+	// Build it
+	int lib = strlen(output) > 3 && strcmp(output + strlen(output)-3, ".so")==0;
+	char* cc = getenv("CC");
+	char* flags = getenv("ALTBAT_CFLAGS");
+	if(!cc) cc = "cc";
+	if(!flags) flags = "";
+
+	// $CC and $ALTBAT_CFLAGS may hold several words, each is an argument
+	size_t words = strlen(cc) + strlen(flags) + 2;
+	char* buf   = malloc(words + strlen(home) * 2 + 32);
+	char** argv = malloc(sizeof(char*) * (words + 16));
+	if(!buf || !argv) {
+		fprintf(stderr, "Could not allocate the compiler command\n");
+		free(buf); free(argv);
+		return 1;
+	}
+
+	char* include = buf + words;
+	char* mpc = include + strlen(home) + 3;
+	sprintf(include, "-I%s", home);
+	sprintf(mpc, "%s/libs/mpc/mpc.c", home);
+
+	int argc = aot_words(argv, 0, cc, buf);
+	argv[argc++] = "-O2";
+	argv[argc++] = "-std=c99";
+	if(lib) {
+		argv[argc++] = "-shared";
+		argv[argc++] = "-fPIC";
+		argv[argc++] = "-DALTBAT_AOT_LIB";
+	} else {
+		argv[argc++] = "-DALTBAT_AOT";
+	}
+	argc = aot_words(argv, argc, flags, buf + strlen(cc) + 1);
+	argv[argc++] = include;
+	argv[argc++] = cfile;
+	argv[argc++] = mpc;
+	argv[argc++] = "-lm";
+	argv[argc++] = "-o";
+	argv[argc++] = output;
+	argv[argc] = NULL;
+
+	int status = aot_run(argv);
+	free(buf);
+	free(argv);
+	return status != 0;
 }
 
-bval* bval_read(mpc_ast_t* t) {
-	// If Symbol or Number return conversion to that type
-	if(strstr(t->tag, "number")) return bval_read_num(t);
-	if(strstr(t->tag, "symbol")) return bval_sym(t->contents);
+/**
+ * altbat --emit-c [-o output] files...
+ * script.abat gives script.c and the executable script,
+ * unless another output is given
+ * */
+int aot_main(benv* e, char* exe, int argc, char** files, char* output) {
+	// Directory of main.c
+	char* home = getenv("ALTBAT_HOME");
+	char* dir = NULL;
+	if(!home) {
+		char* slash = strrchr(exe, '/');
+		int len = slash ? slash - exe : 1;
+
+		dir = malloc(len + 1);
+		memcpy(dir, slash ? exe : ".", len);
+		dir[len] = '\0';
+		home = dir;
+	}
 
-	if(strstr(t->tag, "string")) return bval_read_str(t);
+	int status = 0;
+	for(int i=0; i<argc; i++) {
+		char* base = malloc(strlen(files[i]) + 3);
+		strcpy(base, files[i]);
 
-	// If root (>) or sexpr then create empty list
-	bval* x = NULL;
-	if(strcmp(t->tag, ">")==0) x = bval_sexpr();
-	if(strstr(t->tag, "sexpr")) x = bval_sexpr();
-	if(strstr(t->tag, "qexpr")) x = bval_qexpr();
+		char* ext = strrchr(base, '.');
+		if(ext && strcmp(ext, ".abat")==0) *ext = '\0';
 
-	// Fill this list with any valid expression contained within
-	for(int i=0; i < t->children_num; i++) {
-		if(strcmp(t->children[i]->contents, "(")==0
-			|| strcmp(t->children[i]->contents, ")")==0
-			|| strcmp(t->children[i]->contents, "{")==0
-			|| strcmp(t->children[i]->contents, "}")==0
-			|| strcmp(t->children[i]->tag, "regex")==0
-			|| strstr(t->children[i]->tag, "comment")) continue;
+		char* cfile = malloc(strlen(base) + 3);
+		sprintf(cfile, "%s.c", base);
 
-		x = bval_add(x, bval_read(t->children[i]));
+		status |= aot_compile(e, files[i], cfile, output ? output : base, home);
+		free(base); free(cfile);
 	}
 
-	return x;
+	free(dir);
+	return status;
 }
 
 
 
 
+#ifdef ALTBAT_AOT
+void aot_load(benv* e);
+#endif
+
+// Shared objects built by --emit-c have their own aot_load and no main
+#ifndef ALTBAT_AOT_LIB
 int main(int argc, char** argv) {
 	// Create some parses
 	Number  = mpc_new("number");
@@ -1630,17 +8639,54 @@ int main(int argc, char** argv) {
 			altbat  : /^/ <expr>+ /$/ ; ",
 		Number, String, Comment, Symbol, Sexpr, Qexpr, Expr, Altbat);
 
+	benv* e = benv_new();
+	benv_add_builtins(e);
+
+#ifdef ALTBAT_AOT
+	// Executable built by --emit-c, runs the compiled script
+	aot_load(e);
+#else
+	// Parse options, leaving only the filenames in argv
+	int emit = 0;
+	char* output = NULL;
+	int files = 1;
+	for(int i=1; i<argc; i++) {
+		if(strcmp(argv[i], "-O0")==0)
+			opt_enabled = 0;
+		else if(strcmp(argv[i], "--dump-opt")==0)
+			opt_dump = 1;
+		else if(strcmp(argv[i], "--emit-c")==0)
+			emit = 1;
+		else if(strcmp(argv[i], "--no-jit")==0)
+			jit_enabled = 0;
+		else if(strcmp(argv[i], "--jit-verify")==0)
+			jit_verify = 1;
+		else if(strcmp(argv[i], "--fuel")==0 && i+1 < argc)
+			eval_fuel = atol(argv[++i]);
+		else if(strcmp(argv[i], "--timeout")==0 && i+1 < argc)
+			eval_timeout = atol(argv[++i]);
+		else if(strcmp(argv[i], "-o")==0 && i+1 < argc)
+			output = argv[++i];
+		else
+			argv[files++] = argv[i];
+	}
+	argc = files;
+
+	// Compile the files instead of running them
+	if(emit) {
+		int status = aot_main(e, argv[0], argc-1, argv+1, output);
+		benv_del(e);
+		mpc_cleanup(8,
+			Number, String, Comment, Symbol,
+			Sexpr, Qexpr, Expr, Altbat);
+		return status;
+	}
+
 	// Vakon
 	puts("Altbat Version 1.0.0");
 	puts("Press Ctrl+c to Exit");
 	puts("Type \"author\" for more information.\n");
 
-
-
-
-	benv* e = benv_new();
-	benv_add_builtins(e);
-
 	// Interactive prompt
 	if(argc==1) {
 		while(1) {
@@ -1661,7 +8707,9 @@ int main(int argc, char** argv) {
 			if(mpc_parse("<stdin>", input, Altbat, &r)) {
 				// Sucess
 
-				bval* x = bval_eval(e, bval_read(r.output));
+				int began = eval_begin();
+				bval* x = bval_eval(e, bval_opt(e, bval_read(r.output)));
+				eval_end(began);
 				bval_println(x);
 				bval_del(x);
 
@@ -1695,6 +8743,7 @@ int main(int argc, char** argv) {
 			bval_del(x);
 		}
 	}
+#endif
 
 	benv_del(e);
 
@@ -1703,6 +8752,7 @@ int main(int argc, char** argv) {
 		Number, String, Comment, Symbol,
 		Sexpr, Qexpr, Expr, Altbat);
 }
+#endif
 
 
 
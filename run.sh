@@ -1,4 +1,4 @@
 #cc main.c -std=c99 -Wall -ledit -lm libs/mpc/mpc.c -o altbat
-cc main.c -std=c99 -Wall -ledit -lm libs/mpc/mpc.c -g -o altbat
+cc main.c -std=c99 -Wall -ledit -lm -ldl -rdynamic libs/mpc/mpc.c -g -o altbat
 #cc main.c -Wall -std=c99 -ledit -o albat
 ./altbat
@@ -0,0 +1,88 @@
+#!/bin/sh
+# Checks the JIT computes what the interpreter does: each program is run
+# with --no-jit and with the JIT under --jit-verify (which prints any
+# native call that differs from the interpreter) and the outputs are compared.
+# Functions are called more than JIT_THRESHOLD times so they get compiled.
+#
+# Usage: sh tests/jit.sh [altbat binary]
+
+ALTBAT=${1:-./altbat}
+
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+fail=0
+
+# Run the program read from stdin both ways, 'name' is shown on a difference
+check() {
+	cat > "$DIR/$1.abat"
+	"$ALTBAT" --no-jit "$DIR/$1.abat" > "$DIR/interp.txt" 2>&1
+	"$ALTBAT" --jit-verify "$DIR/$1.abat" > "$DIR/jit.txt" 2>&1
+	if grep -q "Could not load" "$DIR/interp.txt"; then
+		echo "FAIL $1"
+		cat "$DIR/interp.txt"
+		fail=1
+	elif ! cmp -s "$DIR/interp.txt" "$DIR/jit.txt"; then
+		echo "FAIL $1"
+		diff "$DIR/interp.txt" "$DIR/jit.txt"
+		fail=1
+	fi
+}
+
+check arith <<'ABAT'
+(def {f} (\ {x y} {+ (* x 3) (- y x) (max x y) (min x y)}))
+(def {g} (\ {x y} {+ (* x 0.5) (- y x)}))
+(def {loop} (\ {n acc} {if (== n 0) {acc} {loop (- n 1) (+ acc (f n (* n 2)) (g (* n 1.0) 2.5))}}))
+(print (loop 500 0))
+(def {cmp} (\ {x y} {if (&& (< x y) (|| (>= x 0) (!= y 3))) {1} {0}}))
+(print (foldl + 0 (map (\ {i} {cmp i 250}) (range -100 500))))
+ABAT
+
+# Results that don't fit in 64 bits become doubles, each function
+# overflows only after it was compiled
+check overflow <<'ABAT'
+(def {sq} (\ {x} {* x x}))
+(print (map sq (range 3037000300 3037000600 2)))
+(def {add} (\ {x y} {+ x y}))
+(print (map (\ {i} {add i 9223372036854775357}) (range 0 600 3)))
+(def {sub} (\ {x y} {- x y}))
+(print (map (\ {i} {sub (- 0 9223372036854775000) i}) (range 0 1000 5)))
+ABAT
+
+# Division by zero and integer division with a remainder go back to the interpreter
+check division <<'ABAT'
+(def {h} (\ {x} {div x 4}))
+(print (map h (range 0 150)))
+(def {d} (\ {x y} {div x y}))
+(print (map (\ {i} {d 100 (- i 150)}) (range 0 200)))
+(def {q} (\ {x y} {div x y}))
+(print (map (\ {i} {q (* i 1.5) (- (* i 1.0) 150.0)}) (range 0 200)))
+ABAT
+
+check recursion <<'ABAT'
+(def {fib} (\ {n} {if (< n 2) {n} {+ (fib (- n 1)) (fib (- n 2))}}))
+(print (fib 22))
+(def {fibf} (\ {n} {if (< n 2.0) {n} {+ (fibf (- n 1.0)) (fibf (- n 2.0))}}))
+(print (fibf 18.0))
+ABAT
+
+check mutual <<'ABAT'
+(def {even} (\ {n} {if (== n 0) {1} {odd (- n 1)}}))
+(def {odd} (\ {n} {if (== n 0) {0} {even (- n 1)}}))
+(print (map even (range 0 300 7)))
+(def {ping} (\ {n acc} {if (<= n 0) {acc} {pong (- n 1) (* acc 3)}}))
+(def {pong} (\ {n acc} {if (<= n 0) {acc} {ping (- n 1) (+ acc 1)}}))
+(print (map (\ {i} {ping i 1}) (range 0 150)))
+ABAT
+
+# A function redefined after it was compiled
+check redefine <<'ABAT'
+(def {k} (\ {x} {+ x 1}))
+(def {use} (\ {x} {* (k x) 2}))
+(print (foldl + 0 (map use (range 200))))
+(def {k} (\ {x} {- x 1}))
+(print (foldl + 0 (map use (range 200))))
+ABAT
+
+[ $fail = 0 ] && echo "ok"
+exit $fail
@@ -0,0 +1,103 @@
+#!/bin/sh
+# Checks the optimizer doesn't change what programs compute: each
+# program is run with and without -O0 and the outputs are compared.
+#
+# Usage: sh tests/opt.sh [altbat binary]
+
+ALTBAT=${1:-./altbat}
+
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+fail=0
+
+# Run the program read from stdin both ways, 'name' is shown on a difference
+check() {
+	cat > "$DIR/$1.abat"
+	"$ALTBAT" -O0 "$DIR/$1.abat" > "$DIR/O0.txt" 2>&1
+	"$ALTBAT" "$DIR/$1.abat" > "$DIR/opt.txt" 2>&1
+	if grep -q "Could not load" "$DIR/O0.txt"; then
+		echo "FAIL $1"
+		cat "$DIR/O0.txt"
+		fail=1
+	elif ! cmp -s "$DIR/O0.txt" "$DIR/opt.txt"; then
+		echo "FAIL $1"
+		diff "$DIR/O0.txt" "$DIR/opt.txt"
+		fail=1
+	fi
+}
+
+check fold <<'ABAT'
+(print (* 60 60 24) (+ 1 (* 2 3)) (div 7 2))
+(print (div 1 0))
+(def {+} -)
+(print (+ 5 3))
+ABAT
+
+# Folds in a lambda body are used only while their builtins are still bound
+check fold-body <<'ABAT'
+(def {f} (\ {x} {+ x (* 2 3)}))
+(print (f 1))
+(def {*} +)
+(print (f 1))
+(def {n} (\ {x} {+ x (* 2 (- 5 3)) (+ 1 1)}))
+(print (n 0))
+(def {-} +)
+(print (n 0))
+ABAT
+
+# A caller's formal can rebind a builtin a body folded
+check fold-formal <<'ABAT'
+(def {f} (\ {x} {+ x (* 2 3)}))
+(def {g} (\ {*} {f 1}))
+(print (f 1) (g -) (g +))
+(def {k} (\ {x} {* x (+ 1 (* 60 60 24))}))
+(def {h} (\ {+} {k 1}))
+(print (k 1) (h -))
+ABAT
+
+check inline <<'ABAT'
+(def {inc} (\ {x} {+ x 1}))
+(def {sq} (\ {x} {* x x}))
+(def {y} 3)
+(print (inc y) (inc (sq y)) (inc (* y 2)))
+(def {inc} (\ {x} {- x 1}))
+(print (inc y))
+ABAT
+
+# A lambda called by the body sees the function's formals as it is dynamically scoped
+check scope <<'ABAT'
+(def {h} (\ {d} {x}))
+(def {f} (\ {x} {+ x (h 0)}))
+(def {x} 100)
+(print (f 5))
+(def {g} (\ {x} {+ x (k)}))
+(def {k} (\ {} {x}))
+(print (g 5))
+(def {ap} (\ {fn x} {+ x (fn 0)}))
+(print (ap h 1))
+ABAT
+
+# Arguments are evaluated before the body
+check order <<'ABAT'
+(def {a} (\ {n} {do (print "a") n}))
+(def {b} (\ {n} {do (print "b") n}))
+(def {f} (\ {x} {+ (b 0) x}))
+(print (f (a 0)))
+(def {g} (\ {x} {- 10 x}))
+(print (g (a 1)))
+(def {two} (\ {x y} {+ y x}))
+(print (two (a 1) 2))
+ABAT
+
+check branch <<'ABAT'
+(def {pick} (\ {c x} {if c {x} {0}}))
+(print (pick 1 5) (pick 0 5))
+(def {side} (\ {n} {do (print "side") n}))
+(print (pick 0 (side 5)))
+(def {both} (\ {p q} {&& p q}))
+(print (both 0 (side 1)))
+ABAT
+
+[ $fail = 0 ] && echo "ok"
+exit $fail
@@ -0,0 +1,55 @@
+#!/bin/sh
+# Checks the output of the string, string builder and regex builtins, in
+# particular that numbers are written with all the digits they need.
+#
+# Usage: sh tests/strings.sh [altbat binary]
+
+ALTBAT=${1:-./altbat}
+
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+fail=0
+
+# Run the program read from stdin and compare what it prints with 'expected'
+expect() {
+	cat > "$DIR/$1.abat"
+	# Skip the version banner and the space print leaves after each value
+	"$ALTBAT" "$DIR/$1.abat" 2>&1 | tail -n +5 | sed 's/ *$//' > "$DIR/out.txt"
+	printf '%s\n' "$2" > "$DIR/expected.txt"
+	if ! cmp -s "$DIR/expected.txt" "$DIR/out.txt"; then
+		echo "FAIL $1"
+		diff "$DIR/expected.txt" "$DIR/out.txt"
+		fail=1
+	fi
+}
+
+expect num-str '"0.25" "3.14159" "-2.5" "0.30000000000000004" "42" "3"
+1 1' <<'ABAT'
+(print (num->str 0.25) (num->str 3.14159) (num->str -2.5) (num->str (+ 0.1 0.2)) (num->str 42) (num->str 3.0))
+(def {x} (div 1.0 3))
+(print (== x (str->num (num->str x))) (== 0.1 (str->num (num->str 0.1))))
+ABAT
+
+expect append '"2.75,0.125,-1.5,7"
+"x=3.14159 y=0.3333333333333333"' <<'ABAT'
+(def {b} (builder ""))
+(append b 2.75 "," 0.125 "," -1.5 "," 7)
+(print (build b))
+(print (build (append (builder "x=") 3.14159 " y=" (div 1.0 3))))
+ABAT
+
+expect strings '5 "batman" "man" 3
+{"a" "b" "c"} "BAT" "a-b-c"' <<'ABAT'
+(print (str-len "hello") (concat "bat" "man") (substr "batman" 3 6) (index-of "batman" "man"))
+(print (split "a,b,c" ",") (upper "bat") (replace "a b c" " " "-"))
+ABAT
+
+expect regex '1 0 {"a"} {"a"}
+"a  " "  a" {"1" ",22"}' <<'ABAT'
+(print (re-match "^a*a$" "aa") (re-match "a$b" "ab") (re-find-all "^a" "aaa") (re-find-all "a$" "aaa"))
+(print (re-replace "^\\s+" "  a  " "") (re-replace "\\s+$" "  a  " "") (re-find-all "(^|,)[0-9]+" "1,22,x3"))
+ABAT
+
+[ $fail = 0 ] && echo "ok"
+exit $fail
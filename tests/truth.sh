@@ -0,0 +1,42 @@
+#!/bin/sh
+# Checks which values '&&', '||' and 'filter' take as true:
+# empty lists, strings, ranges, vectors and dictionaries are false.
+#
+# Usage: sh tests/truth.sh [altbat binary]
+
+ALTBAT=${1:-./altbat}
+
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+fail=0
+
+# Run the program read from stdin and compare what it prints with 'expected'
+expect() {
+	cat > "$DIR/$1.abat"
+	# Skip the version banner and the space print leaves after each value
+	"$ALTBAT" "$DIR/$1.abat" 2>&1 | tail -n +5 | sed 's/ *$//' > "$DIR/out.txt"
+	printf '%s\n' "$2" > "$DIR/expected.txt"
+	if ! cmp -s "$DIR/expected.txt" "$DIR/out.txt"; then
+		echo "FAIL $1"
+		diff "$DIR/expected.txt" "$DIR/out.txt"
+		fail=1
+	fi
+}
+
+expect empty '0 0 0 0 0 0 0' <<'ABAT'
+(def {t} (\ {x} {|| x 0}))
+(print (t {}) (t "") (t (range 0 0)) (t (tail (range 1))) (t (vec {})) (t (del (dict "a" 1) "a")) (t (range 5 0)))
+ABAT
+
+expect not-empty '1 1 1 1 1 1 1' <<'ABAT'
+(def {t} (\ {x} {&& x 1}))
+(print (t {0}) (t "a") (t (range 0 1)) (t (tail (range 2))) (t (vec {0})) (t (dict "a" 0)) (t (range 5 0 -1)))
+ABAT
+
+expect filter '{{1} [2]}' <<'ABAT'
+(print (filter (\ {x} {x}) (list (range 0 0) {1} (vec {}) (vec {2}) (del (dict "a" 1) "a"))))
+ABAT
+
+[ $fail = 0 ] && echo "ok"
+exit $fail